@@ -0,0 +1,235 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/* lrproxy-archive: adds states to a pack, and lists, extracts and verifies them */
+
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int usage(char const* const name) {
+    fprintf(stderr, "Usage: %s list pack\n", name);
+    fprintf(stderr, "       %s add pack state...\n", name);
+    fprintf(stderr, "       %s get pack number output\n", name);
+    fprintf(stderr, "       %s verify pack\n", name);
+    fprintf(stderr, "States are numbered from 1.\n");
+    return 1;
+}
+
+static void* read_file(char const* const path, size_t* const size) {
+    FILE* const file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    void* data = NULL;
+
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long const length = ftell(file);
+
+        if (length >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc(length != 0 ? (size_t)length : 1);
+
+            if (data != NULL && fread(data, 1, (size_t)length, file) != (size_t)length) {
+                free(data);
+                data = NULL;
+            }
+
+            *size = (size_t)length;
+        }
+    }
+
+    fclose(file);
+    return data;
+}
+
+static void print_totals(pack_t const* const pack) {
+    printf(
+        "%zu states, %llu KiB, in %zu chunks of %llu KiB (%.2f%%)\n",
+        pack->state_count,
+        (unsigned long long)(pack->state_bytes / 1024),
+        pack->chunk_count,
+        (unsigned long long)(pack->chunk_bytes / 1024),
+        pack->state_bytes != 0 ? (double)pack->chunk_bytes * 100.0 / (double)pack->state_bytes : 0.0
+    );
+}
+
+static int list(pack_t* const pack) {
+    for (size_t i = 0; i < pack->state_count; i++) {
+        size_t size, chunks;
+        uint64_t hash;
+
+        if (pack_info(pack, i, &size, &hash, &chunks)) {
+            printf("%6zu %12zu bytes %6zu chunks %016llx\n", i + 1, size, chunks, (unsigned long long)hash);
+        }
+    }
+
+    print_totals(pack);
+    return 0;
+}
+
+static int add(pack_t* const pack, int const count, char* paths[]) {
+    int result = 0;
+
+    for (int i = 0; i < count; i++) {
+        size_t size, index;
+        void* const data = read_file(paths[i], &size);
+
+        if (data == NULL) {
+            fprintf(stderr, "Couldn't read \"%s\"\n", paths[i]);
+            result = 1;
+            continue;
+        }
+
+        if (pack_add(pack, data, size, &index)) {
+            printf("%6zu %s\n", index + 1, paths[i]);
+        }
+        else {
+            fprintf(stderr, "Couldn't add \"%s\"\n", paths[i]);
+            result = 1;
+        }
+
+        free(data);
+    }
+
+    print_totals(pack);
+    return result;
+}
+
+static int get(pack_t* const pack, char const* const number, char const* const path) {
+    size_t const index = (size_t)strtoul(number, NULL, 10) - 1;
+    size_t size, chunks;
+    uint64_t hash;
+
+    if (!pack_info(pack, index, &size, &hash, &chunks)) {
+        fprintf(stderr, "No state %s in the pack\n", number);
+        return 1;
+    }
+
+    void* const data = malloc(size != 0 ? size : 1);
+
+    if (data == NULL || !pack_load(pack, index, data)) {
+        fprintf(stderr, "Couldn't load state %s\n", number);
+        free(data);
+        return 1;
+    }
+
+    FILE* const file = fopen(path, "wb");
+    bool const ok = file != NULL && fwrite(data, 1, size, file) == size;
+
+    if (file != NULL && fclose(file) != 0) {
+        fprintf(stderr, "Couldn't write \"%s\"\n", path);
+        free(data);
+        return 1;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Couldn't write \"%s\"\n", path);
+    }
+
+    free(data);
+    return ok ? 0 : 1;
+}
+
+static int verify(pack_t* const pack) {
+    size_t failed = 0;
+    void* data = NULL;
+    size_t capacity = 0;
+
+    for (size_t i = 0; i < pack->state_count; i++) {
+        size_t size, chunks;
+        uint64_t hash;
+
+        if (!pack_info(pack, i, &size, &hash, &chunks)) {
+            failed++;
+            continue;
+        }
+
+        if (size > capacity) {
+            void* const buffer = realloc(data, size);
+
+            if (buffer == NULL) {
+                failed++;
+                continue;
+            }
+
+            data = buffer;
+            capacity = size;
+        }
+
+        if (!pack_load(pack, i, data) || pack_hash(data, size) != hash) {
+            printf("%6zu is damaged\n", i + 1);
+            failed++;
+        }
+    }
+
+    free(data);
+    printf("%zu states, %zu damaged\n", pack->state_count, failed);
+    return failed != 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        return usage(argv[0]);
+    }
+
+    char const* const command = argv[1];
+    bool const writable = strcmp(command, "add") == 0;
+    pack_t pack;
+
+    if (strcmp(command, "list") != 0 && strcmp(command, "add") != 0 && strcmp(command, "get") != 0 && strcmp(command, "verify") != 0) {
+        return usage(argv[0]);
+    }
+
+    if (strcmp(command, "get") == 0 && argc != 5) {
+        return usage(argv[0]);
+    }
+
+    if (!pack_open(&pack, argv[2], writable)) {
+        fprintf(stderr, "Couldn't open pack \"%s\"\n", argv[2]);
+        return 1;
+    }
+
+    int result;
+
+    if (strcmp(command, "list") == 0) {
+        result = list(&pack);
+    }
+    else if (strcmp(command, "add") == 0) {
+        result = add(&pack, argc - 3, argv + 3);
+    }
+    else if (strcmp(command, "get") == 0) {
+        result = get(&pack, argv[3], argv[4]);
+    }
+    else {
+        result = verify(&pack);
+    }
+
+    pack_close(&pack);
+    return result;
+}
@@ -0,0 +1,348 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+lrproxy-bench: a headless frontend that runs a core, or the proxy loading a
+core, as fast as possible and reports how fast it went.
+*/
+
+#include "libretro.h"
+#include "core.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#define DEFAULT_FRAMES 1000
+#define MAX_VARIABLES 64
+
+typedef struct {
+    char const* key;
+    char const* value;
+}
+variable_t;
+
+static variable_t s_variables[MAX_VARIABLES];
+static unsigned s_variable_count;
+static bool s_verbose;
+static bool s_support_no_game;
+static enum retro_pixel_format s_pixel_format = RETRO_PIXEL_FORMAT_0RGB1555;
+static uint64_t s_video_frames;
+static uint64_t s_audio_frames;
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void RETRO_CALLCONV log_printf(enum retro_log_level level, char const* fmt, ...) {
+    if (!s_verbose && level < RETRO_LOG_WARN) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static bool environment(unsigned cmd, void* data) {
+    switch (cmd) {
+        case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+            *(bool*)data = true;
+            return true;
+
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+            s_pixel_format = *(enum retro_pixel_format const*)data;
+            return true;
+
+        case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_CORE_ASSETS_DIRECTORY:
+            *(char const**)data = ".";
+            return true;
+
+        case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+            ((struct retro_log_callback*)data)->log = log_printf;
+            return true;
+
+        case RETRO_ENVIRONMENT_GET_VARIABLE: {
+            struct retro_variable* const var = (struct retro_variable*)data;
+
+            for (unsigned i = 0; i < s_variable_count; i++) {
+                if (strcmp(s_variables[i].key, var->key) == 0) {
+                    var->value = s_variables[i].value;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+            *(bool*)data = false;
+            return true;
+
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+            s_support_no_game = *(bool const*)data;
+            return true;
+
+        case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+            *(int*)data = 3; /* video and audio */
+            return true;
+
+        case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+        case RETRO_ENVIRONMENT_SET_GEOMETRY:
+        case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+        case RETRO_ENVIRONMENT_SET_VARIABLES:
+        case RETRO_ENVIRONMENT_SET_CONTROLLER_INFO:
+        case RETRO_ENVIRONMENT_SET_SUBSYSTEM_INFO:
+        case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
+        case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void video_refresh(void const* data, unsigned width, unsigned height, size_t pitch) {
+    (void)data;
+    (void)width;
+    (void)height;
+    (void)pitch;
+    s_video_frames++;
+}
+
+static void audio_sample(int16_t left, int16_t right) {
+    (void)left;
+    (void)right;
+    s_audio_frames++;
+}
+
+static size_t audio_sample_batch(int16_t const* data, size_t frames) {
+    (void)data;
+    s_audio_frames += frames;
+    return frames;
+}
+
+static void input_poll(void) {}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    (void)port;
+    (void)device;
+    (void)index;
+    (void)id;
+    return 0;
+}
+
+static void* read_file(char const* const path, size_t* const size) {
+    FILE* const file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    void* data = NULL;
+
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long const length = ftell(file);
+
+        if (length >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc(length != 0 ? (size_t)length : 1);
+
+            if (data != NULL && fread(data, 1, (size_t)length, file) != (size_t)length) {
+                free(data);
+                data = NULL;
+            }
+
+            *size = (size_t)length;
+        }
+    }
+
+    fclose(file);
+    return data;
+}
+
+static int usage(char const* const name) {
+    fprintf(stderr, "Usage: %s [-n frames] [-w warmup frames] [-s key=value]... [-v] core [content]\n", name);
+    fprintf(stderr, "  -n  number of frames to measure, defaults to %d\n", DEFAULT_FRAMES);
+    fprintf(stderr, "  -w  frames to run before measuring, defaults to 0\n");
+    fprintf(stderr, "  -s  sets a core option\n");
+    fprintf(stderr, "  -v  shows all the messages logged by the core\n");
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long frames = DEFAULT_FRAMES;
+    unsigned long warmup = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            frames = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            warmup = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && s_variable_count < MAX_VARIABLES) {
+            char* const equal = strchr(argv[++i], '=');
+
+            if (equal == NULL) {
+                return usage(argv[0]);
+            }
+
+            *equal = 0;
+            s_variables[s_variable_count].key = argv[i];
+            s_variables[s_variable_count].value = equal + 1;
+            s_variable_count++;
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            s_verbose = true;
+        }
+        else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (argc - i < 1 || argc - i > 2 || frames == 0) {
+        return usage(argv[0]);
+    }
+
+    char const* const core_path = argv[i];
+    char const* const content_path = argc - i == 2 ? argv[i + 1] : NULL;
+
+    core_t core;
+
+    if (!core_load(&core, core_path)) {
+        return 1;
+    }
+
+    struct retro_system_info info;
+    memset(&info, 0, sizeof(info));
+
+    core.set_environment(environment);
+    core.get_system_info(&info);
+    core.init();
+
+    core.set_video_refresh(video_refresh);
+    core.set_audio_sample(audio_sample);
+    core.set_audio_sample_batch(audio_sample_batch);
+    core.set_input_poll(input_poll);
+    core.set_input_state(input_state);
+
+    struct retro_game_info game;
+    void* data = NULL;
+    memset(&game, 0, sizeof(game));
+
+    if (content_path != NULL) {
+        game.path = content_path;
+
+        if (!info.need_fullpath) {
+            data = read_file(content_path, &game.size);
+
+            if (data == NULL) {
+                fprintf(stderr, "Error reading \"%s\"\n", content_path);
+                return 1;
+            }
+
+            game.data = data;
+        }
+    }
+    else if (!s_support_no_game) {
+        fprintf(stderr, "The core needs content to run\n");
+        return 1;
+    }
+
+    if (!core.load_game(content_path != NULL ? &game : NULL)) {
+        fprintf(stderr, "The core couldn't load the content\n");
+        return 1;
+    }
+
+    struct retro_system_av_info av_info;
+    memset(&av_info, 0, sizeof(av_info));
+    core.get_system_av_info(&av_info);
+
+    for (unsigned long j = 0; j < warmup; j++) {
+        core.run();
+    }
+
+    static histogram_t latency;
+    histogram_reset(&latency);
+    s_video_frames = s_audio_frames = 0;
+
+    uint64_t const start = now();
+
+    for (unsigned long j = 0; j < frames; j++) {
+        uint64_t const t0 = now();
+        core.run();
+        histogram_add(&latency, now() - t0);
+    }
+
+    uint64_t const elapsed = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double const seconds = elapsed / 1e9;
+    double const fps = frames / seconds;
+
+    printf(
+        "core        %s %s\n",
+        info.library_name != NULL ? info.library_name : "",
+        info.library_version != NULL ? info.library_version : ""
+    );
+    printf("frames      %lu in %.3f s, %lu video frames, %.0f audio frames\n", frames, seconds, (unsigned long)s_video_frames, (double)s_audio_frames);
+    printf("speed       %.2f fps", fps);
+
+    if (av_info.timing.fps > 0.0) {
+        printf(", %.2fx real time at %.2f fps", fps / av_info.timing.fps, av_info.timing.fps);
+    }
+
+    printf("\n");
+    printf(
+        "frame (us)  mean %.2f, p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+        (double)latency.total / (double)latency.count / 1000.0,
+        histogram_percentile(&latency, 50.0) / 1000.0,
+        histogram_percentile(&latency, 90.0) / 1000.0,
+        histogram_percentile(&latency, 99.0) / 1000.0,
+        histogram_percentile(&latency, 99.9) / 1000.0,
+        latency.max / 1000.0
+    );
+    printf("peak RSS    %ld KiB\n", usage.ru_maxrss);
+
+    /* The strings in info belong to the core, so it's only unloaded at the end */
+    core.unload_game();
+    core.deinit();
+    core_unload(&core);
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,400 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "checkpoint.h"
+#include "trace.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TAG "[LRPROXY] "
+
+/*
+Each buffer is filled by the emulation thread while FREE, and belongs to the
+writer thread while PENDING or WRITING. With two buffers a new checkpoint can
+be taken while the previous one is being written, and when both are busy the
+checkpoint is skipped instead of waiting for the disk.
+*/
+typedef enum {
+    FREE,
+    PENDING,
+    WRITING
+}
+buffer_state_t;
+
+typedef struct {
+    void* data;
+    size_t capacity;
+    size_t size;
+    uint64_t frame;
+    buffer_state_t state;
+}
+buffer_t;
+
+static buffer_t s_buffers[2];
+static buffer_t* s_filling;
+
+static char* s_path;
+static char* s_temp_path;
+static char* s_dir;
+static unsigned s_interval;
+static unsigned s_frames;
+static volatile sig_atomic_t s_requested;
+
+static pthread_t s_writer;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static bool s_running;
+static bool s_started;
+
+/* Written by the writer thread with s_mutex held */
+static uint64_t s_written;
+static uint64_t s_failed;
+static histogram_t s_write_times;
+
+/* Only used by the emulation thread */
+static uint64_t s_taken;
+static uint64_t s_skipped;
+static uint64_t s_grown;
+static histogram_t s_save_times;
+
+#ifndef _WIN32
+static struct sigaction s_old_action;
+static bool s_installed;
+
+static void request(int const signum) {
+    (void)signum;
+    s_requested = 1;
+}
+#endif
+
+static bool write_all(int const fd, void const* const data, size_t size) {
+    char const* ptr = (char const*)data;
+
+    while (size != 0) {
+        ssize_t const written = write(fd, ptr, size);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        ptr += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+/* The state goes to a temporary file that replaces the checkpoint only after it's on the disk, so a crash leaves the previous one */
+static bool persist(buffer_t const* const buffer) {
+    int const fd = open(s_temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    bool const ok = write_all(fd, buffer->data, buffer->size) && fsync(fd) == 0;
+
+    if (close(fd) != 0 || !ok || rename(s_temp_path, s_path) != 0) {
+        return false;
+    }
+
+    /* The rename itself is only durable after the directory is synced */
+    int const dir = open(s_dir, O_RDONLY);
+
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+
+    return true;
+}
+
+static void* writer(void* const arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&s_mutex);
+
+    for (;;) {
+        buffer_t* buffer = NULL;
+
+        for (unsigned i = 0; i < 2; i++) {
+            if (s_buffers[i].state == PENDING && (buffer == NULL || s_buffers[i].frame < buffer->frame)) {
+                buffer = &s_buffers[i];
+            }
+        }
+
+        if (buffer == NULL) {
+            if (!s_running) {
+                break;
+            }
+
+            pthread_cond_wait(&s_cond, &s_mutex);
+            continue;
+        }
+
+        buffer->state = WRITING;
+        pthread_mutex_unlock(&s_mutex);
+
+        uint64_t const t0 = trace_now();
+        bool const ok = persist(buffer);
+        uint64_t const t1 = trace_now();
+
+        pthread_mutex_lock(&s_mutex);
+
+        if (ok) {
+            s_written++;
+            histogram_add(&s_write_times, t1 - t0);
+        }
+        else {
+            s_failed++;
+        }
+
+        buffer->state = FREE;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+    return NULL;
+}
+
+static char* duplicate(char const* const str, size_t const length, char const* const suffix) {
+    size_t const suffix_length = strlen(suffix);
+    char* const copy = (char*)malloc(length + suffix_length + 1);
+
+    if (copy != NULL) {
+        memcpy(copy, str, length);
+        memcpy(copy + length, suffix, suffix_length + 1);
+    }
+
+    return copy;
+}
+
+bool checkpoint_start(char const* const path, unsigned const interval) {
+    char const* const slash = strrchr(path, '/');
+
+    s_path = duplicate(path, strlen(path), "");
+    s_temp_path = duplicate(path, strlen(path), ".tmp");
+    s_dir = slash != NULL ? duplicate(path, slash == path ? 1 : (size_t)(slash - path), "") : duplicate(".", 1, "");
+
+    if (s_path == NULL || s_temp_path == NULL || s_dir == NULL) {
+        checkpoint_stop();
+        return false;
+    }
+
+    memset(s_buffers, 0, sizeof(s_buffers));
+    s_filling = NULL;
+    s_interval = interval;
+    s_frames = 0;
+    s_requested = 0;
+
+    s_written = s_failed = 0;
+    s_taken = s_skipped = s_grown = 0;
+    histogram_reset(&s_write_times);
+    histogram_reset(&s_save_times);
+
+    s_running = true;
+
+    if (pthread_create(&s_writer, NULL, writer, NULL) != 0) {
+        fprintf(stderr, TAG "Couldn't start the checkpoint writer thread\n");
+        checkpoint_stop();
+        return false;
+    }
+
+    s_started = true;
+
+#ifndef _WIN32
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = request;
+    sa.sa_flags = SA_RESTART;
+    s_installed = sigaction(SIGUSR2, &sa, &s_old_action) == 0;
+#endif
+
+    return true;
+}
+
+void checkpoint_stop(void) {
+#ifndef _WIN32
+    if (s_installed) {
+        sigaction(SIGUSR2, &s_old_action, NULL);
+        s_installed = false;
+    }
+#endif
+
+    if (s_started) {
+        /* Pending checkpoints are still written, only new ones stop */
+        pthread_mutex_lock(&s_mutex);
+        s_running = false;
+        pthread_cond_signal(&s_cond);
+        pthread_mutex_unlock(&s_mutex);
+
+        pthread_join(s_writer, NULL);
+        s_started = false;
+    }
+
+    if (s_taken != 0) {
+        fprintf(
+            stderr,
+            TAG "Checkpoints: %llu taken, %llu written to \"%s\", %llu failed, %llu skipped while both buffers were busy, %llu grew a buffer in retro_run\n",
+            (unsigned long long)s_taken,
+            (unsigned long long)s_written,
+            s_path,
+            (unsigned long long)s_failed,
+            (unsigned long long)s_skipped,
+            (unsigned long long)s_grown
+        );
+
+        fprintf(
+            stderr,
+            TAG "Checkpoints: saving took %.2f us mean, %.2f us p99 in retro_run, writing %.2f ms mean, %.2f ms p99 in the writer thread\n",
+            (double)s_save_times.total / (double)s_save_times.count / 1000.0,
+            histogram_percentile(&s_save_times, 99.0) / 1000.0,
+            s_write_times.count != 0 ? (double)s_write_times.total / (double)s_write_times.count / 1000000.0 : 0.0,
+            histogram_percentile(&s_write_times, 99.0) / 1000000.0
+        );
+    }
+
+    free(s_buffers[0].data);
+    free(s_buffers[1].data);
+    free(s_path);
+    free(s_temp_path);
+    free(s_dir);
+
+    memset(s_buffers, 0, sizeof(s_buffers));
+    s_filling = NULL;
+    s_path = s_temp_path = s_dir = NULL;
+    s_taken = 0;
+}
+
+bool checkpoint_due(void) {
+    bool due = false;
+
+    if (s_interval != 0 && ++s_frames >= s_interval) {
+        s_frames = 0;
+        due = true;
+    }
+
+    if (s_requested) {
+        s_requested = 0;
+        due = true;
+    }
+
+    return due;
+}
+
+/* Touches the new memory, so its pages are faulted in now and not while the state is saved */
+static bool grow(buffer_t* const buffer, size_t const size) {
+    uint8_t* const data = (uint8_t*)realloc(buffer->data, size);
+
+    if (data == NULL) {
+        return false;
+    }
+
+    memset(data + buffer->capacity, 0, size - buffer->capacity);
+    buffer->data = data;
+    buffer->capacity = size;
+    return true;
+}
+
+void checkpoint_reserve(size_t const size) {
+    bool available[2];
+
+    pthread_mutex_lock(&s_mutex);
+
+    for (unsigned i = 0; i < 2; i++) {
+        available[i] = s_buffers[i].state == FREE;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+
+    /* Only this thread takes a free buffer, so they stay free while they grow */
+    for (unsigned i = 0; i < 2; i++) {
+        if (available[i] && size > s_buffers[i].capacity && !grow(&s_buffers[i], size)) {
+            fprintf(stderr, TAG "Couldn't allocate %zu bytes for a checkpoint buffer\n", size);
+        }
+    }
+}
+
+void* checkpoint_buffer(size_t const size) {
+    s_filling = NULL;
+
+    pthread_mutex_lock(&s_mutex);
+
+    for (unsigned i = 0; i < 2; i++) {
+        if (s_buffers[i].state == FREE) {
+            s_filling = &s_buffers[i];
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+
+    if (s_filling == NULL) {
+        s_skipped++;
+        return NULL;
+    }
+
+    /* The state grew since checkpoint_reserve, the writer thread doesn't touch free buffers so they can grow without the lock */
+    if (size > s_filling->capacity) {
+        if (!grow(s_filling, size)) {
+            s_filling = NULL;
+            return NULL;
+        }
+
+        s_grown++;
+    }
+
+    return s_filling->data;
+}
+
+void checkpoint_submit(size_t const size, uint64_t const ns) {
+    if (s_filling == NULL) {
+        return;
+    }
+
+    histogram_add(&s_save_times, ns);
+    s_taken++;
+
+    pthread_mutex_lock(&s_mutex);
+    s_filling->size = size;
+    s_filling->frame = s_taken;
+    s_filling->state = PENDING;
+    pthread_cond_signal(&s_cond);
+    pthread_mutex_unlock(&s_mutex);
+
+    s_filling = NULL;
+}
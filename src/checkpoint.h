@@ -0,0 +1,41 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Saves the state of the core to a file every so many frames, or when the
+frontend gets SIGUSR2, without retro_run waiting for the disk. The state is
+saved into one of two buffers and written and synced by a thread, to a
+temporary file that then replaces the checkpoint, so a crash at any time
+leaves a complete state on the disk. The file has what retro_serialize gave,
+and can be loaded like any other state.
+*/
+bool checkpoint_start(char const* path, unsigned interval);
+
+/* Waits for the pending checkpoints to be written, prints the report, and puts back the old SIGUSR2 handler */
+void checkpoint_stop(void);
+
+/* Returns true once every interval frames, and after SIGUSR2 */
+bool checkpoint_due(void);
+
+/* Allocates both buffers for a state of size bytes, after the content is loaded so retro_run doesn't have to */
+void checkpoint_reserve(size_t size);
+
+/* Returns the buffer where the state must be saved, or NULL if both are still being written, grows it if the state got bigger */
+void* checkpoint_buffer(size_t size);
+
+/* Gives the buffer with the saved state to the writer thread, ns is the time it took to save */
+void checkpoint_submit(size_t size, uint64_t ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHECKPOINT_H */
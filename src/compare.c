@@ -0,0 +1,273 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "compare.h"
+#include "secondary.h"
+#include "trace.h"
+#include "histogram.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "[LRPROXY] "
+
+typedef enum {
+    SIDE_A,
+    SIDE_B,
+
+    SIDE_COUNT
+}
+side_t;
+
+/* What each build gave to the frontend in the current frame */
+typedef struct {
+    uint64_t video; /* the frame on the screen, so it carries over when the core dupes */
+    uint64_t audio;
+    uint64_t hashing;
+    histogram_t frames;
+}
+output_t;
+
+static FILE* s_frames_file;
+static output_t s_outputs[SIDE_COUNT];
+static enum retro_pixel_format s_format;
+
+static uint64_t s_frame;
+static int64_t s_delta;
+static uint64_t s_faster;
+static uint64_t s_video_differs;
+static uint64_t s_audio_differs;
+static uint64_t s_first_video;
+static uint64_t s_first_audio;
+static uint64_t s_states_failed;
+
+/* Only the visible part of each line, the padding up to the pitch may have anything in it */
+static void hash_video(output_t* const out, enum retro_pixel_format const format, void const* const data, unsigned const width, unsigned const height, size_t const pitch) {
+    if (data == NULL || data == RETRO_HW_FRAME_BUFFER_VALID) {
+        return;
+    }
+
+    uint64_t const t0 = trace_now();
+    size_t const line = (size_t)width * (format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2);
+    uint64_t h = hash_data(HASH_SEED, &width, sizeof(width));
+    h = hash_data(h, &height, sizeof(height));
+
+    for (unsigned y = 0; y < height; y++) {
+        h = hash_data(h, (uint8_t const*)data + y * pitch, line);
+    }
+
+    out->video = h;
+    out->hashing += trace_now() - t0;
+}
+
+static void hash_audio(output_t* const out, int16_t const* const data, size_t const frames) {
+    uint64_t const t0 = trace_now();
+    out->audio = hash_data(out->audio, data, frames * 2 * sizeof(int16_t));
+    out->hashing += trace_now() - t0;
+}
+
+static void video_refresh(void const* data, unsigned width, unsigned height, size_t pitch) {
+    hash_video(&s_outputs[SIDE_B], secondary_pixel_format(), data, width, height, pitch);
+}
+
+static size_t audio_sample_batch(int16_t const* data, size_t frames) {
+    hash_audio(&s_outputs[SIDE_B], data, frames);
+    return frames;
+}
+
+bool compare_start(char const* const path, char const* const frames_path) {
+    if (!secondary_load(path, video_refresh, audio_sample_batch)) {
+        return false;
+    }
+
+    s_frame = 0;
+    s_delta = 0;
+    s_faster = s_video_differs = s_audio_differs = s_states_failed = 0;
+    s_format = RETRO_PIXEL_FORMAT_0RGB1555;
+
+    for (unsigned i = 0; i < SIDE_COUNT; i++) {
+        memset(&s_outputs[i], 0, sizeof(s_outputs[i]));
+        histogram_reset(&s_outputs[i].frames);
+    }
+
+    s_frames_file = NULL;
+
+    if (frames_path != NULL && *frames_path != 0) {
+        s_frames_file = fopen(frames_path, "w");
+
+        if (s_frames_file == NULL) {
+            fprintf(stderr, TAG "Couldn't open \"%s\"\n", frames_path);
+        }
+        else {
+            fprintf(s_frames_file, "frame,a_ns,b_ns,delta_ns,video,audio\n");
+        }
+    }
+
+    fprintf(stderr, TAG "Comparing with \"%s\"\n", path);
+    return true;
+}
+
+void compare_unserialize(void const* const data, size_t const size) {
+    /* A different build may not be able to load the states of the other */
+    if (!secondary_unserialize(data, size)) {
+        s_states_failed++;
+    }
+}
+
+void compare_environment(unsigned const cmd, void const* const data, bool const result) {
+    if (!result || data == NULL) {
+        return;
+    }
+
+    if (cmd == RETRO_ENVIRONMENT_SET_PIXEL_FORMAT) {
+        s_format = *(enum retro_pixel_format const*)data;
+    }
+}
+
+void compare_video(void const* const data, unsigned const width, unsigned const height, size_t const pitch) {
+    hash_video(&s_outputs[SIDE_A], s_format, data, width, height, pitch);
+}
+
+void compare_audio(int16_t const* const data, size_t const frames) {
+    hash_audio(&s_outputs[SIDE_A], data, frames);
+}
+
+void compare_run(uint64_t const ns) {
+    output_t* const a = &s_outputs[SIDE_A];
+    output_t* const b = &s_outputs[SIDE_B];
+
+    uint64_t const t0 = trace_now();
+    secondary_run();
+    uint64_t const total = trace_now() - t0;
+
+    /* The time spent hashing is the proxy's, not the core's */
+    uint64_t const a_ns = ns > a->hashing ? ns - a->hashing : 0;
+    uint64_t const b_ns = total > b->hashing ? total - b->hashing : 0;
+    bool const same_video = a->video == b->video;
+    bool const same_audio = a->audio == b->audio;
+
+    histogram_add(&a->frames, a_ns);
+    histogram_add(&b->frames, b_ns);
+    s_delta += (int64_t)b_ns - (int64_t)a_ns;
+    s_faster += b_ns < a_ns;
+
+    if (!same_video && s_video_differs++ == 0) {
+        s_first_video = s_frame;
+    }
+
+    if (!same_audio && s_audio_differs++ == 0) {
+        s_first_audio = s_frame;
+    }
+
+    if (s_frames_file != NULL) {
+        fprintf(
+            s_frames_file,
+            "%llu,%llu,%llu,%lld,%d,%d\n",
+            (unsigned long long)s_frame,
+            (unsigned long long)a_ns,
+            (unsigned long long)b_ns,
+            (long long)b_ns - (long long)a_ns,
+            same_video,
+            same_audio
+        );
+    }
+
+    a->audio = b->audio = 0;
+    a->hashing = b->hashing = 0;
+    s_frame++;
+}
+
+static void print_report(void) {
+    if (s_frame == 0) {
+        return;
+    }
+
+    fprintf(
+        stderr,
+        TAG "%-32s %10s %10s %10s %10s %10s\n",
+        "retro_run compared (us)", "mean", "p50", "p99", "p99.9", "max"
+    );
+
+    for (unsigned i = 0; i < SIDE_COUNT; i++) {
+        histogram_t const* const hist = &s_outputs[i].frames;
+
+        fprintf(
+            stderr,
+            TAG "  %-30s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+            i == SIDE_A ? "A (proxied core)" : "B (compared core)",
+            (double)hist->total / (double)hist->count / 1000.0,
+            histogram_percentile(hist, 50.0) / 1000.0,
+            histogram_percentile(hist, 99.0) / 1000.0,
+            histogram_percentile(hist, 99.9) / 1000.0,
+            hist->max / 1000.0
+        );
+    }
+
+    uint64_t const a_total = s_outputs[SIDE_A].frames.total;
+
+    fprintf(
+        stderr,
+        TAG "B takes %+.2f us per frame (%+.1f%%), and was faster in %llu of %llu frames\n",
+        (double)s_delta / (double)s_frame / 1000.0,
+        a_total != 0 ? (double)s_delta * 100.0 / (double)a_total : 0.0,
+        (unsigned long long)s_faster,
+        (unsigned long long)s_frame
+    );
+
+    if (s_video_differs == 0 && s_audio_differs == 0) {
+        fprintf(stderr, TAG "Video and audio are the same in all frames\n");
+    }
+
+    if (s_video_differs != 0) {
+        fprintf(
+            stderr,
+            TAG "Video differs in %llu frames, first at frame %llu\n",
+            (unsigned long long)s_video_differs,
+            (unsigned long long)s_first_video
+        );
+    }
+
+    if (s_audio_differs != 0) {
+        fprintf(
+            stderr,
+            TAG "Audio differs in %llu frames, first at frame %llu\n",
+            (unsigned long long)s_audio_differs,
+            (unsigned long long)s_first_audio
+        );
+    }
+
+    if (s_states_failed != 0) {
+        fprintf(stderr, TAG "B couldn't load %llu of the states saved by A\n", (unsigned long long)s_states_failed);
+    }
+}
+
+void compare_stop(void) {
+    print_report();
+
+    if (s_frames_file != NULL) {
+        fclose(s_frames_file);
+        s_frames_file = NULL;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include "libretro.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Runs a second build of the core, B, in lockstep with the one the frontend
+sees, A. B is a secondary copy, that gets the same calls as A and reads the
+same input, and its video and audio are only hashed to be compared with A's.
+*/
+bool compare_start(char const* path, char const* frames_path);
+
+/* Prints the report, B is deinitialized and unloaded with secondary_deinit */
+void compare_stop(void);
+
+/* B may not be able to load the states saved by A, which is counted in the report */
+void compare_unserialize(void const* data, size_t size);
+
+/* Environment calls made by A, for its pixel format */
+void compare_environment(unsigned cmd, void const* data, bool result);
+
+/* What A gives to the frontend during a frame */
+void compare_video(void const* data, unsigned width, unsigned height, size_t pitch);
+void compare_audio(int16_t const* data, size_t frames);
+
+/* Called after A ran a frame that took ns, runs the same frame in B and compares them */
+void compare_run(uint64_t ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPARE_H */
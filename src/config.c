@@ -0,0 +1,266 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _WIN32
+    #define _GNU_SOURCE /* dladdr */
+#endif
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <Windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+#define TAG "[LRPROXY] "
+
+#define CONFIG_MAX_ENTRIES 64
+#define CONFIG_MAX_KEY 32
+#define CONFIG_MAX_VALUE 1024
+#define CONFIG_MAX_PATH 4096
+
+typedef struct {
+    char key[CONFIG_MAX_KEY];
+    char value[CONFIG_MAX_VALUE];
+}
+entry_t;
+
+static entry_t s_entries[CONFIG_MAX_ENTRIES];
+static unsigned s_count;
+static bool s_loaded;
+
+static char* trim(char* str) {
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+
+    char* end = str + strlen(str);
+
+    while (end > str && isspace((unsigned char)end[-1])) {
+        *--end = 0;
+    }
+
+    return str;
+}
+
+/* The configuration file sits next to the proxy with the same name and a .cfg extension */
+static bool sidecar_path(char* const path, size_t const size) {
+#ifdef _WIN32
+    HMODULE module;
+
+    if (!GetModuleHandleExA(
+        GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        (LPCSTR)(void*)sidecar_path,
+        &module
+    )) {
+        return false;
+    }
+
+    DWORD const length = GetModuleFileNameA(module, path, (DWORD)size);
+
+    if (length == 0 || length >= size) {
+        return false;
+    }
+#else
+    Dl_info info;
+
+    if (dladdr((void*)sidecar_path, &info) == 0 || info.dli_fname == NULL) {
+        return false;
+    }
+
+    if (snprintf(path, size, "%s", info.dli_fname) >= (int)size) {
+        return false;
+    }
+#endif
+
+    char* slash = strrchr(path, '/');
+    char* const backslash = strrchr(path, '\\');
+
+    if (backslash != NULL && (slash == NULL || backslash > slash)) {
+        slash = backslash;
+    }
+
+    char* const dot = strrchr(path, '.');
+    size_t const base = dot != NULL && (slash == NULL || dot > slash) ? (size_t)(dot - path) : strlen(path);
+
+    if (base + 5 > size) {
+        return false;
+    }
+
+    strcpy(path + base, ".cfg");
+    return true;
+}
+
+void config_load(void) {
+    if (s_loaded) {
+        return;
+    }
+
+    s_loaded = true;
+
+    char path[CONFIG_MAX_PATH];
+    char const* const env = getenv("LRPROXY_CONFIG");
+
+    if (env != NULL && *env != 0) {
+        snprintf(path, sizeof(path), "%s", env);
+    }
+    else if (!sidecar_path(path, sizeof(path))) {
+        return;
+    }
+
+    FILE* const file = fopen(path, "r");
+
+    if (file == NULL) {
+        if (env != NULL && *env != 0) {
+            fprintf(stderr, TAG "Couldn't open configuration file \"%s\"\n", path);
+        }
+
+        return;
+    }
+
+    char line[CONFIG_MAX_KEY + CONFIG_MAX_VALUE + 16];
+    unsigned number = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        char* const str = trim(line);
+
+        if (*str == 0 || *str == '#') {
+            continue;
+        }
+
+        char* const equal = strchr(str, '=');
+
+        if (equal == NULL) {
+            fprintf(stderr, TAG "%s:%u: expected key = value\n", path, number);
+            continue;
+        }
+
+        *equal = 0;
+        char const* const key = trim(str);
+        char const* const value = trim(equal + 1);
+
+        if (s_count == CONFIG_MAX_ENTRIES || strlen(key) >= CONFIG_MAX_KEY || strlen(value) >= CONFIG_MAX_VALUE) {
+            fprintf(stderr, TAG "%s:%u: entry ignored\n", path, number);
+            continue;
+        }
+
+        strcpy(s_entries[s_count].key, key);
+        strcpy(s_entries[s_count].value, value);
+        s_count++;
+    }
+
+    fclose(file);
+}
+
+char const* config_string(char const* const key, char const* const def) {
+    char name[CONFIG_MAX_KEY + 8];
+    size_t i = 0;
+
+    for (char const* k = "LRPROXY_"; *k != 0; k++) {
+        name[i++] = *k;
+    }
+
+    for (char const* k = key; *k != 0 && i < sizeof(name) - 1; k++) {
+        name[i++] = (char)toupper((unsigned char)*k);
+    }
+
+    name[i] = 0;
+    char const* const value = getenv(name);
+
+    if (value != NULL) {
+        return value;
+    }
+
+    /* Later entries override earlier ones */
+    for (unsigned j = s_count; j > 0; j--) {
+        if (strcmp(s_entries[j - 1].key, key) == 0) {
+            return s_entries[j - 1].value;
+        }
+    }
+
+    return def;
+}
+
+unsigned long config_uint(char const* const key, unsigned long const def) {
+    char const* const value = config_string(key, NULL);
+
+    if (value == NULL || *value == 0) {
+        return def;
+    }
+
+    char* end;
+    unsigned long const result = strtoul(value, &end, 0);
+
+    if (*end != 0) {
+        fprintf(stderr, TAG "Invalid value for %s: \"%s\"\n", key, value);
+        return def;
+    }
+
+    return result;
+}
+
+double config_double(char const* const key, double const def) {
+    char const* const value = config_string(key, NULL);
+
+    if (value == NULL || *value == 0) {
+        return def;
+    }
+
+    char* end;
+    double const result = strtod(value, &end);
+
+    if (*end != 0) {
+        fprintf(stderr, TAG "Invalid value for %s: \"%s\"\n", key, value);
+        return def;
+    }
+
+    return result;
+}
+
+bool config_bool(char const* const key, bool const def) {
+    char const* const value = config_string(key, NULL);
+
+    if (value == NULL || *value == 0) {
+        return def;
+    }
+
+    if (strcmp(value, "1") == 0 || strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "on") == 0) {
+        return true;
+    }
+
+    if (strcmp(value, "0") == 0 || strcmp(value, "false") == 0 || strcmp(value, "no") == 0 || strcmp(value, "off") == 0) {
+        return false;
+    }
+
+    fprintf(stderr, TAG "Invalid value for %s: \"%s\"\n", key, value);
+    return def;
+}
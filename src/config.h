@@ -0,0 +1,29 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Settings are looked up first in the LRPROXY_<KEY> environment variable, then
+in the configuration file. The file is the one in LRPROXY_CONFIG, or the
+proxy's own path with the extension replaced by .cfg. Each line has a
+key = value pair, lines starting with # are ignored.
+*/
+
+/* Reads the configuration file, does nothing if it was already read */
+void config_load(void);
+
+char const* config_string(char const* key, char const* def);
+unsigned long config_uint(char const* key, unsigned long def);
+double config_double(char const* key, double def);
+bool config_bool(char const* key, bool def);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_H */
@@ -0,0 +1,107 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _WIN32
+    #define _GNU_SOURCE /* dlmopen */
+#endif
+
+#include "core.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define CORE_DLSYM(prop, name) \
+    do { \
+        void* sym = dynlib_symbol(core->handle, name); \
+        if (!sym) goto error; \
+        memcpy(&core->prop, &sym, sizeof(core->prop)); \
+    } while (0)
+
+static bool resolve(core_t* const core, char const* const path) {
+    if (core->handle == NULL) {
+        fprintf(stderr, "Error loading core \"%s\": %s\n", path, dynlib_error());
+        return false;
+    }
+
+    CORE_DLSYM(init, "retro_init");
+    CORE_DLSYM(deinit, "retro_deinit");
+    CORE_DLSYM(api_version, "retro_api_version");
+    CORE_DLSYM(get_system_info, "retro_get_system_info");
+    CORE_DLSYM(get_system_av_info, "retro_get_system_av_info");
+    CORE_DLSYM(set_environment, "retro_set_environment");
+    CORE_DLSYM(set_video_refresh, "retro_set_video_refresh");
+    CORE_DLSYM(set_audio_sample, "retro_set_audio_sample");
+    CORE_DLSYM(set_audio_sample_batch, "retro_set_audio_sample_batch");
+    CORE_DLSYM(set_input_poll, "retro_set_input_poll");
+    CORE_DLSYM(set_input_state, "retro_set_input_state");
+    CORE_DLSYM(set_controller_port_device, "retro_set_controller_port_device");
+    CORE_DLSYM(reset, "retro_reset");
+    CORE_DLSYM(run, "retro_run");
+    CORE_DLSYM(serialize_size, "retro_serialize_size");
+    CORE_DLSYM(serialize, "retro_serialize");
+    CORE_DLSYM(unserialize, "retro_unserialize");
+    CORE_DLSYM(cheat_reset, "retro_cheat_reset");
+    CORE_DLSYM(cheat_set, "retro_cheat_set");
+    CORE_DLSYM(load_game, "retro_load_game");
+    CORE_DLSYM(load_game_special, "retro_load_game_special");
+    CORE_DLSYM(unload_game, "retro_unload_game");
+    CORE_DLSYM(get_region, "retro_get_region");
+    CORE_DLSYM(get_memory_data, "retro_get_memory_data");
+    CORE_DLSYM(get_memory_size, "retro_get_memory_size");
+
+    return true;
+
+error:
+    fprintf(stderr, "Couldn't find symbol in \"%s\": %s\n", path, dynlib_error());
+    dynlib_close(core->handle);
+    core->handle = NULL;
+    return false;
+}
+
+#undef CORE_DLSYM
+
+bool core_load(core_t* const core, char const* const path) {
+    memset(core, 0, sizeof(*core));
+    core->handle = dynlib_open(path);
+    return resolve(core, path);
+}
+
+bool core_load_isolated(core_t* const core, char const* const path) {
+    memset(core, 0, sizeof(*core));
+
+#ifdef _WIN32
+    fprintf(stderr, "Error loading core \"%s\": namespaces are not supported on Windows\n", path);
+    return false;
+#else
+    core->handle = dlmopen(LM_ID_NEWLM, path, RTLD_NOW | RTLD_LOCAL);
+    return resolve(core, path);
+#endif
+}
+
+void core_unload(core_t* const core) {
+    if (core->handle != NULL) {
+        dynlib_close(core->handle);
+        core->handle = NULL;
+    }
+}
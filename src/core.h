@@ -0,0 +1,58 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include "libretro.h"
+#include "dynlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A libretro core loaded by one of the tools, either a real core or the proxy */
+typedef struct {
+    dynlib_t handle;
+
+    void (*init)(void);
+    void (*deinit)(void);
+    unsigned (*api_version)(void);
+    void (*get_system_info)(struct retro_system_info*);
+    void (*get_system_av_info)(struct retro_system_av_info*);
+    void (*set_environment)(retro_environment_t);
+    void (*set_video_refresh)(retro_video_refresh_t);
+    void (*set_audio_sample)(retro_audio_sample_t);
+    void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+    void (*set_input_poll)(retro_input_poll_t);
+    void (*set_input_state)(retro_input_state_t);
+    void (*set_controller_port_device)(unsigned, unsigned);
+    void (*reset)(void);
+    void (*run)(void);
+    size_t (*serialize_size)(void);
+    bool (*serialize)(void*, size_t);
+    bool (*unserialize)(void const*, size_t);
+    void (*cheat_reset)(void);
+    void (*cheat_set)(unsigned, bool, char const*);
+    bool (*load_game)(struct retro_game_info const*);
+    bool (*load_game_special)(unsigned, struct retro_game_info const*, size_t);
+    void (*unload_game)(void);
+    unsigned (*get_region)(void);
+    void* (*get_memory_data)(unsigned);
+    size_t (*get_memory_size)(unsigned);
+}
+core_t;
+
+/* Loads the core and gets all its entry points, prints the error and returns false on failure */
+bool core_load(core_t* core, char const* path);
+
+/*
+Loads the core in a new link-map namespace with dlmopen, so it gets its own
+copy of its global variables and of the libraries it uses, and can be loaded
+more than once in the same process. Not available on Windows.
+*/
+bool core_load_isolated(core_t* core, char const* path);
+void core_unload(core_t* core);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CORE_H */
@@ -0,0 +1,292 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "determinism.h"
+#include "trace.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[LRPROXY] "
+
+/* Frames listed in the report, the others are only counted */
+#define MAX_LISTED 16
+
+typedef enum {
+    DIFF_VIDEO = 1,
+    DIFF_AUDIO = 2,
+    DIFF_INPUT = 4,
+    DIFF_STATE = 8
+}
+diff_t;
+
+typedef struct {
+    uint64_t video;
+    uint64_t audio;
+    uint64_t state;
+    bool saved;
+}
+run_t;
+
+typedef struct {
+    uint64_t key;
+    int16_t value;
+}
+input_t;
+
+typedef struct {
+    uint64_t frame;
+    unsigned diffs;
+}
+listed_t;
+
+static unsigned s_interval;
+static enum retro_pixel_format s_format;
+
+static uint64_t s_frame;
+static unsigned s_frames;
+static run_t s_runs[2];
+static run_t* s_run;
+static bool s_replay;
+
+static input_t* s_inputs;
+static size_t s_input_count;
+static size_t s_input_capacity;
+static size_t s_input_pos;
+static bool s_input_differs;
+
+static uint64_t s_checked;
+static uint64_t s_skipped;
+static uint64_t s_differ;
+static uint64_t s_counts[4];
+static listed_t s_listed[MAX_LISTED];
+static unsigned s_listed_count;
+static uint64_t s_t0;
+static uint64_t s_ns;
+
+bool determinism_start(unsigned const interval) {
+    s_interval = interval != 0 ? interval : 1;
+    s_format = RETRO_PIXEL_FORMAT_0RGB1555;
+
+    s_frame = 0;
+    s_frames = 0;
+    s_run = NULL;
+
+    s_inputs = NULL;
+    s_input_count = s_input_capacity = 0;
+
+    s_checked = s_skipped = s_differ = 0;
+    memset(s_counts, 0, sizeof(s_counts));
+    s_listed_count = 0;
+    s_ns = 0;
+    return true;
+}
+
+void determinism_stop(void) {
+    if (s_checked != 0 || s_skipped != 0) {
+        fprintf(
+            stderr,
+            TAG "Determinism: %llu frames checked, %llu couldn't be checked, %llu ran differently the second time, %.2f us mean to check\n",
+            (unsigned long long)s_checked,
+            (unsigned long long)s_skipped,
+            (unsigned long long)s_differ,
+            s_checked != 0 ? (double)s_ns / (double)s_checked / 1000.0 : 0.0
+        );
+
+        if (s_differ != 0) {
+            fprintf(
+                stderr,
+                TAG "Determinism: video differed in %llu frames, audio in %llu, input in %llu, the state in %llu\n",
+                (unsigned long long)s_counts[0],
+                (unsigned long long)s_counts[1],
+                (unsigned long long)s_counts[2],
+                (unsigned long long)s_counts[3]
+            );
+
+            for (unsigned i = 0; i < s_listed_count; i++) {
+                unsigned const diffs = s_listed[i].diffs;
+
+                fprintf(
+                    stderr,
+                    TAG "  frame %llu:%s%s%s%s\n",
+                    (unsigned long long)s_listed[i].frame,
+                    (diffs & DIFF_VIDEO) != 0 ? " video" : "",
+                    (diffs & DIFF_AUDIO) != 0 ? " audio" : "",
+                    (diffs & DIFF_INPUT) != 0 ? " input" : "",
+                    (diffs & DIFF_STATE) != 0 ? " state" : ""
+                );
+            }
+
+            if (s_differ > s_listed_count) {
+                fprintf(stderr, TAG "  and %llu more\n", (unsigned long long)(s_differ - s_listed_count));
+            }
+        }
+
+        /* What the frontend sees is what matters for run-ahead, states that only differ are a problem for netplay */
+        if (s_checked != 0) {
+            bool const safe = s_counts[0] == 0 && s_counts[1] == 0 && s_counts[2] == 0;
+
+            fprintf(
+                stderr,
+                TAG "Determinism: %s%s\n",
+                safe ? "the frames checked ran the same from a state, run-ahead should be safe" : "run-ahead isn't safe with this core",
+                safe && s_counts[3] != 0 ? ", but the states saved after them differ" : ""
+            );
+        }
+    }
+
+    free(s_inputs);
+    s_inputs = NULL;
+    s_input_count = s_input_capacity = 0;
+}
+
+void determinism_environment(unsigned const cmd, void const* const data, bool const result) {
+    if (result && data != NULL && cmd == RETRO_ENVIRONMENT_SET_PIXEL_FORMAT) {
+        s_format = *(enum retro_pixel_format const*)data;
+    }
+}
+
+bool determinism_due(void) {
+    s_frame++;
+
+    if (++s_frames < s_interval) {
+        return false;
+    }
+
+    s_frames = 0;
+    return true;
+}
+
+void determinism_begin(bool const replay) {
+    s_replay = replay;
+    s_run = &s_runs[replay ? 1 : 0];
+    s_run->video = s_run->audio = HASH_SEED;
+    s_run->state = 0;
+    s_run->saved = false;
+
+    if (replay) {
+        s_input_pos = 0;
+        s_input_differs = false;
+    }
+    else {
+        s_t0 = trace_now();
+        s_input_count = 0;
+    }
+}
+
+/* Duped frames and hardware rendered ones are hashed by their size only */
+void determinism_video(void const* const data, unsigned const width, unsigned const height, size_t const pitch) {
+    uint64_t h = hash_data(s_run->video, &width, sizeof(width));
+    h = hash_data(h, &height, sizeof(height));
+
+    if (data != NULL && data != RETRO_HW_FRAME_BUFFER_VALID) {
+        size_t const line = (size_t)width * (s_format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2);
+
+        for (unsigned y = 0; y < height; y++) {
+            h = hash_data(h, (uint8_t const*)data + y * pitch, line);
+        }
+    }
+
+    s_run->video = h;
+}
+
+void determinism_audio(int16_t const* const data, size_t const frames) {
+    s_run->audio = hash_data(s_run->audio, data, frames * 2 * sizeof(int16_t));
+}
+
+void determinism_input(unsigned const port, unsigned const device, unsigned const index, unsigned const id, int16_t const value) {
+    if (s_input_count == s_input_capacity) {
+        size_t const capacity = s_input_capacity == 0 ? 64 : s_input_capacity * 2;
+        input_t* const inputs = (input_t*)realloc(s_inputs, capacity * sizeof(*inputs));
+
+        if (inputs == NULL) {
+            return;
+        }
+
+        s_inputs = inputs;
+        s_input_capacity = capacity;
+    }
+
+    s_inputs[s_input_count].key = hash_input_key(port, device, index, id);
+    s_inputs[s_input_count].value = value;
+    s_input_count++;
+}
+
+/* A core that reads different input the second time gets what was read in that position, or 0 past the end */
+int16_t determinism_replay_input(unsigned const port, unsigned const device, unsigned const index, unsigned const id) {
+    if (s_input_pos >= s_input_count) {
+        s_input_differs = true;
+        return 0;
+    }
+
+    input_t const* const input = &s_inputs[s_input_pos++];
+    s_input_differs = s_input_differs || input->key != hash_input_key(port, device, index, id);
+    return input->value;
+}
+
+void determinism_end(void const* const state, size_t const size) {
+    if (state != NULL) {
+        s_run->state = hash_data(hash_data(HASH_SEED, &size, sizeof(size)), state, size);
+        s_run->saved = true;
+    }
+
+    if (!s_replay) {
+        return;
+    }
+
+    run_t const* const a = &s_runs[0];
+    run_t const* const b = &s_runs[1];
+    unsigned diffs = 0;
+
+    diffs |= a->video != b->video ? DIFF_VIDEO : 0;
+    diffs |= a->audio != b->audio ? DIFF_AUDIO : 0;
+    diffs |= s_input_differs || s_input_pos != s_input_count ? DIFF_INPUT : 0;
+    diffs |= a->saved && b->saved && a->state != b->state ? DIFF_STATE : 0;
+
+    if (diffs != 0) {
+        for (unsigned i = 0; i < 4; i++) {
+            s_counts[i] += (diffs >> i) & 1;
+        }
+
+        if (s_listed_count < MAX_LISTED) {
+            s_listed[s_listed_count].frame = s_frame;
+            s_listed[s_listed_count].diffs = diffs;
+            s_listed_count++;
+        }
+
+        s_differ++;
+    }
+
+    s_checked++;
+    s_ns += trace_now() - s_t0;
+    s_run = NULL;
+}
+
+void determinism_skip(void) {
+    s_skipped++;
+    s_run = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef DETERMINISM_H
+#define DETERMINISM_H
+
+#include "libretro.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Checks if the core runs a frame the same way when it's run again from a
+state saved before it, which run-ahead and rewind depend on. The first run
+is the one the frontend sees, and its video, audio, input and the state
+after it are hashed. The second run starts from the saved state, reads the
+input recorded in the first, and is only hashed. Frames where the two runs
+differ are reported.
+*/
+bool determinism_start(unsigned interval);
+
+/* Prints the report */
+void determinism_stop(void);
+
+/* Environment calls made by the core, for its pixel format */
+void determinism_environment(unsigned cmd, void const* data, bool result);
+
+/* Called once per frame, returns true every interval frames */
+bool determinism_due(void);
+
+/* Starts the first run of a frame, or the second one when replay is true */
+void determinism_begin(bool replay);
+
+/* What the core gives to the frontend during a run */
+void determinism_video(void const* data, unsigned width, unsigned height, size_t pitch);
+void determinism_audio(int16_t const* data, size_t frames);
+
+/* Records the input read in the first run, and gives it back in the same order in the second */
+void determinism_input(unsigned port, unsigned device, unsigned index, unsigned id, int16_t value);
+int16_t determinism_replay_input(unsigned port, unsigned device, unsigned index, unsigned id);
+
+/* Ends a run with the state after it, or NULL if it couldn't be saved, the second one compares both runs */
+void determinism_end(void const* state, size_t size);
+
+/* A frame that was due but couldn't be checked */
+void determinism_skip(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DETERMINISM_H */
@@ -0,0 +1,440 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "dirty.h"
+#include "trace.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define TAG "[LRPROXY] "
+
+/* Bit of the /proc/self/pagemap entries set when the page was written since the soft-dirty bits were cleared */
+#define PAGEMAP_SOFT_DIRTY (UINT64_C(1) << 55)
+
+/* Page size used when comparing pages with a copy on systems where it can't be queried */
+#define DEFAULT_PAGE_SIZE 4096
+
+/* Memory added since the last reset, as page aligned address ranges */
+typedef struct {
+    uintptr_t begin;
+    uintptr_t end;
+}
+range_t;
+
+static range_t* s_ranges;
+static size_t s_range_count;
+static size_t s_range_capacity;
+
+/* The same memory with overlapping and adjacent ranges merged, which is what's tracked */
+static dirty_area_t* s_areas;
+static size_t s_area_count;
+static bool s_tracking;
+
+static int s_clear_fd = -1;
+static int s_pagemap_fd = -1;
+static bool s_soft_dirty;
+static size_t s_page_size;
+
+/* Page map entries of an area, and the pages written in the current frame */
+static uint64_t* s_entries;
+static dirty_page_t* s_dirty;
+static size_t s_capacity;
+
+/* Without soft-dirty bits, pages are compared with a copy of all the tracked memory */
+static uint8_t* s_copy;
+
+static FILE* s_file;
+
+static uint64_t s_frame;
+static uint64_t s_t0;
+static uint64_t s_tracked_pages;
+static size_t s_state_size;
+static histogram_t s_pages;
+static histogram_t s_times;
+
+#ifdef __linux__
+/* Writing 4 to clear_refs clears the soft-dirty bits of all pages of the process */
+static bool clear_soft_dirty(void) {
+    return write(s_clear_fd, "4", 1) == 1;
+}
+
+static bool read_pagemap(uintptr_t const address, size_t const pages) {
+    size_t const size = pages * sizeof(uint64_t);
+    off_t const offset = (off_t)(address / s_page_size * sizeof(uint64_t));
+    return pread(s_pagemap_fd, s_entries, size, offset) == (ssize_t)size;
+}
+
+/* Kernels without CONFIG_MEM_SOFT_DIRTY accept the write to clear_refs, so check if a written page is flagged */
+static bool has_soft_dirty(void) {
+    void* probe;
+
+    if (posix_memalign(&probe, s_page_size, s_page_size) != 0) {
+        return false;
+    }
+
+    volatile uint8_t* const page = (volatile uint8_t*)probe;
+    page[0] = 1;
+    bool ok = clear_soft_dirty();
+    page[0] = 2;
+
+    ok = ok && read_pagemap((uintptr_t)probe, 1) && (s_entries[0] & PAGEMAP_SOFT_DIRTY) != 0;
+    free(probe);
+    return ok;
+}
+#endif
+
+static bool reserve(size_t const pages) {
+    if (pages <= s_capacity) {
+        return true;
+    }
+
+    uint64_t* const entries = (uint64_t*)realloc(s_entries, pages * sizeof(*entries));
+    s_entries = entries != NULL ? entries : s_entries;
+    dirty_page_t* const dirty = (dirty_page_t*)realloc(s_dirty, pages * sizeof(*dirty));
+    s_dirty = dirty != NULL ? dirty : s_dirty;
+
+    if (entries == NULL || dirty == NULL) {
+        return false;
+    }
+
+    s_capacity = pages;
+    return true;
+}
+
+bool dirty_start(char const* const path) {
+    s_range_count = s_area_count = 0;
+    s_tracking = false;
+    s_frame = 0;
+    s_tracked_pages = 0;
+    s_state_size = 0;
+    histogram_reset(&s_pages);
+    histogram_reset(&s_times);
+
+    s_soft_dirty = false;
+    s_page_size = DEFAULT_PAGE_SIZE;
+
+#ifdef __linux__
+    s_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    s_clear_fd = open("/proc/self/clear_refs", O_WRONLY);
+    s_pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    s_soft_dirty = s_clear_fd >= 0 && s_pagemap_fd >= 0 && reserve(1) && has_soft_dirty();
+#endif
+
+    if (!s_soft_dirty) {
+        fprintf(stderr, TAG "No soft-dirty page tracking, pages will be compared with a copy\n");
+    }
+
+    s_file = NULL;
+
+    if (path != NULL && *path != 0) {
+        s_file = fopen(path, "wb");
+
+        if (s_file == NULL) {
+            fprintf(stderr, TAG "Couldn't create \"%s\"\n", path);
+        }
+        else {
+            dirty_header_t header;
+            memcpy(header.magic, DIRTY_MAGIC, sizeof(header.magic));
+            header.version = DIRTY_VERSION;
+            header.page_size = (uint32_t)s_page_size;
+            fwrite(&header, sizeof(header), 1, s_file);
+        }
+    }
+
+    return true;
+}
+
+void dirty_stop(void) {
+    if (s_pages.count != 0) {
+        fprintf(
+            stderr,
+            TAG "Dirty pages (%s): %zu areas, %llu pages of %zu bytes (%llu KiB) tracked\n",
+            s_soft_dirty ? "soft-dirty" : "copy",
+            s_area_count,
+            (unsigned long long)s_tracked_pages,
+            s_page_size,
+            (unsigned long long)(s_tracked_pages * s_page_size / 1024)
+        );
+
+        fprintf(
+            stderr,
+            TAG "Dirty pages per frame %.1f mean, %llu p50, %llu p99, %llu max, %.2f%% of the tracked memory\n",
+            (double)s_pages.total / (double)s_pages.count,
+            (unsigned long long)histogram_percentile(&s_pages, 50.0),
+            (unsigned long long)histogram_percentile(&s_pages, 99.0),
+            (unsigned long long)s_pages.max,
+            s_tracked_pages != 0 ? (double)s_pages.total * 100.0 / (double)s_pages.count / (double)s_tracked_pages : 0.0
+        );
+
+        if (s_state_size != 0) {
+            fprintf(
+                stderr,
+                TAG "The dirty pages are %.1f KiB per frame, and retro_serialize %.1f KiB\n",
+                (double)s_pages.total * (double)s_page_size / (double)s_pages.count / 1024.0,
+                s_state_size / 1024.0
+            );
+        }
+
+        fprintf(
+            stderr,
+            TAG "Tracking took %.2f us mean, %.2f us p99 per frame\n",
+            (double)s_times.total / (double)s_times.count / 1000.0,
+            histogram_percentile(&s_times, 99.0) / 1000.0
+        );
+    }
+
+#ifdef __linux__
+    if (s_clear_fd >= 0) {
+        close(s_clear_fd);
+    }
+
+    if (s_pagemap_fd >= 0) {
+        close(s_pagemap_fd);
+    }
+#endif
+
+    if (s_file != NULL) {
+        fclose(s_file);
+    }
+
+    free(s_ranges);
+    free(s_areas);
+    free(s_entries);
+    free(s_dirty);
+    free(s_copy);
+
+    s_clear_fd = s_pagemap_fd = -1;
+    s_file = NULL;
+    s_ranges = NULL;
+    s_areas = NULL;
+    s_entries = NULL;
+    s_dirty = NULL;
+    s_copy = NULL;
+    s_range_capacity = s_capacity = 0;
+    s_range_count = s_area_count = 0;
+    s_tracking = false;
+}
+
+/* The areas are kept for the report until the next dirty_track */
+void dirty_reset(void) {
+    s_range_count = 0;
+    s_tracking = false;
+}
+
+void dirty_add_memory(void* const data, size_t const size) {
+    if (data == NULL || size == 0) {
+        return;
+    }
+
+    if (s_range_count == s_range_capacity) {
+        size_t const capacity = s_range_capacity == 0 ? 16 : s_range_capacity * 2;
+        range_t* const ranges = (range_t*)realloc(s_ranges, capacity * sizeof(*ranges));
+
+        if (ranges == NULL) {
+            return;
+        }
+
+        s_ranges = ranges;
+        s_range_capacity = capacity;
+    }
+
+    uintptr_t const begin = (uintptr_t)data;
+    range_t* const range = &s_ranges[s_range_count++];
+    range->begin = begin / s_page_size * s_page_size;
+    range->end = (begin + size + s_page_size - 1) / s_page_size * s_page_size;
+}
+
+void dirty_add_memory_map(struct retro_memory_map const* const map) {
+    for (unsigned i = 0; i < map->num_descriptors; i++) {
+        struct retro_memory_descriptor const* const desc = &map->descriptors[i];
+
+        /* Memory that never changes isn't worth tracking */
+        if ((desc->flags & RETRO_MEMDESC_CONST) == 0 && desc->ptr != NULL) {
+            dirty_add_memory((uint8_t*)desc->ptr + desc->offset, desc->len);
+        }
+    }
+}
+
+static int compare_ranges(void const* const a, void const* const b) {
+    uintptr_t const x = ((range_t const*)a)->begin;
+    uintptr_t const y = ((range_t const*)b)->begin;
+    return x < y ? -1 : x > y;
+}
+
+static void write_areas(void) {
+    dirty_record_t const record = {DIRTY_AREAS, (uint32_t)s_area_count, s_frame};
+    fwrite(&record, sizeof(record), 1, s_file);
+    fwrite(s_areas, sizeof(*s_areas), s_area_count, s_file);
+
+    for (size_t i = 0; i < s_area_count; i++) {
+        fwrite((void const*)(uintptr_t)s_areas[i].address, s_page_size, (size_t)s_areas[i].pages, s_file);
+    }
+}
+
+void dirty_track(size_t const state_size) {
+    s_state_size = state_size;
+    s_area_count = 0;
+    s_tracked_pages = 0;
+
+    if (s_range_count == 0) {
+        return;
+    }
+
+    dirty_area_t* const areas = (dirty_area_t*)realloc(s_areas, s_range_count * sizeof(*areas));
+
+    if (areas == NULL) {
+        return;
+    }
+
+    s_areas = areas;
+    qsort(s_ranges, s_range_count, sizeof(*s_ranges), compare_ranges);
+
+    for (size_t i = 0; i < s_range_count;) {
+        uintptr_t const begin = s_ranges[i].begin;
+        uintptr_t end = s_ranges[i].end;
+
+        for (i++; i < s_range_count && s_ranges[i].begin <= end; i++) {
+            end = s_ranges[i].end > end ? s_ranges[i].end : end;
+        }
+
+        dirty_area_t* const area = &s_areas[s_area_count++];
+        area->address = begin;
+        area->pages = (end - begin) / s_page_size;
+        s_tracked_pages += area->pages;
+    }
+
+    /* The entries are read an area at a time, but the pages written can be in all of them */
+    if (!reserve((size_t)s_tracked_pages)) {
+        fprintf(stderr, TAG "Couldn't allocate memory to track %llu pages\n", (unsigned long long)s_tracked_pages);
+        s_area_count = 0;
+        return;
+    }
+
+    if (!s_soft_dirty) {
+        uint8_t* const copy = (uint8_t*)realloc(s_copy, (size_t)s_tracked_pages * s_page_size);
+
+        if (copy == NULL) {
+            fprintf(stderr, TAG "Couldn't allocate memory to copy %llu pages\n", (unsigned long long)s_tracked_pages);
+            s_area_count = 0;
+            return;
+        }
+
+        s_copy = copy;
+
+        for (size_t i = 0, offset = 0; i < s_area_count; offset += (size_t)s_areas[i].pages * s_page_size, i++) {
+            memcpy(s_copy + offset, (void const*)(uintptr_t)s_areas[i].address, (size_t)s_areas[i].pages * s_page_size);
+        }
+    }
+
+    if (s_file != NULL) {
+        write_areas();
+    }
+
+    s_tracking = true;
+}
+
+void dirty_frame_begin(void) {
+    s_t0 = 0;
+
+#ifdef __linux__
+    if (s_tracking && s_soft_dirty) {
+        s_t0 = trace_now();
+        clear_soft_dirty();
+        s_t0 = trace_now() - s_t0;
+    }
+#endif
+}
+
+/* Adds the pages of the area written in the frame to s_dirty, returns the new count */
+static size_t find_dirty(size_t const i, size_t count, size_t const copy_offset) {
+    dirty_area_t const* const area = &s_areas[i];
+    uint8_t const* const memory = (uint8_t const*)(uintptr_t)area->address;
+
+#ifdef __linux__
+    if (s_soft_dirty) {
+        if (read_pagemap((uintptr_t)area->address, (size_t)area->pages)) {
+            for (size_t j = 0; j < area->pages; j++) {
+                if ((s_entries[j] & PAGEMAP_SOFT_DIRTY) != 0) {
+                    s_dirty[count].area = (uint32_t)i;
+                    s_dirty[count].page = (uint32_t)j;
+                    count++;
+                }
+            }
+        }
+
+        return count;
+    }
+#endif
+
+    uint8_t* const copy = s_copy + copy_offset;
+
+    for (size_t j = 0; j < area->pages; j++) {
+        size_t const offset = j * s_page_size;
+
+        if (memcmp(copy + offset, memory + offset, s_page_size) != 0) {
+            memcpy(copy + offset, memory + offset, s_page_size);
+            s_dirty[count].area = (uint32_t)i;
+            s_dirty[count].page = (uint32_t)j;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void dirty_frame_end(void) {
+    if (!s_tracking) {
+        return;
+    }
+
+    uint64_t const t0 = trace_now();
+    size_t count = 0;
+
+    for (size_t i = 0, offset = 0; i < s_area_count; offset += (size_t)s_areas[i].pages * s_page_size, i++) {
+        count = find_dirty(i, count, offset);
+    }
+
+    if (s_file != NULL && count != 0) {
+        dirty_record_t const record = {DIRTY_FRAME, (uint32_t)count, s_frame};
+        fwrite(&record, sizeof(record), 1, s_file);
+
+        for (size_t i = 0; i < count; i++) {
+            uintptr_t const address = (uintptr_t)s_areas[s_dirty[i].area].address + s_dirty[i].page * s_page_size;
+            fwrite(&s_dirty[i], sizeof(s_dirty[i]), 1, s_file);
+            fwrite((void const*)address, s_page_size, 1, s_file);
+        }
+    }
+
+    histogram_add(&s_pages, count);
+    histogram_add(&s_times, s_t0 + trace_now() - t0);
+    s_frame++;
+}
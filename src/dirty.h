@@ -0,0 +1,90 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include "libretro.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Finds the pages of the core's memory written in each frame with the
+soft-dirty bits of Linux: the bits of the whole process are cleared before
+the frame, and read from /proc/self/pagemap for the core's memory after it.
+When the kernel doesn't have them, the pages are compared with a copy of the
+memory instead, which finds the same pages but costs a pass over all of it.
+The memory is what the core gives with RETRO_ENVIRONMENT_SET_MEMORY_MAPS and
+retro_get_memory_data, and doesn't include anything else the core keeps,
+like the registers of the emulated CPU.
+
+The pages written are optionally saved to a checkpoint file, which is this
+header, followed by a DIRTY_AREAS record with the memory areas and all their
+pages whenever content is loaded, and a DIRTY_FRAME record with the pages
+written in each frame that wrote any. The memory of a frame is rebuilt by
+applying the frame records since the last areas record to its pages.
+*/
+#define DIRTY_MAGIC "LRPXDRT1"
+#define DIRTY_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+}
+dirty_header_t;
+
+typedef enum {
+    DIRTY_AREAS = 1, /* count dirty_area_t, followed by the pages of all areas */
+    DIRTY_FRAME      /* count dirty_page_t, each followed by the page */
+}
+dirty_record_type_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t count;
+    uint64_t frame;
+}
+dirty_record_t;
+
+/* Pages of the core's memory, in the address space of the process that recorded them */
+typedef struct {
+    uint64_t address;
+    uint64_t pages;
+}
+dirty_area_t;
+
+typedef struct {
+    uint32_t area;
+    uint32_t page;
+}
+dirty_page_t;
+
+/* Checks if the kernel has soft-dirty bits, and creates the checkpoint file if path isn't NULL or empty */
+bool dirty_start(char const* path);
+
+/* Prints the report and closes the checkpoint file */
+void dirty_stop(void);
+
+/* Forgets the memory of the core, before it unloads the content */
+void dirty_reset(void);
+
+/* Memory of the core, from RETRO_ENVIRONMENT_SET_MEMORY_MAPS and retro_get_memory_data */
+void dirty_add_memory_map(struct retro_memory_map const* map);
+void dirty_add_memory(void* data, size_t size);
+
+/* Starts tracking the memory added after the content was loaded, state_size is used in the report */
+void dirty_track(size_t state_size);
+
+/* Called before and after each frame */
+void dirty_frame_begin(void);
+void dirty_frame_end(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DIRTY_H */
@@ -21,7 +21,8 @@ extern "C" {
   
   typedef void* dynlib_t;
   
-  #define dynlib_open( path )        dlopen( path, RTLD_LAZY )
+  /* Resolve everything up front instead of on the first call through the PLT */
+  #define dynlib_open( path )        dlopen( path, RTLD_NOW )
   #define dynlib_symbol( lib, name ) dlsym( lib, name )
   #define dynlib_close( lib )        dlclose( lib )
   #define dynlib_error()             dlerror()
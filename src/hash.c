@@ -0,0 +1,52 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "hash.h"
+
+#include <string.h>
+
+uint64_t hash_data(uint64_t h, void const* const data, size_t size) {
+    uint8_t const* p = (uint8_t const*)data;
+
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        h = hash_word(h, word);
+    }
+
+    for (; size != 0; size--, p++) {
+        h = (h ^ *p) * HASH_PRIME;
+    }
+
+    return h;
+}
+
+uint64_t hash_word(uint64_t h, uint64_t const word) {
+    h = (h ^ word) * HASH_PRIME;
+    return h ^ (h >> 29);
+}
+
+uint64_t hash_input_key(unsigned const port, unsigned const device, unsigned const index, unsigned const id) {
+    return (uint64_t)port << 48 | (uint64_t)device << 40 | (uint64_t)index << 32 | (uint64_t)id;
+}
@@ -0,0 +1,33 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+FNV-1a over 64-bit words, with a shift after each multiplication so the high
+bits of a word reach the low bits of the hash, and over bytes for the tail.
+The values end up in pack files and are compared between runs, so the
+functions below must not change.
+*/
+#define HASH_SEED 0xcbf29ce484222325ULL
+#define HASH_PRIME 0x100000001b3ULL
+
+/* Continues the hash h with size bytes of data, start with HASH_SEED */
+uint64_t hash_data(uint64_t h, void const* data, size_t size);
+
+/* Continues the hash h with one word, the same as hash_data with the word's bytes on little-endian CPUs */
+uint64_t hash_word(uint64_t h, uint64_t word);
+
+/* Packs the arguments of an input_state call into one word, to be hashed or compared */
+uint64_t hash_input_key(unsigned port, unsigned device, unsigned index, unsigned id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HASH_H */
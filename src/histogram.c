@@ -0,0 +1,102 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "histogram.h"
+
+#include <string.h>
+
+static unsigned bucket_index(uint64_t const value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned)value;
+    }
+
+    unsigned const msb = 63 - (unsigned)__builtin_clzll(value);
+
+    if (msb >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    /* shift >= 1, and value >> shift is between HISTOGRAM_SUB_BUCKETS / 2 and HISTOGRAM_SUB_BUCKETS - 1 */
+    unsigned const shift = msb - HISTOGRAM_SUB_BITS + 1;
+    unsigned const sub = (unsigned)(value >> shift) - HISTOGRAM_SUB_BUCKETS / 2;
+    return HISTOGRAM_SUB_BUCKETS + (shift - 1) * (HISTOGRAM_SUB_BUCKETS / 2) + sub;
+}
+
+/* Highest value that falls into the bucket */
+static uint64_t bucket_value(unsigned const index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+
+    unsigned const shift = (index - HISTOGRAM_SUB_BUCKETS) / (HISTOGRAM_SUB_BUCKETS / 2) + 1;
+    uint64_t const sub = (index - HISTOGRAM_SUB_BUCKETS) % (HISTOGRAM_SUB_BUCKETS / 2) + HISTOGRAM_SUB_BUCKETS / 2;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_reset(histogram_t* const hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->min = UINT64_MAX;
+}
+
+void histogram_add(histogram_t* const hist, uint64_t const value) {
+    hist->count++;
+    hist->total += value;
+    hist->min = value < hist->min ? value : hist->min;
+    hist->max = value > hist->max ? value : hist->max;
+    hist->buckets[bucket_index(value)]++;
+}
+
+void histogram_merge(histogram_t* const dest, histogram_t const* const src) {
+    dest->count += src->count;
+    dest->total += src->total;
+    dest->min = src->min < dest->min ? src->min : dest->min;
+    dest->max = src->max > dest->max ? src->max : dest->max;
+
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dest->buckets[i] += src->buckets[i];
+    }
+}
+
+uint64_t histogram_percentile(histogram_t const* const hist, double const percentile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    /* Rank of the sample at the percentile, rounded up */
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->count + 0.999999);
+    rank = rank == 0 ? 1 : rank;
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+
+        if (seen >= rank) {
+            uint64_t const value = bucket_value(i);
+            return value < hist->max && i != HISTOGRAM_BUCKETS - 1 ? value : hist->max;
+        }
+    }
+
+    return hist->max;
+}
@@ -0,0 +1,45 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Log-bucketed histogram in the style of HdrHistogram. Values below
+HISTOGRAM_SUB_BUCKETS get one bucket each, and every power of two above that
+is split into HISTOGRAM_SUB_BUCKETS / 2 linear buckets, so the error of any
+percentile is below 1 / HISTOGRAM_SUB_BUCKETS (about 3%). Values are
+nanoseconds, anything above 2^HISTOGRAM_MAX_BITS (about 18 minutes) goes to
+the last bucket.
+*/
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1U << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS) * (HISTOGRAM_SUB_BUCKETS / 2))
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+}
+histogram_t;
+
+void histogram_reset(histogram_t* hist);
+void histogram_add(histogram_t* hist, uint64_t value);
+
+/* Merges the samples of src into dest */
+void histogram_merge(histogram_t* dest, histogram_t const* src);
+
+/* Highest value equivalent to the percentile (0 to 100), clamped to the maximum */
+uint64_t histogram_percentile(histogram_t const* hist, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTOGRAM_H */
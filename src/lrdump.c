@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* lrproxy-dump: renders a binary trace written by the proxy */
+
+#include "trace.h"
+#include "tracefmt.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int usage(char const* const name) {
+    fprintf(stderr, "Usage: %s [-f text|json|csv] [trace file]\n", name);
+    fprintf(stderr, "Reads the trace from stdin if no file is given.\n");
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    tracefmt_format_t format = TRACEFMT_TEXT;
+    char const* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            char const* const name = argv[++i];
+
+            if (strcmp(name, "text") == 0) {
+                format = TRACEFMT_TEXT;
+            }
+            else if (strcmp(name, "json") == 0) {
+                format = TRACEFMT_JSON;
+            }
+            else if (strcmp(name, "csv") == 0) {
+                format = TRACEFMT_CSV;
+            }
+            else {
+                return usage(argv[0]);
+            }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != 0) {
+            return usage(argv[0]);
+        }
+        else if (path == NULL) {
+            path = argv[i];
+        }
+        else {
+            return usage(argv[0]);
+        }
+    }
+
+    FILE* const file = path == NULL || strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Couldn't open \"%s\"\n", path);
+        return 1;
+    }
+
+    trace_header_t header;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "Not a trace file\n");
+        return 1;
+    }
+
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "Unsupported trace version %u with %u bytes per record\n", header.version, header.record_size);
+        return 1;
+    }
+
+    static tracefmt_t fmt;
+    tracefmt_init(&fmt, stdout, format);
+
+    trace_record_t rec;
+
+    while (fread(&rec, sizeof(rec), 1, file) == 1) {
+        tracefmt_record(&fmt, &rec);
+    }
+
+    tracefmt_finish(&fmt);
+
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    return 0;
+}
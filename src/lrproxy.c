@@ -23,503 +23,678 @@ SOFTWARE.
 */
 
 #include "libretro.h"
-#include "dynlib.h"
+#include "core.h"
+#include "trace.h"
+#include "config.h"
+#include "stats.h"
+#include "profiler.h"
+#include "session.h"
+#include "compare.h"
+#include "secondary.h"
+#include "rewind.h"
+#include "statediff.h"
+#include "dirty.h"
+#include "checkpoint.h"
+#include "pack.h"
+#include "determinism.h"
+#include "hash.h"
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <inttypes.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
 
 #define XSTR(s) STR(s)
 #define STR(s) #s
 #define TAG "[LRPROXY] "
 
-static dynlib_t s_handle = NULL;
+/* The core setting takes precedence, PROXY_FOR is only the default */
+#ifdef PROXY_FOR
+    #define DEFAULT_CORE XSTR(PROXY_FOR)
+#else
+    #define DEFAULT_CORE NULL
+#endif
+
 static retro_environment_t s_env = NULL;
 
-static void (*s_init)(void);
-static void (*s_deinit)(void);
-static unsigned (*s_api_version)(void);
-static void (*s_get_system_info)(struct retro_system_info*);
-static void (*s_get_system_av_info)(struct retro_system_av_info*);
-static void (*s_set_environment)(retro_environment_t);
-static void (*s_set_video_refresh)(retro_video_refresh_t);
-static void (*s_set_audio_sample)(retro_audio_sample_t);
-static void (*s_set_audio_sample_batch)(retro_audio_sample_batch_t);
-static void (*s_set_input_poll)(retro_input_poll_t);
-static void (*s_set_input_state)(retro_input_state_t);
-static void (*s_set_controller_port_device)(unsigned, unsigned);
-static void (*s_reset)(void);
-static void (*s_run)(void);
-static size_t (*s_serialize_size)(void);
-static bool (*s_serialize)(void*, size_t);
-static bool (*s_unserialize)(void const*, size_t);
-static void (*s_cheat_reset)(void);
-static void (*s_cheat_set)(unsigned, bool, char const*);
-static bool (*s_load_game)(struct retro_game_info const*);
-static bool (*s_load_game_special)(unsigned, struct retro_game_info const*, size_t);
-static void (*s_unload_game)(void);
-static unsigned (*s_getRegion)(void);
-static void* (*s_get_memory_data)(unsigned);
-static size_t (*s_get_memory_size)(unsigned);
-
-#ifdef QUIET
-    #define CORE_DLSYM(prop, name) \
-        do { \
-            void* sym = dynlib_symbol(s_handle, name); \
-            if (!sym) goto error; \
-            memcpy(&prop, &sym, sizeof(prop)); \
-        } while (0)
+/* Frontend callbacks, wrapped to time them when the stats setting is on, input_state to record it, and video and audio to compare them */
+static retro_video_refresh_t s_video_refresh = NULL;
+static retro_audio_sample_t s_audio_sample = NULL;
+static retro_audio_sample_batch_t s_audio_sample_batch = NULL;
+static retro_input_poll_t s_input_poll = NULL;
+static retro_input_state_t s_input_state = NULL;
+
+static core_t s_core;
+
+/* Logging categories, selected at runtime with the log setting */
+#define LOG_LIFECYCLE (1U << 0)
+#define LOG_RUN       (1U << 1)
+#define LOG_SERIALIZE (1U << 2)
+#define LOG_ENV       (1U << 3)
+#define LOG_CALLBACKS (1U << 4)
+#define LOG_DETAILS   (1U << 5)
+#define LOG_ALL       (LOG_LIFECYCLE | LOG_RUN | LOG_SERIALIZE | LOG_ENV | LOG_CALLBACKS | LOG_DETAILS)
+
+#define LOGGING(category) ((s_log & (category)) != 0)
+#define LOGGING_DETAILS(category) ((s_log & ((category) | LOG_DETAILS)) == ((category) | LOG_DETAILS))
+
+#ifdef PASSTHROUGH
+/* Nothing is ever logged, so the compiler removes the logging code and the wrappers become tail calls */
+static unsigned const s_log = 0;
 #else
-    #define CORE_DLSYM(prop, name) \
-        do { \
-            fprintf(stderr, TAG "Getting pointer to %s\n", name); \
-            void* sym = dynlib_symbol(s_handle, name); \
-            if (!sym) goto error; \
-            memcpy(&prop, &sym, sizeof(prop)); \
-        } while (0)
+static unsigned s_log = 0;
 #endif
 
-static void init(void) {
-    if (s_handle != NULL) {
-        return;
+/* One bit per environment command, ignoring RETRO_ENVIRONMENT_EXPERIMENTAL */
+static uint8_t s_log_env[32];
+
+#ifdef PASSTHROUGH
+static bool const s_stats = false;
+static bool const s_perf = false;
+#else
+static bool s_stats = false;
+static bool s_perf = false;
+#endif
+
+/* Number of frames kept in memory when only slow frames are logged, and how slow they must be */
+#ifdef PASSTHROUGH
+static unsigned const s_slow_frames = 0;
+#else
+static unsigned s_slow_frames = 0;
+#endif
+
+static double s_slow_threshold = 1.0;
+static uint64_t s_slow_limit = 0;
+
+/* Where the profile of retro_run is written, NULL when not profiling */
+#ifdef PASSTHROUGH
+static char const* const s_profile = NULL;
+#else
+static char const* s_profile = NULL;
+#endif
+
+/* Whether the calls and what the core gets from the callbacks are recorded to replay them later */
+#ifdef PASSTHROUGH
+static bool const s_record = false;
+#else
+static bool s_record = false;
+#endif
+
+/* Whether another build of the core runs in lockstep to compare it with this one */
+#ifdef PASSTHROUGH
+static bool const s_compare = false;
+#else
+static bool s_compare = false;
+#endif
+
+/* Frames run ahead of the frontend in every retro_run to hide the input lag of the core */
+#ifdef PASSTHROUGH
+static unsigned const s_run_ahead = 0;
+#else
+static unsigned s_run_ahead = 0;
+#endif
+
+/* Whether a second copy of the core is loaded, to compare it or to run ahead with it */
+#ifdef PASSTHROUGH
+static bool const s_secondary = false;
+#else
+static bool s_secondary = false;
+#endif
+
+/*
+The input the first copy read in this frame and in the previous one, and
+whether the second copy is ahead of it, which stops being true when the
+frontend changes the state of the first one
+*/
+static uint64_t s_input_hash = 0;
+static uint64_t s_previous_input_hash = 0;
+static bool s_synced = false;
+
+/* Whether states are kept to rewind while the rewind button of the first joypad is held */
+#ifdef PASSTHROUGH
+static bool const s_rewind = false;
+#else
+static bool s_rewind = false;
+#endif
+
+static unsigned s_rewind_interval = 1;
+static unsigned s_rewind_button = RETRO_DEVICE_ID_JOYPAD_L3;
+static unsigned s_rewind_frames = 0;
+
+/* Whether the state is saved after every frame to see how much of it changes */
+#ifdef PASSTHROUGH
+static bool const s_state_diff = false;
+#else
+static bool s_state_diff = false;
+#endif
+
+/* Whether the pages of the core's memory written in each frame are tracked */
+#ifdef PASSTHROUGH
+static bool const s_dirty = false;
+#else
+static bool s_dirty = false;
+#endif
+
+/* Whether the state is periodically saved to disk by the checkpoint writer */
+#ifdef PASSTHROUGH
+static bool const s_checkpoint = false;
+#else
+static bool s_checkpoint = false;
+#endif
+
+/* The pack where the states saved by the frontend are added, and the state loaded after the content, from 1 */
+#ifdef PASSTHROUGH
+static bool const s_archive = false;
+#else
+static bool s_archive = false;
+#endif
+
+static pack_t s_pack;
+static unsigned s_archive_state = 0;
+static uint64_t s_archived = 0;
+static uint64_t s_archived_bytes = 0;
+static uint64_t s_archive_chunk_bytes = 0;
+static uint64_t s_archive_ns = 0;
+
+/* The size of the state, asked of the core again only after something that may change it, 0 when unknown */
+#ifdef PASSTHROUGH
+static bool const s_cache_size = false;
+#else
+static bool s_cache_size = false;
+#endif
+
+static size_t s_cached_size = 0;
+static unsigned s_verify_size = 0; /* ask the core anyway every this many calls */
+static uint64_t s_size_calls = 0;
+static uint64_t s_size_core_calls = 0;
+static uint64_t s_size_core_ns = 0;
+static uint64_t s_size_verified = 0;
+static uint64_t s_size_changed = 0;
+
+/* Whether frames are run twice from the same state to check that the core is deterministic */
+#ifdef PASSTHROUGH
+static bool const s_determinism = false;
+#else
+static bool s_determinism = false;
+#endif
+
+/* Which run of a checked frame is going on, the second one doesn't reach the frontend */
+typedef enum {
+    CHECK_NONE,
+    CHECK_FIRST,
+    CHECK_REPLAY
+}
+check_t;
+
+static check_t s_checking = CHECK_NONE;
+
+/* The state after the first run of a checked frame, which the frontend goes on from */
+static void* s_check_state = NULL;
+static size_t s_check_capacity = 0;
+
+/* The state saved after the frame that advances the emulation, loaded back after the frames run ahead */
+static void* s_state = NULL;
+static size_t s_state_capacity = 0;
+
+/* What GET_AUDIO_VIDEO_ENABLE tells the core, and what reaches the frontend, in the frame being run */
+#define AV_VIDEO 1
+#define AV_AUDIO 2
+#define AV_FAST_SAVESTATES 4
+#define AV_HARD_DISABLE_AUDIO 8
+
+static int s_av_enable = AV_VIDEO | AV_AUDIO;
+
+static void video_refresh(void const* data, unsigned width, unsigned height, size_t pitch);
+static size_t audio_sample_batch(int16_t const* data, size_t frames);
+
+/* Frames are timed for the statistics and to find the slow ones */
+#define TIMING() (s_stats || s_slow_frames != 0 || s_compare)
+
+/* Time spent inside the core by each call, only measured when the stats setting is on */
+#define STATS_BEGIN() (s_stats ? trace_now() : 0)
+#define STATS_END(id, t0) do { if (s_stats) stats_add(id, trace_now() - (t0)); } while (0)
+
+/* Time spent in the frontend's callbacks, which compare also takes out of the core's time */
+#define CALLBACKS_TIMED() (s_stats || s_compare)
+#define CALLBACK_BEGIN() (CALLBACKS_TIMED() ? trace_now() : 0)
+
+#define LOGGING_ENV(cmd) ((s_log_env[((cmd) & 0xff) >> 3] & (1U << ((cmd) & 7))) != 0)
+
+#ifndef PASSTHROUGH
+static unsigned parse_log(char const* spec) {
+    static struct {char const* name; unsigned mask;} const categories[] = {
+        {"lifecycle", LOG_LIFECYCLE},
+        {"run", LOG_RUN},
+        {"serialize", LOG_SERIALIZE},
+        {"env", LOG_ENV},
+        {"callbacks", LOG_CALLBACKS},
+        {"details", LOG_DETAILS},
+        {"all", LOG_ALL},
+        {"none", 0}
+    };
+
+    if (isdigit((unsigned char)*spec)) {
+        return (unsigned)strtoul(spec, NULL, 0) & LOG_ALL;
     }
 
-    fprintf(stderr, TAG "Loading core \"%s\"\n", XSTR(PROXY_FOR));
+    unsigned mask = 0;
 
-    s_handle = dynlib_open(XSTR(PROXY_FOR));
+    while (*spec != 0) {
+        size_t const length = strcspn(spec, ", ");
+        size_t i = 0;
 
-    if (s_handle == NULL) {
-        fprintf(stderr, TAG "Error loading core: %s\n", dynlib_error());
-        return;
+        for (; i < sizeof(categories) / sizeof(categories[0]); i++) {
+            if (strlen(categories[i].name) == length && strncmp(categories[i].name, spec, length) == 0) {
+                mask |= categories[i].mask;
+                break;
+            }
+        }
+
+        if (i == sizeof(categories) / sizeof(categories[0]) && length != 0) {
+            fprintf(stderr, TAG "Unknown log category \"%.*s\"\n", (int)length, spec);
+        }
+
+        spec += length;
+        spec += strspn(spec, ", ");
     }
 
-    CORE_DLSYM(s_init, "retro_init");
-    CORE_DLSYM(s_deinit, "retro_deinit");
-    CORE_DLSYM(s_api_version, "retro_api_version");
-    CORE_DLSYM(s_get_system_info, "retro_get_system_info");
-    CORE_DLSYM(s_get_system_av_info, "retro_get_system_av_info");
-    CORE_DLSYM(s_set_environment, "retro_set_environment");
-    CORE_DLSYM(s_set_video_refresh, "retro_set_video_refresh");
-    CORE_DLSYM(s_set_audio_sample, "retro_set_audio_sample");
-    CORE_DLSYM(s_set_audio_sample_batch, "retro_set_audio_sample_batch");
-    CORE_DLSYM(s_set_input_poll, "retro_set_input_poll");
-    CORE_DLSYM(s_set_input_state, "retro_set_input_state");
-    CORE_DLSYM(s_set_controller_port_device, "retro_set_controller_port_device");
-    CORE_DLSYM(s_reset, "retro_reset");
-    CORE_DLSYM(s_run, "retro_run");
-    CORE_DLSYM(s_serialize_size, "retro_serialize_size");
-    CORE_DLSYM(s_serialize, "retro_serialize");
-    CORE_DLSYM(s_unserialize, "retro_unserialize");
-    CORE_DLSYM(s_cheat_reset, "retro_cheat_reset");
-    CORE_DLSYM(s_cheat_set, "retro_cheat_set");
-    CORE_DLSYM(s_load_game, "retro_load_game");
-    CORE_DLSYM(s_load_game_special, "retro_load_game_special");
-    CORE_DLSYM(s_unload_game, "retro_unload_game");
-    CORE_DLSYM(s_getRegion, "retro_get_region");
-    CORE_DLSYM(s_get_memory_data, "retro_get_memory_data");
-    CORE_DLSYM(s_get_memory_size, "retro_get_memory_size");
-
-    return;
-
-error:
-    fprintf(stderr, TAG "Couldn't find symbol: %s\n", dynlib_error());
-    dynlib_close(s_handle);
-    s_handle = NULL;
+    return mask;
 }
 
-#undef CORE_DLSYM
+static void parse_log_env(char const* spec) {
+    if (spec == NULL || *spec == 0) {
+        memset(s_log_env, 0xff, sizeof(s_log_env));
+        return;
+    }
 
-static char const* pixel_format_str(enum retro_pixel_format const format) {
-    static char unknown[32];
+    memset(s_log_env, 0, sizeof(s_log_env));
 
-    switch (format) {
-        case RETRO_PIXEL_FORMAT_0RGB1555: return "RETRO_PIXEL_FORMAT_0RGB1555";
-        case RETRO_PIXEL_FORMAT_XRGB8888: return "RETRO_PIXEL_FORMAT_XRGB8888";
-        case RETRO_PIXEL_FORMAT_RGB565: return "RETRO_PIXEL_FORMAT_RGB565";
-        case RETRO_PIXEL_FORMAT_UNKNOWN: return "RETRO_PIXEL_FORMAT_UNKNOWN";
+    while (*spec != 0) {
+        char* end;
+        unsigned long const cmd = strtoul(spec, &end, 0);
 
-        default:
-            snprintf(unknown, sizeof(unknown), "%d", format);
-            return unknown;
+        if (end == spec) {
+            fprintf(stderr, TAG "Invalid environment command in \"%s\"\n", spec);
+            return;
+        }
+
+        s_log_env[(cmd & 0xff) >> 3] |= 1U << (cmd & 7);
+        spec = end + strspn(end, ", ");
     }
 }
+#endif
+
+static void init(void) {
+    if (s_core.handle != NULL) {
+        return;
+    }
 
-static char const* device_str(unsigned const device) {
-    static char unknown[32];
+    config_load();
 
-    switch (device & RETRO_DEVICE_MASK) {
-        case RETRO_DEVICE_NONE: return "RETRO_DEVICE_NONE";
-        case RETRO_DEVICE_JOYPAD: return "RETRO_DEVICE_JOYPAD";
-        case RETRO_DEVICE_MOUSE: return "RETRO_DEVICE_MOUSE";
-        case RETRO_DEVICE_KEYBOARD: return "RETRO_DEVICE_KEYBOARD";
-        case RETRO_DEVICE_LIGHTGUN: return "RETRO_DEVICE_LIGHTGUN";
-        case RETRO_DEVICE_ANALOG: return "RETRO_DEVICE_ANALOG";
-        case RETRO_DEVICE_POINTER: return "RETRO_DEVICE_POINTER";
+#ifndef PASSTHROUGH
+    s_log = parse_log(config_string("log", "all"));
+    parse_log_env(config_string("log_env", NULL));
 
-        default:
-            snprintf(unknown, sizeof(unknown), "%u", device & RETRO_DEVICE_MASK);
-            return unknown;
+    s_slow_frames = (unsigned)config_uint("slow_frames", 0);
+    s_slow_threshold = config_double("slow_threshold", 1.0);
+
+    if (s_slow_frames != 0) {
+        /* The retro_run records delimit the frames */
+        s_log |= LOG_RUN;
     }
-}
 
-static char const* device_index_str(unsigned const device, unsigned const index) {
-    static char unknown[32];
+    if (s_log != 0) {
+        trace_start(s_slow_frames);
 
-    if (device == RETRO_DEVICE_ANALOG) {
-        switch (index) {
-            case RETRO_DEVICE_INDEX_ANALOG_LEFT: return "RETRO_DEVICE_INDEX_ANALOG_LEFT";
-            case RETRO_DEVICE_INDEX_ANALOG_RIGHT: return "RETRO_DEVICE_INDEX_ANALOG_RIGHT";
-            case RETRO_DEVICE_INDEX_ANALOG_BUTTON: return "RETRO_DEVICE_INDEX_ANALOG_BUTTON";
+        char const* const crash_dump = config_string("crash_dump", NULL);
+
+        if (crash_dump != NULL && *crash_dump != 0) {
+            trace_crash_dump(crash_dump, (unsigned)config_uint("crash_records", 4096));
         }
     }
 
-    snprintf(unknown, sizeof(unknown), "%u", index);
-    return unknown;
-}
+    s_stats = config_bool("stats", false);
+    s_perf = s_stats && config_bool("perf", false);
 
-static char const* device_id_str(unsigned const device, unsigned const id) {
-    static char unknown[32];
-
-    switch (device & RETRO_DEVICE_MASK) {
-        case RETRO_DEVICE_JOYPAD:
-            switch (id) {
-                case RETRO_DEVICE_ID_JOYPAD_B: return "RETRO_DEVICE_ID_JOYPAD_B";
-                case RETRO_DEVICE_ID_JOYPAD_Y: return "RETRO_DEVICE_ID_JOYPAD_Y";
-                case RETRO_DEVICE_ID_JOYPAD_SELECT: return "RETRO_DEVICE_ID_JOYPAD_SELECT";
-                case RETRO_DEVICE_ID_JOYPAD_START: return "RETRO_DEVICE_ID_JOYPAD_START";
-                case RETRO_DEVICE_ID_JOYPAD_UP: return "RETRO_DEVICE_ID_JOYPAD_UP";
-                case RETRO_DEVICE_ID_JOYPAD_DOWN: return "RETRO_DEVICE_ID_JOYPAD_DOWN";
-                case RETRO_DEVICE_ID_JOYPAD_LEFT: return "RETRO_DEVICE_ID_JOYPAD_LEFT";
-                case RETRO_DEVICE_ID_JOYPAD_RIGHT: return "RETRO_DEVICE_ID_JOYPAD_RIGHT";
-                case RETRO_DEVICE_ID_JOYPAD_A: return "RETRO_DEVICE_ID_JOYPAD_A";
-                case RETRO_DEVICE_ID_JOYPAD_X: return "RETRO_DEVICE_ID_JOYPAD_X";
-                case RETRO_DEVICE_ID_JOYPAD_L: return "RETRO_DEVICE_ID_JOYPAD_L";
-                case RETRO_DEVICE_ID_JOYPAD_R: return "RETRO_DEVICE_ID_JOYPAD_R";
-                case RETRO_DEVICE_ID_JOYPAD_L2: return "RETRO_DEVICE_ID_JOYPAD_L2";
-                case RETRO_DEVICE_ID_JOYPAD_R2: return "RETRO_DEVICE_ID_JOYPAD_R2";
-                case RETRO_DEVICE_ID_JOYPAD_L3: return "RETRO_DEVICE_ID_JOYPAD_L3";
-                case RETRO_DEVICE_ID_JOYPAD_R3: return "RETRO_DEVICE_ID_JOYPAD_R3";
-            }
+    s_profile = config_string("profile", NULL);
 
-            break;
+    if (s_profile != NULL && (*s_profile == 0 || !profiler_start((unsigned)config_uint("profile_hz", 1000)))) {
+        s_profile = NULL;
+    }
 
-        case RETRO_DEVICE_MOUSE:
-            switch (id) {
-                case RETRO_DEVICE_ID_MOUSE_X: return "RETRO_DEVICE_ID_MOUSE_X";
-                case RETRO_DEVICE_ID_MOUSE_Y: return "RETRO_DEVICE_ID_MOUSE_Y";
-                case RETRO_DEVICE_ID_MOUSE_LEFT: return "RETRO_DEVICE_ID_MOUSE_LEFT";
-                case RETRO_DEVICE_ID_MOUSE_RIGHT: return "RETRO_DEVICE_ID_MOUSE_RIGHT";
-                case RETRO_DEVICE_ID_MOUSE_WHEELUP: return "RETRO_DEVICE_ID_MOUSE_WHEELUP";
-                case RETRO_DEVICE_ID_MOUSE_WHEELDOWN: return "RETRO_DEVICE_ID_MOUSE_WHEELDOWN";
-                case RETRO_DEVICE_ID_MOUSE_MIDDLE: return "RETRO_DEVICE_ID_MOUSE_MIDDLE";
-                case RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELUP: return "RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELUP";
-                case RETRO_DEVICE_ID_MOUSE_BUTTON_4: return "RETRO_DEVICE_ID_MOUSE_BUTTON_4";
-                case RETRO_DEVICE_ID_MOUSE_BUTTON_5: return "RETRO_DEVICE_ID_MOUSE_BUTTON_5";
-            }
+    if (s_stats) {
+        stats_start();
+    }
 
-            break;
+    char const* const record = config_string("record", NULL);
+    s_record = record != NULL && *record != 0 && session_start(record);
 
-        case RETRO_DEVICE_LIGHTGUN:
-            switch (id) {
-                case RETRO_DEVICE_ID_LIGHTGUN_SCREEN_X: return "RETRO_DEVICE_ID_LIGHTGUN_SCREEN_X";
-                case RETRO_DEVICE_ID_LIGHTGUN_SCREEN_Y: return "RETRO_DEVICE_ID_LIGHTGUN_SCREEN_Y";
-                case RETRO_DEVICE_ID_LIGHTGUN_IS_OFFSCREEN: return "RETRO_DEVICE_ID_LIGHTGUN_IS_OFFSCREEN";
-                case RETRO_DEVICE_ID_LIGHTGUN_TRIGGER: return "RETRO_DEVICE_ID_LIGHTGUN_TRIGGER";
-                case RETRO_DEVICE_ID_LIGHTGUN_RELOAD: return "RETRO_DEVICE_ID_LIGHTGUN_RELOAD";
-                case RETRO_DEVICE_ID_LIGHTGUN_AUX_A: return "RETRO_DEVICE_ID_LIGHTGUN_AUX_A";
-                case RETRO_DEVICE_ID_LIGHTGUN_AUX_B: return "RETRO_DEVICE_ID_LIGHTGUN_AUX_B";
-                case RETRO_DEVICE_ID_LIGHTGUN_START: return "RETRO_DEVICE_ID_LIGHTGUN_START";
-                case RETRO_DEVICE_ID_LIGHTGUN_SELECT: return "RETRO_DEVICE_ID_LIGHTGUN_SELECT";
-                case RETRO_DEVICE_ID_LIGHTGUN_AUX_C: return "RETRO_DEVICE_ID_LIGHTGUN_AUX_C";
-                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_UP: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_UP";
-                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_DOWN: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_DOWN";
-                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_LEFT: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_LEFT";
-                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_RIGHT: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_RIGHT";
-                case RETRO_DEVICE_ID_LIGHTGUN_X: return "RETRO_DEVICE_ID_LIGHTGUN_X";
-                case RETRO_DEVICE_ID_LIGHTGUN_Y: return "RETRO_DEVICE_ID_LIGHTGUN_Y";
-                case RETRO_DEVICE_ID_LIGHTGUN_PAUSE: return "RETRO_DEVICE_ID_LIGHTGUN_PAUSE";
-            }
+    char const* const compare = config_string("compare", NULL);
+    s_compare = compare != NULL && *compare != 0 && compare_start(compare, config_string("compare_frames", NULL));
+    s_secondary = s_compare;
 
-            break;
+    s_run_ahead = (unsigned)config_uint("run_ahead", 0);
 
-        case RETRO_DEVICE_ANALOG:
-            switch (id) {
-                case RETRO_DEVICE_ID_ANALOG_X: return "RETRO_DEVICE_ID_ANALOG_X";
-                case RETRO_DEVICE_ID_ANALOG_Y: return "RETRO_DEVICE_ID_ANALOG_Y";
-            }
+    if (s_run_ahead != 0 && (s_record || s_compare)) {
+        /* The frames run ahead would be recorded, or have to be run by the other build too */
+        fprintf(stderr, TAG "Run-ahead doesn't work together with record or compare, disabled\n");
+        s_run_ahead = 0;
+    }
 
-            break;
+    s_state_diff = config_bool("state_diff", false) && statediff_start();
+    s_dirty = config_bool("dirty_pages", false) && dirty_start(config_string("dirty_checkpoints", NULL));
 
-        case RETRO_DEVICE_POINTER:
-            switch (id) {
-                case RETRO_DEVICE_ID_POINTER_X: return "RETRO_DEVICE_ID_POINTER_X";
-                case RETRO_DEVICE_ID_POINTER_Y: return "RETRO_DEVICE_ID_POINTER_Y";
-                case RETRO_DEVICE_ID_POINTER_PRESSED: return "RETRO_DEVICE_ID_POINTER_PRESSED";
-                case RETRO_DEVICE_ID_POINTER_COUNT: return "RETRO_DEVICE_ID_POINTER_COUNT";
-            }
+    char const* const checkpoint = config_string("checkpoint", "");
+    s_checkpoint = *checkpoint != 0 && checkpoint_start(checkpoint, (unsigned)config_uint("checkpoint_interval", 0));
 
-            break;
+    if (config_bool("check_determinism", false)) {
+        if (s_run_ahead != 0 || s_record || s_compare) {
+            /* The check would run the frames run ahead, or add frames the session or B don't have */
+            fprintf(stderr, TAG "The determinism check doesn't work together with run-ahead, record or compare, disabled\n");
+        }
+        else {
+            s_determinism = determinism_start((unsigned)config_uint("check_determinism_interval", 1));
+        }
     }
 
-    snprintf(unknown, sizeof(unknown), "%u", id);
-    return unknown;
-}
+    s_cache_size = config_bool("cache_serialize_size", false);
+    s_verify_size = (unsigned)config_uint("verify_serialize_size", 0);
 
-static char const* hw_context_type_str(enum retro_hw_context_type const ctxtype)
-{
-    static char unknown[32];
-
-    switch (ctxtype) {
-        case RETRO_HW_CONTEXT_NONE: return "RETRO_HW_CONTEXT_NONE";
-        case RETRO_HW_CONTEXT_OPENGL: return "RETRO_HW_CONTEXT_OPENGL";
-        case RETRO_HW_CONTEXT_OPENGLES2: return "RETRO_HW_CONTEXT_OPENGLES2";
-        case RETRO_HW_CONTEXT_OPENGL_CORE: return "RETRO_HW_CONTEXT_OPENGL_CORE";
-        case RETRO_HW_CONTEXT_OPENGLES3: return "RETRO_HW_CONTEXT_OPENGLES3";
-        case RETRO_HW_CONTEXT_OPENGLES_VERSION: return "RETRO_HW_CONTEXT_OPENGLES_VERSION";
-        case RETRO_HW_CONTEXT_VULKAN: return "RETRO_HW_CONTEXT_VULKAN";
-        case RETRO_HW_CONTEXT_DIRECT3D: return "RETRO_HW_CONTEXT_DIRECT3D";
-        case RETRO_HW_CONTEXT_DUMMY: return "RETRO_HW_CONTEXT_DUMMY";
+    char const* const archive = config_string("archive", "");
 
-        default:
-            snprintf(unknown, sizeof(unknown), "%d", ctxtype);
-            return unknown;
+    if (*archive != 0) {
+        s_archive = pack_open(&s_pack, archive, true);
+
+        if (s_archive) {
+            s_archive_state = (unsigned)config_uint("archive_state", 0);
+            s_archive_chunk_bytes = s_pack.chunk_bytes;
+        }
+        else {
+            fprintf(stderr, TAG "Couldn't open archive \"%s\"\n", archive);
+        }
+    }
+
+    size_t const rewind = (size_t)config_uint("rewind", 0);
+
+    if (rewind != 0 && (s_record || s_compare)) {
+        /* Loading the states isn't a call from the frontend, so it can't be recorded or mirrored */
+        fprintf(stderr, TAG "Rewind doesn't work together with record or compare, disabled\n");
+    }
+    else if (rewind != 0) {
+        s_rewind_interval = (unsigned)config_uint("rewind_interval", 1);
+        s_rewind_interval = s_rewind_interval != 0 ? s_rewind_interval : 1;
+        s_rewind_button = (unsigned)config_uint("rewind_button", RETRO_DEVICE_ID_JOYPAD_L3);
+        s_rewind_frames = 0;
+        s_rewind = rewind_start(rewind * 1024 * 1024, s_rewind_interval);
+    }
+#endif
+
+    char const* const core = config_string("core", DEFAULT_CORE);
+
+    if (core == NULL || *core == 0) {
+        fprintf(stderr, TAG "No core to load, set LRPROXY_CORE or core in the configuration file\n");
+        return;
+    }
+
+    fprintf(stderr, TAG "Loading core \"%s\"\n", core);
+
+    if (!core_load(&s_core, core)) {
+        return;
+    }
+
+#ifndef PASSTHROUGH
+    s_synced = false;
+
+    if (s_run_ahead != 0 && config_bool("run_ahead_instance", false)) {
+        /* The second copy's video and audio go through the same wrappers, which drop them unless they're wanted */
+        s_secondary = secondary_load(core, video_refresh, audio_sample_batch);
+
+        if (!s_secondary) {
+            fprintf(stderr, TAG "Running ahead with savestates on the core\n");
+        }
+    }
+#endif
+}
+
+static void set_fps(double const fps) {
+    if (s_stats) {
+        stats_set_fps(fps);
     }
+
+    s_slow_limit = fps > 0.0 ? (uint64_t)(s_slow_threshold * 1000000000.0 / fps) : 0;
+}
+
+#ifndef _WIN32
+/*
+Load the core together with the proxy, so only the entry points that a
+frontend can call first have to check for it. On Windows it's not safe to
+load libraries from DllMain, so the core is loaded by the first of them.
+*/
+__attribute__((constructor)) static void load(void) {
+    init();
 }
+#endif
 
-static void log_device_capabilities(uint64_t const caps) {
-    fprintf(stderr, TAG "    =");
+static bool environment(unsigned cmd, void* data) {
+    bool result = s_env(cmd, data);
 
-    if (caps == 0) {
-        fprintf(stderr, " -");
+    if ((s_run_ahead != 0 || s_rewind) && cmd == RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE) {
+        /* The states saved for run-ahead and rewind never leave memory and are loaded by the same binary */
+        int const frontend = result ? *(int*)data : AV_VIDEO | AV_AUDIO;
+        *(int*)data = (frontend & ~(AV_VIDEO | AV_AUDIO)) | (frontend & s_av_enable) | AV_FAST_SAVESTATES;
+        result = true;
     }
 
-    if (caps & (1 << RETRO_DEVICE_JOYPAD)) {
-        fprintf(stderr," RETRO_DEVICE_JOYPAD");
+    if (TIMING() && cmd == RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO && result) {
+        set_fps(((struct retro_system_av_info const*)data)->timing.fps);
     }
 
-    if (caps & (1 << RETRO_DEVICE_MOUSE)) {
-        fprintf(stderr," RETRO_DEVICE_MOUSE");
+    if (s_record) {
+        session_env(cmd, data, result);
     }
 
-    if (caps & (1 << RETRO_DEVICE_KEYBOARD)) {
-        fprintf(stderr," RETRO_DEVICE_KEYBOARD");
+    if (s_secondary) {
+        secondary_environment(cmd, data, result);
     }
 
-    if (caps & (1 << RETRO_DEVICE_LIGHTGUN)) {
-        fprintf(stderr," RETRO_DEVICE_LIGHTGUN");
+    /* The core's memory is the same whether the frontend supports memory maps or not */
+    if (s_dirty && cmd == RETRO_ENVIRONMENT_SET_MEMORY_MAPS) {
+        dirty_add_memory_map((struct retro_memory_map const*)data);
     }
 
-    if (caps & (1 << RETRO_DEVICE_ANALOG)) {
-        fprintf(stderr," RETRO_DEVICE_ANALOG");
+    if (s_compare) {
+        compare_environment(cmd, data, result);
     }
 
-    if (caps & (1 << RETRO_DEVICE_POINTER)) {
-        fprintf(stderr," RETRO_DEVICE_POINTER");
+    if (s_determinism) {
+        determinism_environment(cmd, data, result);
     }
 
-    fprintf(stderr, "\n");
-}
+    /* New timings and changed core options can both come with a different state */
+    if (s_cache_size && (cmd == RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO || (cmd == RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE && result && *(bool const*)data))) {
+        s_cached_size = 0;
+    }
 
-static bool environment(unsigned cmd, void* data) {
-    bool const result = s_env(cmd, data);
+    if (!LOGGING(LOG_ENV) || !LOGGING_ENV(cmd)) {
+        return result;
+    }
 
     switch (cmd) {
         case RETRO_ENVIRONMENT_SET_ROTATION:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_ROTATION(%u) = %d\n", *(unsigned const*)data, result);
+        case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
+            trace_env(cmd, data, *(unsigned const*)data, result);
             break;
 
         case RETRO_ENVIRONMENT_GET_OVERSCAN:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_OVERSCAN() = %d, %d\n", *(bool*)data, result);
-            break;
-
         case RETRO_ENVIRONMENT_GET_CAN_DUPE:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_CAN_DUPE() = %d, %d\n", *(bool*)data, result);
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+            trace_env(cmd, data, *(bool const*)data, result);
             break;
 
         case RETRO_ENVIRONMENT_SET_MESSAGE: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_MESSAGE(%p) = %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_message const* const rec = (struct retro_message const*)data;
-            fprintf(stderr, TAG "    ->msg    = \"%s\"\n", rec->msg);
-            fprintf(stderr, TAG "    ->frames = %u\n", rec->frames);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_message const* const rec = (struct retro_message const*)data;
+                trace_field_string("msg   ", TRACE_NO_INDEX, rec->msg);
+                trace_field("frames", TRACE_NO_INDEX, TRACE_KIND_UINT, rec->frames, 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_SHUTDOWN:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SHUTDOWN() = %d\n", result);
-            break;
-
-        case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL(%u) = %d\n", *(unsigned const*)data, result);
+            trace_env(cmd, data, 0, result);
             break;
 
         case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY() = \"%s\", %d\n", *(char const**)data, result);
+        case RETRO_ENVIRONMENT_GET_LIBRETRO_PATH:
+            trace_env_string(cmd, data, *(char const**)data, result);
             break;
 
-        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT: {
-            enum retro_pixel_format const val = *(enum retro_pixel_format const*)data;
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_PIXEL_FORMAT(%s) = %d\n", pixel_format_str(val), result);
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+            trace_env(cmd, data, *(enum retro_pixel_format const*)data, result);
             break;
-        }
 
         case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS(%p) = %d\n", data, result);
-
-#ifndef QUIET
-            struct retro_input_descriptor const* rec = (struct retro_input_descriptor const*)data;
-
-            for (unsigned i = 0; rec->description != NULL; rec++, i++) {
-                fprintf(stderr, TAG "    [%u].port        = %u\n", i, rec->port);
-
-                fprintf(
-                    stderr, TAG "    [%u].device      = %u << RETRO_DEVICE_TYPE_SHIFT | %s\n",
-                    i, rec->device >> RETRO_DEVICE_TYPE_SHIFT, device_str(rec->device)
-                );
-
-                fprintf(stderr, TAG "    [%u].index       = %s\n", i, device_index_str(rec->device, rec->index));
-                fprintf(stderr, TAG "    [%u].id          = %s\n", i, device_id_str(rec->device, rec->id));
-                fprintf(stderr, TAG "    [%u].description = \"%s\"\n", i, rec->description);
+            trace_env(cmd, data, 0, result);
+
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_input_descriptor const* rec = (struct retro_input_descriptor const*)data;
+
+                for (unsigned i = 0; rec->description != NULL; rec++, i++) {
+                    trace_field("port       ", i, TRACE_KIND_UINT, rec->port, 0);
+                    trace_field("device     ", i, TRACE_KIND_DEVICE, rec->device, 0);
+                    trace_field("index      ", i, TRACE_KIND_DEVICE_INDEX, rec->index, rec->device);
+                    trace_field("id         ", i, TRACE_KIND_DEVICE_ID, rec->id, rec->device);
+                    trace_field_string("description", i, rec->description);
+                }
             }
-#endif
 
             break;
         }
 
         case RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK(%p) = %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_keyboard_callback const* const rec = (struct retro_keyboard_callback const*)data;
-            fprintf(stderr, TAG "    ->callback = %p\n", rec->callback);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_keyboard_callback const* const rec = (struct retro_keyboard_callback const*)data;
+                trace_field("callback", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->callback), 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE(%p) = %d\n", data, result);
-
-#ifndef QUIET
-            struct retro_disk_control_callback const* const rec = (struct retro_disk_control_callback*)data;
-            fprintf(stderr, TAG "    ->set_eject_state     = %p\n", rec->set_eject_state);
-            fprintf(stderr, TAG "    ->get_eject_state     = %p\n", rec->get_eject_state);
-            fprintf(stderr, TAG "    ->get_image_index     = %p\n", rec->get_image_index);
-            fprintf(stderr, TAG "    ->set_image_index     = %p\n", rec->set_image_index);
-            fprintf(stderr, TAG "    ->get_num_images      = %p\n", rec->get_num_images);
-            fprintf(stderr, TAG "    ->replace_image_index = %p\n", rec->replace_image_index);
-            fprintf(stderr, TAG "    ->add_image_index     = %p\n", rec->add_image_index);
-#endif
+            trace_env(cmd, data, 0, result);
+
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_disk_control_callback const* const rec = (struct retro_disk_control_callback*)data;
+                trace_field("set_eject_state    ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->set_eject_state), 0);
+                trace_field("get_eject_state    ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->get_eject_state), 0);
+                trace_field("get_image_index    ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->get_image_index), 0);
+                trace_field("set_image_index    ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->set_image_index), 0);
+                trace_field("get_num_images     ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->get_num_images), 0);
+                trace_field("replace_image_index", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->replace_image_index), 0);
+                trace_field("add_image_index    ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->add_image_index), 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_SET_HW_RENDER: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_HW_RENDER(%p) = %d\n", data, result);
-
-#ifndef QUIET
-            struct retro_hw_render_callback const* const rec = (struct retro_hw_render_callback*)data;
-            fprintf(stderr, TAG "    ->context_type            = %s\n", hw_context_type_str(rec->context_type));
-            fprintf(stderr, TAG "    ->context_reset           = %p\n", rec->context_reset);
-            fprintf(stderr, TAG "    ->get_current_framebuffer = %p\n", rec->get_current_framebuffer);
-            fprintf(stderr, TAG "    ->get_proc_address        = %p\n", rec->get_proc_address);
-            fprintf(stderr, TAG "    ->depth                   = %d\n", rec->depth);
-            fprintf(stderr, TAG "    ->stencil                 = %d\n", rec->stencil);
-            fprintf(stderr, TAG "    ->bottom_left_origin      = %d\n", rec->bottom_left_origin);
-            fprintf(stderr, TAG "    ->version_major           = %u\n", rec->version_major);
-            fprintf(stderr, TAG "    ->version_minor           = %u\n", rec->version_minor);
-            fprintf(stderr, TAG "    ->cache_context           = %d\n", rec->cache_context);
-            fprintf(stderr, TAG "    ->context_destroy         = %p\n", rec->context_destroy);
-            fprintf(stderr, TAG "    ->debug_context           = %d\n", rec->debug_context);
-#endif
+            trace_env(cmd, data, 0, result);
+
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_hw_render_callback const* const rec = (struct retro_hw_render_callback*)data;
+                trace_field("context_type           ", TRACE_NO_INDEX, TRACE_KIND_HW_CONTEXT_TYPE, rec->context_type, 0);
+                trace_field("context_reset          ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->context_reset), 0);
+                trace_field("get_current_framebuffer", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->get_current_framebuffer), 0);
+                trace_field("get_proc_address       ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->get_proc_address), 0);
+                trace_field("depth                  ", TRACE_NO_INDEX, TRACE_KIND_BOOL, rec->depth, 0);
+                trace_field("stencil                ", TRACE_NO_INDEX, TRACE_KIND_BOOL, rec->stencil, 0);
+                trace_field("bottom_left_origin     ", TRACE_NO_INDEX, TRACE_KIND_BOOL, rec->bottom_left_origin, 0);
+                trace_field("version_major          ", TRACE_NO_INDEX, TRACE_KIND_UINT, rec->version_major, 0);
+                trace_field("version_minor          ", TRACE_NO_INDEX, TRACE_KIND_UINT, rec->version_minor, 0);
+                trace_field("cache_context          ", TRACE_NO_INDEX, TRACE_KIND_BOOL, rec->cache_context, 0);
+                trace_field("context_destroy        ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->context_destroy), 0);
+                trace_field("debug_context          ", TRACE_NO_INDEX, TRACE_KIND_BOOL, rec->debug_context, 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_GET_VARIABLE: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_VARIABLE() = %p, %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_variable const* const rec = (struct retro_variable*)data;
-            fprintf(stderr, TAG "    ->key   = \"%s\"\n", rec->key);
-            fprintf(stderr, TAG "    ->value = \"%s\"\n", rec->value);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_variable const* const rec = (struct retro_variable*)data;
+                trace_field_string("key  ", TRACE_NO_INDEX, rec->key);
+                trace_field_string("value", TRACE_NO_INDEX, rec->value);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_SET_VARIABLES: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_VARIABLES(%p), %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_variable const* rec = (struct retro_variable const*)data;
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_variable const* rec = (struct retro_variable const*)data;
 
-            for (unsigned i = 0; rec->key != NULL; rec++, i++) {
-                fprintf(stderr, TAG "    [%u].key   = \"%s\"\n", i, rec->key);
-                fprintf(stderr, TAG "    [%u].value = \"%s\"\n", i, rec->value);
+                for (unsigned i = 0; rec->key != NULL; rec++, i++) {
+                    trace_field_string("key  ", i, rec->key);
+                    trace_field_string("value", i, rec->value);
+                }
             }
-#endif
 
             break;
         }
 
-        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE() = %d, %d\n", *(bool*)data, result);
-            break;
-
-        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME(%d) = %d\n", *(bool const*)data, result);
-            break;
-
-        case RETRO_ENVIRONMENT_GET_LIBRETRO_PATH:
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_LIBRETRO_PATH() = \"%s\", %d\n", *(char const**)data, result);
-            break;
-
         case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK(%p) = %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_frame_time_callback const* const rec = (struct retro_frame_time_callback*)data;
-            fprintf(stderr, TAG "    ->callback  = %p\n", rec->callback);
-            fprintf(stderr, TAG "    ->reference = %" PRId64 "\n", rec->reference);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_frame_time_callback const* const rec = (struct retro_frame_time_callback*)data;
+                trace_field("callback ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->callback), 0);
+                trace_field("reference", TRACE_NO_INDEX, TRACE_KIND_INT64, (uint64_t)rec->reference, 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK(%p) = %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_audio_callback const* const rec = (struct retro_audio_callback*)data;
-            fprintf(stderr, TAG "    ->callback  = %p\n", rec->callback);
-            fprintf(stderr, TAG "    ->set_state = %p\n", rec->set_state);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_audio_callback const* const rec = (struct retro_audio_callback*)data;
+                trace_field("callback ", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->callback), 0);
+                trace_field("set_state", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->set_state), 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE() = %p, %d\n", data, result);
+            trace_env(cmd, data, 0, result);
 
-#ifndef QUIET
-            struct retro_rumble_interface const* const rec = (struct retro_rumble_interface*)data;
-            fprintf(stderr, TAG "    ->set_rumble_state = %p\n", rec->set_rumble_state);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                struct retro_rumble_interface const* const rec = (struct retro_rumble_interface*)data;
+                trace_field("set_rumble_state", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(rec->set_rumble_state), 0);
+            }
 
             break;
         }
 
         case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES: {
-            fprintf(stderr, TAG "RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES() = %02" PRIx64 ", %d\n", *(uint64_t*)data, result);
+            trace_env(cmd, data, *(uint64_t*)data, result);
 
-#ifndef QUIET
-            log_device_capabilities(*(uint64_t*)data);
-#endif
+            if (LOGGING(LOG_DETAILS)) {
+                trace_field("", TRACE_NO_INDEX, TRACE_KIND_DEVICE_CAPABILITIES, *(uint64_t*)data, 0);
+            }
 
             break;
         }
@@ -1093,240 +1268,1158 @@ static bool environment(unsigned cmd, void* data) {
                                             * based systems).
                                             */
         default:
-            fprintf(stderr, TAG "Unknown environment call (%u, %p) = %d\n", cmd, data, result);
+            trace_env(cmd, data, 0, result);
             break;
     }
 
     return result;
 }
 
-void retro_init(void) {
-    init();
-
-    s_init();
-    fprintf(stderr, TAG "retro_init()\n");
-}
+/* Time spent in the frontend callbacks during the current retro_run */
+static stats_frame_t s_frame;
 
-void retro_deinit(void) {
-    init();
+static void video_refresh(void const* data, unsigned width, unsigned height, size_t pitch) {
+    if ((s_av_enable & AV_VIDEO) == 0) {
+        return;
+    }
 
-    s_deinit();
-    fprintf(stderr, TAG "retro_deinit()\n");
+    if (s_compare) {
+        compare_video(data, width, height, pitch);
+    }
 
-    dynlib_close(s_handle);
-    s_handle = NULL;
-}
+    if (s_checking != CHECK_NONE) {
+        determinism_video(data, width, height, pitch);
 
-unsigned retro_api_version(void) {
-    init();
+        if (s_checking == CHECK_REPLAY) {
+            return;
+        }
+    }
 
-    unsigned const result = s_api_version();
-    fprintf(stderr, TAG "retro_api_version() = %u\n", result);
+    uint64_t const t0 = CALLBACK_BEGIN();
+    s_video_refresh(data, width, height, pitch);
 
-    return result;
+    if (CALLBACKS_TIMED()) {
+        s_frame.video += trace_now() - t0;
+    }
 }
 
-void retro_get_system_info(struct retro_system_info* info) {
-    init();
+static void audio_sample(int16_t left, int16_t right) {
+    if ((s_av_enable & AV_AUDIO) == 0) {
+        return;
+    }
 
-    s_get_system_info(info);
-    fprintf(stderr, TAG "retro_get_system_info(%p)\n", info);
+    if (s_compare) {
+        int16_t const frame[2] = {left, right};
+        compare_audio(frame, 1);
+    }
 
-#ifndef QUIET
-    fprintf(stderr, TAG "    ->library_name     = \"%s\"\n", info->library_name);
-    fprintf(stderr, TAG "    ->library_version  = \"%s\"\n", info->library_version);
-    fprintf(stderr, TAG "    ->valid_extensions = \"%s\"\n", info->valid_extensions);
-    fprintf(stderr, TAG "    ->need_fullpath    = %d\n", info->need_fullpath);
-    fprintf(stderr, TAG "    ->block_extract    = %d\n", info->block_extract);
-#endif
-}
+    if (s_checking != CHECK_NONE) {
+        int16_t const frame[2] = {left, right};
+        determinism_audio(frame, 1);
 
-void retro_get_system_av_info(struct retro_system_av_info* info) {
-    init();
+        if (s_checking == CHECK_REPLAY) {
+            return;
+        }
+    }
 
-    s_get_system_av_info(info);
-    fprintf(stderr, TAG "retro_get_system_av_info(%p)\n", info);
-
-#ifndef QUIET
-    fprintf(stderr, TAG "    ->geometry.base_width   = %u\n", info->geometry.base_width);
-    fprintf(stderr, TAG "    ->geometry.base_height  = %u\n", info->geometry.base_height);
-    fprintf(stderr, TAG "    ->geometry.max_width    = %u\n", info->geometry.max_width);
-    fprintf(stderr, TAG "    ->geometry.max_height   = %u\n", info->geometry.max_height);
-    fprintf(stderr, TAG "    ->geometry.aspect_ratio = %f\n", info->geometry.aspect_ratio);
-    fprintf(stderr, TAG "    ->timing.fps            = %f\n", info->timing.fps);
-    fprintf(stderr, TAG "    ->timing.sample_rate    = %f\n", info->timing.sample_rate);
-#endif
+    uint64_t const t0 = CALLBACK_BEGIN();
+    s_audio_sample(left, right);
+
+    if (CALLBACKS_TIMED()) {
+        s_frame.audio += trace_now() - t0;
+    }
 }
 
-void retro_set_environment(retro_environment_t cb) {
-    init();
+static size_t audio_sample_batch(int16_t const* data, size_t frames) {
+    if ((s_av_enable & AV_AUDIO) == 0) {
+        return frames;
+    }
 
-    s_env = cb;
-    s_set_environment(environment);
-    fprintf(stderr, TAG "retro_set_environment(%p)\n", cb);
-}
+    if (s_compare) {
+        compare_audio(data, frames);
+    }
 
-void retro_set_video_refresh(retro_video_refresh_t cb) {
-    init();
+    if (s_checking != CHECK_NONE) {
+        determinism_audio(data, frames);
 
-    s_set_video_refresh(cb);
-    fprintf(stderr, TAG "retro_set_video_refresh(%p)\n", cb);
-}
+        if (s_checking == CHECK_REPLAY) {
+            return frames;
+        }
+    }
 
-void retro_set_audio_sample(retro_audio_sample_t cb) {
-    init();
+    uint64_t const t0 = CALLBACK_BEGIN();
+    size_t const result = s_audio_sample_batch(data, frames);
 
-    s_set_audio_sample(cb);
-    fprintf(stderr, TAG "retro_set_audio_sample(%p)\n", cb);
+    if (CALLBACKS_TIMED()) {
+        s_frame.audio += trace_now() - t0;
+    }
+
+    return result;
 }
 
-void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) {
-    init();
+static void input_poll(void) {
+    if (s_checking == CHECK_REPLAY) {
+        return;
+    }
+
+    uint64_t const t0 = CALLBACK_BEGIN();
+    s_input_poll();
 
-    s_set_audio_sample_batch(cb);
-    fprintf(stderr, TAG "retro_set_audio_sample_batch(%p)\n", cb);
+    if (CALLBACKS_TIMED()) {
+        s_frame.input += trace_now() - t0;
+    }
 }
 
-void retro_set_input_poll(retro_input_poll_t cb) {
-    init();
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    if (s_checking == CHECK_REPLAY) {
+        return determinism_replay_input(port, device, index, id);
+    }
 
-    s_set_input_poll(cb);
-    fprintf(stderr, TAG "retro_set_input_poll(%p)\n", cb);
-}
+    uint64_t const t0 = CALLBACK_BEGIN();
+    int16_t const result = s_input_state(port, device, index, id);
 
-void retro_set_input_state(retro_input_state_t cb) {
-    init();
+    if (s_checking == CHECK_FIRST) {
+        determinism_input(port, device, index, id, result);
+    }
 
-    s_set_input_state(cb);
-    fprintf(stderr, TAG "retro_set_input_state(%p)\n", cb);
-}
+    if (CALLBACKS_TIMED()) {
+        s_frame.input += trace_now() - t0;
+    }
 
-void retro_set_controller_port_device(unsigned port, unsigned device) {
-    init();
+    if (s_record) {
+        session_input(port, device, index, id, result);
+    }
+
+    if (s_secondary) {
+        s_input_hash = hash_word(hash_word(s_input_hash, hash_input_key(port, device, index, id)), (uint16_t)result);
+    }
 
-    s_set_controller_port_device(port, device);
-    fprintf(stderr, TAG "retro_set_controller_port_device(%u, %u)\n", port, device);
+    return result;
 }
 
-void retro_reset(void) {
+void retro_init(void) {
     init();
 
-    s_reset();
-    fprintf(stderr, TAG "retro_reset()\n");
-}
+    if (s_record) {
+        session_call(TRACE_RETRO_INIT, 0, 0);
+    }
 
-void retro_run(void) {
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.init();
+    STATS_END(TRACE_RETRO_INIT, t0);
+
+    if (s_secondary) {
+        secondary_init();
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_INIT, 0, 0, 0, 0);
+    }
+}
+
+void retro_deinit(void) {
+    if (s_record) {
+        session_call(TRACE_RETRO_DEINIT, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.deinit();
+    STATS_END(TRACE_RETRO_DEINIT, t0);
+
+    if (s_secondary) {
+        secondary_deinit();
+    }
+
+    if (s_compare) {
+        compare_stop();
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_DEINIT, 0, 0, 0, 0);
+    }
+
+    if (s_stats) {
+        stats_print();
+        stats_stop();
+    }
+
+    if (s_profile != NULL) {
+        profiler_write(s_profile, (void const*)s_core.run);
+        profiler_stop();
+    }
+
+    trace_stop();
+    session_stop();
+
+    if (s_rewind) {
+        rewind_stop();
+    }
+
+    if (s_state_diff) {
+        statediff_stop();
+    }
+
+    if (s_dirty) {
+        dirty_stop();
+    }
+
+    if (s_checkpoint) {
+        checkpoint_stop();
+    }
+
+    if (s_determinism) {
+        determinism_stop();
+    }
+
+    free(s_check_state);
+    s_check_state = NULL;
+    s_check_capacity = 0;
+
+    if (s_cache_size && s_size_calls != 0) {
+        fprintf(
+            stderr,
+            TAG "retro_serialize_size: %llu calls, %llu went to the core and took %.2f us mean, %llu verified, %llu found a different size\n",
+            (unsigned long long)s_size_calls,
+            (unsigned long long)s_size_core_calls,
+            s_size_core_calls != 0 ? (double)s_size_core_ns / (double)s_size_core_calls / 1000.0 : 0.0,
+            (unsigned long long)s_size_verified,
+            (unsigned long long)s_size_changed
+        );
+    }
+
+    /* A core loaded again after retro_deinit starts with a new count and asks for its size */
+    s_cached_size = 0;
+    s_size_calls = s_size_core_calls = s_size_core_ns = 0;
+    s_size_verified = s_size_changed = 0;
+
+    if (s_archive) {
+        if (s_archived != 0) {
+            fprintf(
+                stderr,
+                TAG "Archive: %llu states of %llu KiB added in %llu KiB of new chunks, %.2f us mean per state, %zu states in the pack\n",
+                (unsigned long long)s_archived,
+                (unsigned long long)(s_archived_bytes / 1024),
+                (unsigned long long)((s_pack.chunk_bytes - s_archive_chunk_bytes) / 1024),
+                (double)s_archive_ns / (double)s_archived / 1000.0,
+                s_pack.state_count
+            );
+        }
+
+        pack_close(&s_pack);
+    }
+
+    free(s_state);
+    s_state = NULL;
+    s_state_capacity = 0;
+
+    core_unload(&s_core);
+}
+
+unsigned retro_api_version(void) {
     init();
 
-    s_run();
-    fprintf(stderr, TAG "retro_run()\n");
+    if (s_record) {
+        session_call(TRACE_RETRO_API_VERSION, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    unsigned const result = s_core.api_version();
+    STATS_END(TRACE_RETRO_API_VERSION, t0);
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_API_VERSION, 0, 0, 0, result);
+    }
+
+    return result;
 }
 
-size_t retro_serialize_size(void) {
+void retro_get_system_info(struct retro_system_info* info) {
     init();
 
-    size_t const result = s_serialize_size();
-    fprintf(stderr, TAG "retro_serialize_size() = %zu\n", result);
+    if (s_record) {
+        session_call(TRACE_RETRO_GET_SYSTEM_INFO, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.get_system_info(info);
+    STATS_END(TRACE_RETRO_GET_SYSTEM_INFO, t0);
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_GET_SYSTEM_INFO, TRACE_PTR(info), 0, 0, 0);
+    }
+
+    if (LOGGING_DETAILS(LOG_LIFECYCLE)) {
+        trace_field_string("library_name    ", TRACE_NO_INDEX, info->library_name);
+        trace_field_string("library_version ", TRACE_NO_INDEX, info->library_version);
+        trace_field_string("valid_extensions", TRACE_NO_INDEX, info->valid_extensions);
+        trace_field("need_fullpath   ", TRACE_NO_INDEX, TRACE_KIND_BOOL, info->need_fullpath, 0);
+        trace_field("block_extract   ", TRACE_NO_INDEX, TRACE_KIND_BOOL, info->block_extract, 0);
+    }
+}
+
+void retro_get_system_av_info(struct retro_system_av_info* info) {
+    if (s_record) {
+        session_call(TRACE_RETRO_GET_SYSTEM_AV_INFO, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.get_system_av_info(info);
+    STATS_END(TRACE_RETRO_GET_SYSTEM_AV_INFO, t0);
+
+    if (s_secondary) {
+        secondary_get_system_av_info();
+    }
+
+    if (TIMING()) {
+        set_fps(info->timing.fps);
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_GET_SYSTEM_AV_INFO, TRACE_PTR(info), 0, 0, 0);
+    }
+
+    if (LOGGING_DETAILS(LOG_LIFECYCLE)) {
+        trace_field("geometry.base_width  ", TRACE_NO_INDEX, TRACE_KIND_UINT, info->geometry.base_width, 0);
+        trace_field("geometry.base_height ", TRACE_NO_INDEX, TRACE_KIND_UINT, info->geometry.base_height, 0);
+        trace_field("geometry.max_width   ", TRACE_NO_INDEX, TRACE_KIND_UINT, info->geometry.max_width, 0);
+        trace_field("geometry.max_height  ", TRACE_NO_INDEX, TRACE_KIND_UINT, info->geometry.max_height, 0);
+        trace_field_double("geometry.aspect_ratio", TRACE_NO_INDEX, info->geometry.aspect_ratio);
+        trace_field_double("timing.fps           ", TRACE_NO_INDEX, info->timing.fps);
+        trace_field_double("timing.sample_rate   ", TRACE_NO_INDEX, info->timing.sample_rate);
+    }
+}
+
+void retro_set_environment(retro_environment_t cb) {
+    init();
+
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_ENVIRONMENT, 0, 0);
+    }
+
+    /* Don't get in the way of the environment calls unless they're needed */
+    s_env = cb;
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_environment(LOGGING(LOG_ENV) || TIMING() || s_record || s_run_ahead != 0 || s_rewind || s_dirty || s_cache_size || s_determinism ? environment : cb);
+    STATS_END(TRACE_RETRO_SET_ENVIRONMENT, t0);
+
+    if (s_secondary) {
+        secondary_set_environment(cb);
+    }
+
+    if (LOGGING(LOG_CALLBACKS)) {
+        trace_call(TRACE_RETRO_SET_ENVIRONMENT, TRACE_PTR(cb), 0, 0, 0);
+    }
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_VIDEO_REFRESH, 0, 0);
+    }
+
+    s_video_refresh = cb;
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_video_refresh(s_stats || s_compare || s_run_ahead != 0 || s_rewind || s_determinism ? video_refresh : cb);
+    STATS_END(TRACE_RETRO_SET_VIDEO_REFRESH, t0);
+
+    if (LOGGING(LOG_CALLBACKS)) {
+        trace_call(TRACE_RETRO_SET_VIDEO_REFRESH, TRACE_PTR(cb), 0, 0, 0);
+    }
+}
+
+void retro_set_audio_sample(retro_audio_sample_t cb) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_AUDIO_SAMPLE, 0, 0);
+    }
+
+    s_audio_sample = cb;
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_audio_sample(s_stats || s_compare || s_run_ahead != 0 || s_rewind || s_determinism ? audio_sample : cb);
+    STATS_END(TRACE_RETRO_SET_AUDIO_SAMPLE, t0);
+
+    if (LOGGING(LOG_CALLBACKS)) {
+        trace_call(TRACE_RETRO_SET_AUDIO_SAMPLE, TRACE_PTR(cb), 0, 0, 0);
+    }
+}
+
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH, 0, 0);
+    }
+
+    s_audio_sample_batch = cb;
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_audio_sample_batch(s_stats || s_compare || s_run_ahead != 0 || s_rewind || s_determinism ? audio_sample_batch : cb);
+    STATS_END(TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH, t0);
+
+    if (LOGGING(LOG_CALLBACKS)) {
+        trace_call(TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH, TRACE_PTR(cb), 0, 0, 0);
+    }
+}
+
+void retro_set_input_poll(retro_input_poll_t cb) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_INPUT_POLL, 0, 0);
+    }
+
+    s_input_poll = cb;
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_input_poll(s_stats || s_compare || s_determinism ? input_poll : cb);
+    STATS_END(TRACE_RETRO_SET_INPUT_POLL, t0);
+
+    if (LOGGING(LOG_CALLBACKS)) {
+        trace_call(TRACE_RETRO_SET_INPUT_POLL, TRACE_PTR(cb), 0, 0, 0);
+    }
+}
+
+void retro_set_input_state(retro_input_state_t cb) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_INPUT_STATE, 0, 0);
+    }
+
+    s_input_state = cb;
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_input_state(s_stats || s_record || s_secondary || s_determinism ? input_state : cb);
+    STATS_END(TRACE_RETRO_SET_INPUT_STATE, t0);
+
+    if (s_secondary) {
+        secondary_set_input_state(cb);
+    }
+
+    if (LOGGING(LOG_CALLBACKS)) {
+        trace_call(TRACE_RETRO_SET_INPUT_STATE, TRACE_PTR(cb), 0, 0, 0);
+    }
+}
+
+void retro_set_controller_port_device(unsigned port, unsigned device) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE, port, device);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.set_controller_port_device(port, device);
+    STATS_END(TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE, t0);
+
+    if (s_secondary) {
+        secondary_set_controller_port_device(port, device);
+        s_synced = false;
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE, port, device, 0, 0);
+    }
+}
+
+void retro_reset(void) {
+    if (s_record) {
+        session_call(TRACE_RETRO_RESET, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.reset();
+    STATS_END(TRACE_RETRO_RESET, t0);
+
+    if (s_cache_size) {
+        s_cached_size = 0;
+    }
+
+    if (s_secondary) {
+        secondary_reset();
+        s_synced = false;
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_RESET, 0, 0, 0, 0);
+    }
+}
+
+static void disable_run_ahead(char const* const reason) {
+    fprintf(stderr, TAG "%s, run-ahead disabled\n", reason);
+
+#ifndef PASSTHROUGH
+    s_run_ahead = 0;
+#endif
+}
+
+/* All calls to retro_serialize_size go through here, the frontend's and the proxy's own */
+static size_t serialize_size(void) {
+    if (!s_cache_size) {
+        return s_core.serialize_size();
+    }
+
+    s_size_calls++;
+    bool const verify = s_cached_size != 0 && s_verify_size != 0 && s_size_calls % s_verify_size == 0;
+
+    if (s_cached_size != 0 && !verify) {
+        return s_cached_size;
+    }
+
+    uint64_t const t0 = trace_now();
+    size_t const size = s_core.serialize_size();
+    s_size_core_ns += trace_now() - t0;
+    s_size_core_calls++;
+
+    if (verify) {
+        s_size_verified++;
+
+        if (size != s_cached_size && s_size_changed++ == 0) {
+            fprintf(stderr, TAG "retro_serialize_size went from %zu to %zu on its own, this core shouldn't use cache_serialize_size\n", s_cached_size, size);
+        }
+    }
+
+    s_cached_size = size;
+    return size;
+}
+
+static bool reserve_state(size_t const size) {
+    if (size > s_state_capacity) {
+        void* const state = realloc(s_state, size);
+
+        if (state == NULL) {
+            return false;
+        }
+
+        s_state = state;
+        s_state_capacity = size;
+    }
+
+    return true;
+}
+
+/* Saves the state of the core to s_state, returns its size, or 0 if it couldn't be saved */
+static size_t save_state(void) {
+    size_t const size = serialize_size();
+    return size != 0 && reserve_state(size) && s_core.serialize(s_state, size) ? size : 0;
+}
+
+/*
+Runs the frame that advances the emulation with only its audio going to the
+frontend, saves the state, runs the frames ahead with the same input and
+only the video of the last one going to the frontend, and loads the state
+back. The frontend sees the frame the core would show s_run_ahead frames
+later, so the input shows up that much earlier.
+*/
+static void run_ahead(void) {
+    s_av_enable = AV_AUDIO;
+    s_core.run();
+
+    uint64_t const t0 = STATS_BEGIN();
+    stats_frame_t const frame = s_frame;
+    size_t const size = save_state();
+
+    if (size == 0) {
+        s_av_enable = AV_VIDEO | AV_AUDIO;
+        disable_run_ahead("Couldn't save the state");
+        return;
+    }
+
+    s_av_enable = 0;
+
+    for (unsigned i = 1; i < s_run_ahead; i++) {
+        s_core.run();
+    }
+
+    s_av_enable = AV_VIDEO;
+    s_core.run();
+    s_av_enable = AV_VIDEO | AV_AUDIO;
+
+    if (!s_core.unserialize(s_state, size)) {
+        disable_run_ahead("Couldn't load the state");
+    }
+
+    /* The callbacks made by the frames ahead are part of the run-ahead time */
+    if (s_stats) {
+        uint64_t const run_ahead = trace_now() - t0;
+        s_frame = frame;
+        s_frame.run_ahead = run_ahead;
+    }
+}
+
+/*
+Runs ahead with the second copy of the core instead of saving and loading
+the state of the first one every frame. The first copy runs the frame that
+advances the emulation, and only its audio goes to the frontend. The second
+copy is s_run_ahead frames ahead of it, assuming the input doesn't change, so
+while it doesn't it only has to run one frame to show its video. When the
+input changes, the state of the first copy is loaded into the second, which
+runs all the frames ahead again.
+*/
+static void run_ahead_secondary(void) {
+    s_av_enable = AV_AUDIO;
+    s_input_hash = HASH_SEED;
+    s_core.run();
+
+    uint64_t const t0 = STATS_BEGIN();
+    stats_frame_t const frame = s_frame;
+    unsigned frames = 1;
+
+    if (!s_synced || s_input_hash != s_previous_input_hash) {
+        size_t const size = save_state();
+
+        if (size == 0 || !secondary_unserialize(s_state, size)) {
+            s_av_enable = AV_VIDEO | AV_AUDIO;
+            disable_run_ahead("Couldn't copy the state to the second copy of the core");
+            return;
+        }
+
+        frames = s_run_ahead;
+        s_synced = true;
+    }
+
+    s_previous_input_hash = s_input_hash;
+    s_av_enable = 0;
+    secondary_set_av_enable(AV_FAST_SAVESTATES | AV_HARD_DISABLE_AUDIO);
+
+    for (unsigned i = 1; i < frames; i++) {
+        secondary_run();
+    }
+
+    s_av_enable = AV_VIDEO;
+    secondary_set_av_enable(AV_VIDEO | AV_FAST_SAVESTATES | AV_HARD_DISABLE_AUDIO);
+    secondary_run();
+    s_av_enable = AV_VIDEO | AV_AUDIO;
+
+    if (s_stats) {
+        uint64_t const run_ahead = trace_now() - t0;
+        s_frame = frame;
+        s_frame.run_ahead = run_ahead;
+    }
+}
+
+/* Polls the frontend to see if the rewind button is held, the core polls it again when it runs */
+static bool rewinding(void) {
+    s_input_poll();
+    return s_input_state(0, RETRO_DEVICE_JOYPAD, 0, s_rewind_button) != 0;
+}
+
+/* Goes back to the previous state, and runs a frame from it without audio to show its video */
+static void rewind_step(void) {
+    size_t size;
+    void const* const state = rewind_pop(&size);
+
+    if (state != NULL && !s_core.unserialize(state, size)) {
+        fprintf(stderr, TAG "Couldn't load the state to rewind\n");
+    }
+
+    s_synced = false;
+    s_rewind_frames = 0;
+
+    s_av_enable = AV_VIDEO;
+    s_core.run();
+    s_av_enable = AV_VIDEO | AV_AUDIO;
+}
+
+static void rewind_capture(void) {
+    if (++s_rewind_frames < s_rewind_interval) {
+        return;
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    size_t const size = save_state();
+    s_rewind_frames = 0;
+
+    if (size != 0) {
+        rewind_push(s_state, size);
+    }
+
+    if (s_stats) {
+        s_frame.rewind += trace_now() - t0;
+    }
+}
+
+/*
+Runs the frame for the frontend, saving the state before and after it, then
+runs it again from the state before with the same input and without reaching
+the frontend, and goes back to the state after the first run.
+*/
+static void check_determinism(void) {
+    size_t const before = save_state();
+
+    if (before == 0) {
+        determinism_skip();
+        s_core.run();
+        return;
+    }
+
+    s_checking = CHECK_FIRST;
+    determinism_begin(false);
+    s_core.run();
+    s_checking = CHECK_NONE;
+
+    size_t const after = serialize_size();
+
+    if (after > s_check_capacity) {
+        void* const state = realloc(s_check_state, after);
+
+        if (state == NULL) {
+            determinism_skip();
+            return;
+        }
+
+        s_check_state = state;
+        s_check_capacity = after;
+    }
+
+    if (after == 0 || !s_core.serialize(s_check_state, after)) {
+        determinism_skip();
+        return;
+    }
+
+    if (!s_core.unserialize(s_state, before)) {
+        determinism_skip();
+        s_core.unserialize(s_check_state, after);
+        return;
+    }
+
+    determinism_end(s_check_state, after);
+
+    s_checking = CHECK_REPLAY;
+    determinism_begin(true);
+    s_core.run();
+    s_checking = CHECK_NONE;
+
+    size_t const replayed = serialize_size();
+    bool const saved = replayed != 0 && reserve_state(replayed) && s_core.serialize(s_state, replayed);
+    determinism_end(saved ? s_state : NULL, replayed);
+
+    if (!s_core.unserialize(s_check_state, after)) {
+        fprintf(stderr, TAG "Couldn't go back to the state after the checked frame\n");
+    }
+}
+
+/* Saves the state into a buffer of the checkpoint writer, the disk is left to its thread */
+static void take_checkpoint(void) {
+    uint64_t const t0 = trace_now();
+    size_t const size = serialize_size();
+    void* const state = checkpoint_buffer(size);
+
+    if (size != 0 && state != NULL && s_core.serialize(state, size)) {
+        uint64_t const ns = trace_now() - t0;
+        checkpoint_submit(size, ns);
+
+        if (s_stats) {
+            s_frame.checkpoint += ns;
+        }
+    }
+}
+
+static void diff_state(void) {
+    size_t const size = serialize_size();
+    void* const state = statediff_buffer(size);
+
+    if (size != 0 && state != NULL && s_core.serialize(state, size)) {
+        statediff_add(size);
+    }
+}
+
+void retro_run(void) {
+    if (s_record) {
+        session_call(TRACE_RETRO_RUN, 0, 0);
+    }
+
+    if (s_dirty) {
+        dirty_frame_begin();
+    }
+
+    perf_sample_t before, after;
+    bool const counting = s_perf && perf_read(&before);
+
+    if (s_profile != NULL) {
+        profiler_enter();
+    }
+
+    uint64_t const t0 = TIMING() ? trace_now() : 0;
+
+    if (s_rewind && rewinding()) {
+        rewind_step();
+    }
+    else {
+        if (s_run_ahead != 0 && s_secondary) {
+            run_ahead_secondary();
+        }
+        else if (s_run_ahead != 0) {
+            run_ahead();
+        }
+        else if (s_determinism && determinism_due()) {
+            check_determinism();
+        }
+        else {
+            s_core.run();
+        }
+
+        if (s_rewind) {
+            rewind_capture();
+        }
+
+        if (s_checkpoint && checkpoint_due()) {
+            take_checkpoint();
+        }
+    }
+
+    uint64_t const total = TIMING() ? trace_now() - t0 : 0;
+
+    if (s_profile != NULL) {
+        profiler_leave();
+    }
+
+    if (counting && perf_read(&after)) {
+        stats_counters(&before, &after);
+    }
+
+    if (s_stats) {
+        s_frame.total = total;
+        stats_add(TRACE_RETRO_RUN, total);
+        stats_frame(&s_frame);
+        stats_poll();
+    }
+
+    if (LOGGING(LOG_RUN)) {
+        trace_run(total, s_slow_frames != 0 && s_slow_limit != 0 && total > s_slow_limit);
+    }
+
+    if (s_compare) {
+        /* B's callbacks only hash, so A's time in the frontend's callbacks is taken out too */
+        uint64_t const callbacks = s_frame.video + s_frame.audio + s_frame.input;
+        compare_run(total > callbacks ? total - callbacks : 0);
+    }
+
+    if (CALLBACKS_TIMED()) {
+        memset(&s_frame, 0, sizeof(s_frame));
+    }
+
+    /* After the frame was timed, the reports have their own numbers */
+    if (s_dirty) {
+        dirty_frame_end();
+    }
+
+    if (s_state_diff) {
+        diff_state();
+    }
+}
+
+/* Adds the states saved by the frontend to the archive, the chunks they share with the states already in it are stored only once */
+static void archive_state(void const* const data, size_t const size) {
+    uint64_t const t0 = trace_now();
+    size_t index;
+
+    if (!pack_add(&s_pack, data, size, &index)) {
+        fprintf(stderr, TAG "Couldn't add the state to the archive\n");
+        return;
+    }
+
+    s_archived++;
+    s_archived_bytes += size;
+    s_archive_ns += trace_now() - t0;
+}
+
+size_t retro_serialize_size(void) {
+    if (s_record) {
+        session_call(TRACE_RETRO_SERIALIZE_SIZE, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    size_t const result = serialize_size();
+    STATS_END(TRACE_RETRO_SERIALIZE_SIZE, t0);
+
+    if (LOGGING(LOG_SERIALIZE)) {
+        trace_call(TRACE_RETRO_SERIALIZE_SIZE, 0, 0, 0, result);
+    }
 
     return result;
 }
 
 bool retro_serialize(void* data, size_t size) {
-    init();
+    if (s_record) {
+        session_call(TRACE_RETRO_SERIALIZE, size, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    bool const result = s_core.serialize(data, size);
+    STATS_END(TRACE_RETRO_SERIALIZE, t0);
 
-    bool const result = s_serialize(data, size);
-    fprintf(stderr, TAG "retro_serialize(%p, %zu) = %d\n", data, size, result);
+    if (s_archive && result) {
+        archive_state(data, size);
+    }
+
+    if (LOGGING(LOG_SERIALIZE)) {
+        trace_call(TRACE_RETRO_SERIALIZE, TRACE_PTR(data), size, 0, result);
+    }
 
     return result;
 }
 
 bool retro_unserialize(void const* data, size_t size) {
-    init();
+    if (s_record) {
+        session_unserialize(data, size);
+    }
 
-    bool const result = s_unserialize(data, size);
-    fprintf(stderr, TAG "retro_unserialize(%p, %zu) = %d\n", data, size, result);
+    uint64_t const t0 = STATS_BEGIN();
+    bool const result = s_core.unserialize(data, size);
+    STATS_END(TRACE_RETRO_UNSERIALIZE, t0);
+
+    /* The proxy's own loads for run-ahead and rewind are of states it just saved, and keep the size */
+    if (s_cache_size) {
+        s_cached_size = 0;
+    }
+
+    if (s_compare) {
+        compare_unserialize(data, size);
+    }
+
+    s_synced = false;
+
+    if (LOGGING(LOG_SERIALIZE)) {
+        trace_call(TRACE_RETRO_UNSERIALIZE, TRACE_PTR(data), size, 0, result);
+    }
 
     return result;
 }
 
 void retro_cheat_reset(void) {
-    init();
+    if (s_record) {
+        session_call(TRACE_RETRO_CHEAT_RESET, 0, 0);
+    }
 
-    s_cheat_reset();
-    fprintf(stderr, TAG "retro_cheat_reset()\n");
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.cheat_reset();
+    STATS_END(TRACE_RETRO_CHEAT_RESET, t0);
+
+    if (s_secondary) {
+        secondary_cheat_reset();
+        s_synced = false;
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_CHEAT_RESET, 0, 0, 0, 0);
+    }
 }
 
 void retro_cheat_set(unsigned index, bool enabled, char const* code) {
-    init();
+    if (s_record) {
+        session_cheat(index, enabled, code);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.cheat_set(index, enabled, code);
+    STATS_END(TRACE_RETRO_CHEAT_SET, t0);
+
+    if (s_secondary) {
+        secondary_cheat_set(index, enabled, code);
+        s_synced = false;
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call_string(TRACE_RETRO_CHEAT_SET, index, enabled, code);
+    }
+}
 
-    s_cheat_set(index, enabled, code);
-    fprintf(stderr, TAG "retro_cheat_set(%u, %d, \"%s\")\n", index, enabled, code);
+/* Starts the content from a state in the archive, as if the frontend had loaded it */
+static void load_archived_state(void) {
+    size_t const index = s_archive_state - 1;
+    size_t size, chunks;
+    uint64_t hash;
+
+    if (!pack_info(&s_pack, index, &size, &hash, &chunks)) {
+        fprintf(stderr, TAG "There's no state %u in the archive\n", s_archive_state);
+        return;
+    }
+
+    if (!reserve_state(size) || !pack_load(&s_pack, index, s_state)) {
+        fprintf(stderr, TAG "Couldn't load state %u from the archive\n", s_archive_state);
+        return;
+    }
+
+    if (s_record) {
+        session_unserialize(s_state, size);
+    }
+
+    if (!s_core.unserialize(s_state, size)) {
+        fprintf(stderr, TAG "The core couldn't load state %u from the archive\n", s_archive_state);
+    }
+
+    if (s_cache_size) {
+        s_cached_size = 0;
+    }
+
+    if (s_compare) {
+        compare_unserialize(s_state, size);
+    }
+
+    s_synced = false;
+}
+
+/* The memory maps were set in retro_init, retro_set_environment or while loading the content, the memory given by retro_get_memory_data is added to them */
+static void track_memory(void) {
+    static unsigned const ids[] = {RETRO_MEMORY_SAVE_RAM, RETRO_MEMORY_RTC, RETRO_MEMORY_SYSTEM_RAM, RETRO_MEMORY_VIDEO_RAM};
+
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+        dirty_add_memory(s_core.get_memory_data(ids[i]), s_core.get_memory_size(ids[i]));
+    }
+
+    dirty_track(serialize_size());
 }
 
 bool retro_load_game(struct retro_game_info const* game) {
-    init();
+    if (s_record) {
+        session_load_game(TRACE_RETRO_LOAD_GAME, 0, game, 1);
+    }
 
-    bool const result = s_load_game(game);
-    fprintf(stderr, TAG "retro_load_game(%p) = %d\n", game, result);
+    uint64_t const t0 = STATS_BEGIN();
+    bool const result = s_core.load_game(game);
+    STATS_END(TRACE_RETRO_LOAD_GAME, t0);
 
-#ifndef QUIET
-    fprintf(stderr, TAG "    ->path = \"%s\"\n", game->path);
-    fprintf(stderr, TAG "    ->data = %p\n", game->data);
-    fprintf(stderr, TAG "    ->size = %zu\n", game->size);
-    fprintf(stderr, TAG "    ->meta = \"%s\"\n", game->meta);
-#endif
+    if (s_cache_size) {
+        s_cached_size = 0;
+    }
+
+    if (s_checkpoint && result) {
+        checkpoint_reserve(serialize_size());
+    }
+
+    if (s_dirty && result) {
+        track_memory();
+    }
+
+    if (s_secondary) {
+        secondary_load_game(game);
+        s_synced = false;
+    }
+
+    if (s_archive && s_archive_state != 0 && result) {
+        load_archived_state();
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_LOAD_GAME, TRACE_PTR(game), 0, 0, result);
+    }
+
+    /* game is NULL when cores that support no content are started without it */
+    if (LOGGING_DETAILS(LOG_LIFECYCLE) && game != NULL) {
+        trace_field_string("path", TRACE_NO_INDEX, game->path);
+        trace_field("data", TRACE_NO_INDEX, TRACE_KIND_PTR, TRACE_PTR(game->data), 0);
+        trace_field("size", TRACE_NO_INDEX, TRACE_KIND_SIZE, game->size, 0);
+        trace_field_string("meta", TRACE_NO_INDEX, game->meta);
+    }
 
     return result;
 }
 
 bool retro_load_game_special(unsigned game_type, struct retro_game_info const* info, size_t num_info) {
-    init();
+    if (s_record) {
+        session_load_game(TRACE_RETRO_LOAD_GAME_SPECIAL, game_type, info, num_info);
+    }
 
-    bool const result = s_load_game_special(game_type, info, num_info);
-    fprintf(stderr, TAG "retro_load_game_special(%u, %p, %zu) = %d\n", game_type, info, num_info, result);
+    uint64_t const t0 = STATS_BEGIN();
+    bool const result = s_core.load_game_special(game_type, info, num_info);
+    STATS_END(TRACE_RETRO_LOAD_GAME_SPECIAL, t0);
 
-#ifndef QUIET
-    for (size_t i = 0; i < num_info; i++) {
-        fprintf(stderr, TAG "    [%zu].path = \"%s\"\n", i, info[i].path);
-        fprintf(stderr, TAG "    [%zu].data = %p\n", i, info[i].data);
-        fprintf(stderr, TAG "    [%zu].size = %zu\n", i, info[i].size);
-        fprintf(stderr, TAG "    [%zu].meta = \"%s\"\n", i, info[i].meta);
+    if (s_cache_size) {
+        s_cached_size = 0;
+    }
+
+    if (s_checkpoint && result) {
+        checkpoint_reserve(serialize_size());
+    }
+
+    if (s_dirty && result) {
+        track_memory();
+    }
+
+    if (s_secondary) {
+        secondary_load_game_special(game_type, info, num_info);
+        s_synced = false;
+    }
+
+    if (s_archive && s_archive_state != 0 && result) {
+        load_archived_state();
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_LOAD_GAME_SPECIAL, game_type, TRACE_PTR(info), num_info, result);
+    }
+
+    if (LOGGING_DETAILS(LOG_LIFECYCLE)) {
+        for (size_t i = 0; i < num_info; i++) {
+            trace_field_string("path", i, info[i].path);
+            trace_field("data", i, TRACE_KIND_PTR, TRACE_PTR(info[i].data), 0);
+            trace_field("size", i, TRACE_KIND_SIZE, info[i].size, 0);
+            trace_field_string("meta", i, info[i].meta);
+        }
     }
-#endif
 
     return result;
 }
 
 void retro_unload_game(void) {
-    init();
+    if (s_record) {
+        session_call(TRACE_RETRO_UNLOAD_GAME, 0, 0);
+    }
+
+    /* The memory may be gone after the content is unloaded */
+    if (s_dirty) {
+        dirty_reset();
+    }
 
-    s_unload_game();
-    fprintf(stderr, TAG "retro_unload_game()\n");
+    uint64_t const t0 = STATS_BEGIN();
+    s_core.unload_game();
+    STATS_END(TRACE_RETRO_UNLOAD_GAME, t0);
+
+    if (s_cache_size) {
+        s_cached_size = 0;
+    }
+
+    if (s_secondary) {
+        secondary_unload_game();
+    }
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_UNLOAD_GAME, 0, 0, 0, 0);
+    }
 }
 
 unsigned retro_get_region(void) {
-    init();
+    if (s_record) {
+        session_call(TRACE_RETRO_GET_REGION, 0, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    unsigned const result = s_core.get_region();
+    STATS_END(TRACE_RETRO_GET_REGION, t0);
 
-    unsigned const result = s_getRegion();
-    fprintf(stderr, TAG "retro_get_region() = %u\n", result);
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_GET_REGION, 0, 0, 0, result);
+    }
 
     return result;
 }
 
 void* retro_get_memory_data(unsigned id) {
-    init();
+    if (s_record) {
+        session_call(TRACE_RETRO_GET_MEMORY_DATA, id, 0);
+    }
 
-    void* const result = s_get_memory_data(id);
-    fprintf(stderr, TAG "retro_get_memory_data(%u) = %p\n", id, result);
+    uint64_t const t0 = STATS_BEGIN();
+    void* const result = s_core.get_memory_data(id);
+    STATS_END(TRACE_RETRO_GET_MEMORY_DATA, t0);
+
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_GET_MEMORY_DATA, id, 0, 0, TRACE_PTR(result));
+    }
 
     return result;
 }
 
 size_t retro_get_memory_size(unsigned id) {
-    init();
+    if (s_record) {
+        session_call(TRACE_RETRO_GET_MEMORY_SIZE, id, 0);
+    }
+
+    uint64_t const t0 = STATS_BEGIN();
+    size_t const result = s_core.get_memory_size(id);
+    STATS_END(TRACE_RETRO_GET_MEMORY_SIZE, t0);
 
-    size_t const result = s_get_memory_size(id);
-    fprintf(stderr, TAG "retro_get_memory_size(%u) = %zu\n", id, result);
+    if (LOGGING(LOG_LIFECYCLE)) {
+        trace_call(TRACE_RETRO_GET_MEMORY_SIZE, id, 0, 0, result);
+    }
 
     return result;
 }
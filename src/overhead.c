@@ -0,0 +1,365 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+lrproxy-overhead: measures the cost the proxy adds to each entry point, by
+calling them directly in a core and through the proxy with different
+logging settings. Use it with the stub core, which does nothing, so the
+overhead isn't lost in the noise.
+*/
+
+#include "libretro.h"
+#include "core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 1000000UL
+
+/* Proxy settings of each column, the passthrough build is an extra column */
+typedef struct {
+    char const* name;
+    char const* log;
+    char const* stats;
+}
+mode_t_;
+
+static mode_t_ const s_modes[] = {
+    {"none", "none", "0"},
+    {"lifecycle", "lifecycle", "0"},
+    {"run", "run", "0"},
+    {"serialize", "serialize", "0"},
+    {"all", "all", "0"},
+    {"stats", "none", "1"}
+};
+
+#define MODE_COUNT (sizeof(s_modes) / sizeof(s_modes[0]))
+
+typedef enum {
+    ENTRY_API_VERSION,
+    ENTRY_GET_REGION,
+    ENTRY_GET_MEMORY_DATA,
+    ENTRY_GET_MEMORY_SIZE,
+    ENTRY_SET_CONTROLLER_PORT_DEVICE,
+    ENTRY_CHEAT_RESET,
+    ENTRY_RESET,
+    ENTRY_RUN,
+    ENTRY_SERIALIZE_SIZE,
+    ENTRY_SERIALIZE,
+    ENTRY_UNSERIALIZE,
+
+    ENTRY_COUNT
+}
+entry_t;
+
+static char const* const s_entry_names[ENTRY_COUNT] = {
+    "retro_api_version",
+    "retro_get_region",
+    "retro_get_memory_data",
+    "retro_get_memory_size",
+    "retro_set_controller_port_device",
+    "retro_cheat_reset",
+    "retro_reset",
+    "retro_run",
+    "retro_serialize_size",
+    "retro_serialize",
+    "retro_unserialize"
+};
+
+static volatile uintptr_t s_sink;
+static void* s_state;
+static size_t s_state_size;
+
+static bool environment(unsigned cmd, void* data) {
+    switch (cmd) {
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+            return true;
+
+        default:
+            (void)data;
+            return false;
+    }
+}
+
+static void video_refresh(void const* data, unsigned width, unsigned height, size_t pitch) {
+    (void)data;
+    (void)width;
+    (void)height;
+    (void)pitch;
+}
+
+static void audio_sample(int16_t left, int16_t right) {
+    (void)left;
+    (void)right;
+}
+
+static size_t audio_sample_batch(int16_t const* data, size_t frames) {
+    (void)data;
+    return frames;
+}
+
+static void input_poll(void) {}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    (void)port;
+    (void)device;
+    (void)index;
+    (void)id;
+    return 0;
+}
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool start(core_t* const core) {
+    core->set_environment(environment);
+    core->init();
+
+    core->set_video_refresh(video_refresh);
+    core->set_audio_sample(audio_sample);
+    core->set_audio_sample_batch(audio_sample_batch);
+    core->set_input_poll(input_poll);
+    core->set_input_state(input_state);
+
+    if (!core->load_game(NULL)) {
+        fprintf(stderr, "The core couldn't start without content\n");
+        return false;
+    }
+
+    s_state_size = core->serialize_size();
+    free(s_state);
+    s_state = calloc(s_state_size != 0 ? s_state_size : 1, 1);
+    return s_state != NULL;
+}
+
+static void stop(core_t* const core) {
+    core->unload_game();
+    core->deinit();
+}
+
+/* Returns the average time per call in nanoseconds */
+static double measure(core_t const* const core, entry_t const entry, unsigned long const iterations) {
+    uint64_t const t0 = now();
+
+    switch (entry) {
+        case ENTRY_API_VERSION:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = core->api_version();
+            }
+
+            break;
+
+        case ENTRY_GET_REGION:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = core->get_region();
+            }
+
+            break;
+
+        case ENTRY_GET_MEMORY_DATA:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = (uintptr_t)core->get_memory_data(RETRO_MEMORY_SYSTEM_RAM);
+            }
+
+            break;
+
+        case ENTRY_GET_MEMORY_SIZE:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = core->get_memory_size(RETRO_MEMORY_SYSTEM_RAM);
+            }
+
+            break;
+
+        case ENTRY_SET_CONTROLLER_PORT_DEVICE:
+            for (unsigned long i = 0; i < iterations; i++) {
+                core->set_controller_port_device(0, RETRO_DEVICE_JOYPAD);
+            }
+
+            break;
+
+        case ENTRY_CHEAT_RESET:
+            for (unsigned long i = 0; i < iterations; i++) {
+                core->cheat_reset();
+            }
+
+            break;
+
+        case ENTRY_RESET:
+            for (unsigned long i = 0; i < iterations; i++) {
+                core->reset();
+            }
+
+            break;
+
+        case ENTRY_RUN:
+            for (unsigned long i = 0; i < iterations; i++) {
+                core->run();
+            }
+
+            break;
+
+        case ENTRY_SERIALIZE_SIZE:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = core->serialize_size();
+            }
+
+            break;
+
+        case ENTRY_SERIALIZE:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = core->serialize(s_state, s_state_size);
+            }
+
+            break;
+
+        case ENTRY_UNSERIALIZE:
+            for (unsigned long i = 0; i < iterations; i++) {
+                s_sink = core->unserialize(s_state, s_state_size);
+            }
+
+            break;
+
+        case ENTRY_COUNT:
+            break;
+    }
+
+    return (double)(now() - t0) / (double)iterations;
+}
+
+/* Measures all entry points, warming up caches and branch predictors first */
+static bool measure_all(core_t* const core, unsigned long const iterations, double* const results) {
+    if (!start(core)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < ENTRY_COUNT; i++) {
+        measure(core, (entry_t)i, iterations / 10 + 1);
+        results[i] = measure(core, (entry_t)i, iterations);
+    }
+
+    stop(core);
+    return true;
+}
+
+static bool measure_proxy(char const* const path, unsigned long const iterations, double* const results) {
+    core_t proxy;
+
+    /* The proxy reads its settings when it's loaded */
+    if (!core_load(&proxy, path)) {
+        return false;
+    }
+
+    bool const ok = measure_all(&proxy, iterations, results);
+    core_unload(&proxy);
+    return ok;
+}
+
+static int usage(char const* const name) {
+    fprintf(stderr, "Usage: %s [-n iterations] core proxy [passthrough proxy]\n", name);
+    fprintf(stderr, "The proxy is pointed at the core through LRPROXY_CORE and loaded once per logging setting.\n");
+    fprintf(stderr, "Records go nowhere unless LRPROXY_TRACE is set.\n");
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    int i = 1;
+
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+        iterations = strtoul(argv[i + 1], NULL, 0);
+        i += 2;
+    }
+
+    if (argc - i < 2 || argc - i > 3 || iterations == 0) {
+        return usage(argv[0]);
+    }
+
+    char const* const core_path = argv[i];
+    char const* const proxy_path = argv[i + 1];
+    char const* const passthrough_path = argc - i == 3 ? argv[i + 2] : NULL;
+
+    setenv("LRPROXY_CORE", core_path, 1);
+    setenv("LRPROXY_TRACE", "", 0);
+
+    /* The proxies share this instance of the core, it stays loaded all the time */
+    core_t core;
+
+    if (!core_load(&core, core_path)) {
+        return 1;
+    }
+
+    static double direct[ENTRY_COUNT];
+    static double proxied[MODE_COUNT + 1][ENTRY_COUNT];
+
+    if (!measure_all(&core, iterations, direct)) {
+        return 1;
+    }
+
+    for (unsigned j = 0; j < MODE_COUNT; j++) {
+        setenv("LRPROXY_LOG", s_modes[j].log, 1);
+        setenv("LRPROXY_STATS", s_modes[j].stats, 1);
+
+        if (!measure_proxy(proxy_path, iterations, proxied[j])) {
+            return 1;
+        }
+    }
+
+    if (passthrough_path != NULL && !measure_proxy(passthrough_path, iterations, proxied[MODE_COUNT])) {
+        return 1;
+    }
+
+    printf("Nanoseconds per call for the core and added by the proxy with each log setting\n\n");
+    printf("%-34s %9s", "entry point", "direct");
+
+    for (unsigned j = 0; j < MODE_COUNT; j++) {
+        printf(" %9s", s_modes[j].name);
+    }
+
+    printf(passthrough_path != NULL ? " %11s\n" : "\n", "passthrough");
+
+    for (unsigned e = 0; e < ENTRY_COUNT; e++) {
+        printf("%-34s %9.2f", s_entry_names[e], direct[e]);
+
+        for (unsigned j = 0; j < MODE_COUNT; j++) {
+            printf(" %+9.2f", proxied[j][e] - direct[e]);
+        }
+
+        if (passthrough_path != NULL) {
+            printf(" %+11.2f", proxied[MODE_COUNT][e] - direct[e]);
+        }
+
+        printf("\n");
+    }
+
+    core_unload(&core);
+    free(s_state);
+    return 0;
+}
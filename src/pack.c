@@ -0,0 +1,474 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pack.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Chunks are cut where the top 13 bits of the gear hash are zero, 8 KiB after the minimum on average */
+#define MIN_CHUNK 2048
+#define MAX_CHUNK 65536
+#define CUT_MASK (UINT64_C(0x1fff) << 51)
+
+/* Changing the table moves the cuts, and the chunks of new states won't match the old ones */
+static uint64_t s_gear[256];
+static bool s_gear_ready;
+
+static void init_gear(void) {
+    if (s_gear_ready) {
+        return;
+    }
+
+    /* splitmix64 */
+    uint64_t x = UINT64_C(0x6c7270726f787921);
+
+    for (unsigned i = 0; i < 256; i++) {
+        uint64_t z = (x += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        s_gear[i] = z ^ (z >> 31);
+    }
+
+    s_gear_ready = true;
+}
+
+/* The hash shifts one bit per byte, so its top bits depend on the last 64 bytes */
+static size_t cut(uint8_t const* const data, size_t const size) {
+    if (size <= MIN_CHUNK) {
+        return size;
+    }
+
+    size_t const max = size < MAX_CHUNK ? size : MAX_CHUNK;
+    uint64_t h = 0;
+
+    for (size_t i = MIN_CHUNK; i < max; i++) {
+        h = (h << 1) + s_gear[data[i]];
+
+        if ((h & CUT_MASK) == 0) {
+            return i + 1;
+        }
+    }
+
+    return max;
+}
+
+uint64_t pack_hash(void const* const data, size_t const size) {
+    return hash_data(HASH_SEED, data, size);
+}
+
+/* Returns size bytes of the file at offset, mapping it again if it grew since */
+static uint8_t const* at(pack_t* const pack, uint64_t const offset, size_t const size) {
+    if (offset + size > pack->size) {
+        return NULL;
+    }
+
+    if (offset + size > pack->mapped) {
+        if (pack->map != NULL) {
+            munmap(pack->map, pack->mapped);
+            pack->map = NULL;
+            pack->mapped = 0;
+        }
+
+        void* const map = mmap(NULL, (size_t)pack->size, PROT_READ, MAP_SHARED, pack->fd, 0);
+
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+
+        pack->map = (uint8_t*)map;
+        pack->mapped = (size_t)pack->size;
+    }
+
+    return pack->map + offset;
+}
+
+static bool write_at(int const fd, void const* const data, size_t size, uint64_t offset) {
+    char const* ptr = (char const*)data;
+
+    while (size != 0) {
+        ssize_t const written = pwrite(fd, ptr, size, (off_t)offset);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        ptr += written;
+        size -= (size_t)written;
+        offset += (uint64_t)written;
+    }
+
+    return true;
+}
+
+/* A failed append leaves pack->size where it was, so the next one overwrites what was written */
+static bool append(pack_t* const pack, pack_record_t const* const record, void const* const data, size_t const size) {
+    if (!write_at(pack->fd, record, sizeof(*record), pack->size) || !write_at(pack->fd, data, size, pack->size + sizeof(*record))) {
+        return false;
+    }
+
+    pack->size += sizeof(*record) + size;
+    return true;
+}
+
+static void insert(pack_t* const pack, uint64_t const hash, uint64_t const offset) {
+    size_t const mask = pack->slot_count - 1;
+    size_t i = (size_t)hash & mask;
+
+    while (pack->slots[i].offset != 0) {
+        i = (i + 1) & mask;
+    }
+
+    pack->slots[i].hash = hash;
+    pack->slots[i].offset = offset;
+    pack->chunk_count++;
+}
+
+/* Keeps the table at most half full */
+static bool reserve_slots(pack_t* const pack) {
+    if ((pack->chunk_count + 1) * 2 <= pack->slot_count) {
+        return true;
+    }
+
+    size_t const count = pack->slot_count == 0 ? 1024 : pack->slot_count * 2;
+    pack_slot_t* const slots = (pack_slot_t*)calloc(count, sizeof(*slots));
+
+    if (slots == NULL) {
+        return false;
+    }
+
+    pack_slot_t* const old = pack->slots;
+    size_t const old_count = pack->slot_count;
+
+    pack->slots = slots;
+    pack->slot_count = count;
+    pack->chunk_count = 0;
+
+    for (size_t i = 0; i < old_count; i++) {
+        if (old[i].offset != 0) {
+            insert(pack, old[i].hash, old[i].offset);
+        }
+    }
+
+    free(old);
+    return true;
+}
+
+static bool push_state(pack_t* const pack, uint64_t const offset) {
+    if (pack->state_count == pack->state_capacity) {
+        size_t const capacity = pack->state_capacity == 0 ? 64 : pack->state_capacity * 2;
+        uint64_t* const states = (uint64_t*)realloc(pack->states, capacity * sizeof(*states));
+
+        if (states == NULL) {
+            return false;
+        }
+
+        pack->states = states;
+        pack->state_capacity = capacity;
+    }
+
+    pack->states[pack->state_count++] = offset;
+    return true;
+}
+
+static uint64_t find(pack_t* const pack, uint64_t const hash, uint8_t const* const data, size_t const size) {
+    size_t const mask = pack->slot_count - 1;
+
+    for (size_t i = (size_t)hash & mask; pack->slots[i].offset != 0; i = (i + 1) & mask) {
+        if (pack->slots[i].hash != hash) {
+            continue;
+        }
+
+        uint8_t const* const chunk = at(pack, pack->slots[i].offset, sizeof(pack_record_t) + size);
+        pack_record_t record;
+
+        if (chunk != NULL) {
+            memcpy(&record, chunk, sizeof(record));
+
+            if (record.size == size && memcmp(chunk + sizeof(record), data, size) == 0) {
+                return pack->slots[i].offset;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+Rebuilds the chunk table and the state list, and sets end to where the last
+complete record ends. Returns false when the file couldn't be mapped or the
+tables couldn't grow, so a pack isn't truncated because memory ran out.
+*/
+static bool scan(pack_t* const pack, uint64_t* const end) {
+    uint64_t offset = sizeof(pack_header_t);
+
+    while (offset + sizeof(pack_record_t) <= pack->size) {
+        uint8_t const* const p = at(pack, offset, sizeof(pack_record_t));
+
+        if (p == NULL) {
+            return false;
+        }
+
+        pack_record_t record;
+        memcpy(&record, p, sizeof(record));
+
+        uint64_t const payload = record.type == PACK_CHUNK ? record.size : (uint64_t)record.count * sizeof(uint64_t);
+        uint64_t const next = offset + sizeof(record) + payload;
+
+        if ((record.type != PACK_CHUNK && record.type != PACK_STATE) || next > pack->size) {
+            break;
+        }
+
+        if (record.type == PACK_CHUNK) {
+            if (!reserve_slots(pack)) {
+                return false;
+            }
+
+            insert(pack, record.hash, offset);
+            pack->chunk_bytes += record.size;
+        }
+        else {
+            if (!push_state(pack, offset)) {
+                return false;
+            }
+
+            pack->state_bytes += record.size;
+        }
+
+        offset = next;
+    }
+
+    *end = offset;
+    return true;
+}
+
+bool pack_open(pack_t* const pack, char const* const path, bool const writable) {
+    memset(pack, 0, sizeof(*pack));
+    init_gear();
+
+    pack->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    pack->writable = writable;
+
+    if (pack->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    pack_header_t header;
+
+    if (fstat(pack->fd, &st) != 0) {
+        pack_close(pack);
+        return false;
+    }
+
+    pack->size = (uint64_t)st.st_size;
+
+    if (pack->size == 0 && writable) {
+        memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+        header.version = PACK_VERSION;
+        header.reserved = 0;
+
+        if (!write_at(pack->fd, &header, sizeof(header), 0)) {
+            pack_close(pack);
+            return false;
+        }
+
+        pack->size = sizeof(header);
+    }
+    else if (pack->size < sizeof(header) || pread(pack->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        pack_close(pack);
+        return false;
+    }
+
+    if (memcmp(header.magic, PACK_MAGIC, sizeof(header.magic)) != 0 || header.version != PACK_VERSION || !reserve_slots(pack)) {
+        pack_close(pack);
+        return false;
+    }
+
+    uint64_t end;
+
+    if (!scan(pack, &end)) {
+        pack_close(pack);
+        return false;
+    }
+
+    if (end != pack->size) {
+        /* Drop what a crash left of the last records */
+        if (writable && ftruncate(pack->fd, (off_t)end) != 0) {
+            pack_close(pack);
+            return false;
+        }
+
+        pack->size = end;
+    }
+
+    return true;
+}
+
+void pack_close(pack_t* const pack) {
+    if (pack->map != NULL) {
+        munmap(pack->map, pack->mapped);
+    }
+
+    if (pack->fd >= 0) {
+        close(pack->fd);
+    }
+
+    free(pack->slots);
+    free(pack->states);
+    free(pack->refs);
+    memset(pack, 0, sizeof(*pack));
+    pack->fd = -1;
+}
+
+bool pack_add(pack_t* const pack, void const* const data, size_t const size, size_t* const index) {
+    uint8_t const* const bytes = (uint8_t const*)data;
+
+    /* Enough references for a state made only of the smallest chunks */
+    size_t const max_refs = size / MIN_CHUNK + 1;
+
+    if (!pack->writable || max_refs > UINT32_MAX) {
+        return false;
+    }
+
+    if (max_refs > pack->ref_capacity) {
+        uint64_t* const refs = (uint64_t*)realloc(pack->refs, max_refs * sizeof(*refs));
+
+        if (refs == NULL) {
+            return false;
+        }
+
+        pack->refs = refs;
+        pack->ref_capacity = max_refs;
+    }
+
+    size_t count = 0;
+
+    for (size_t pos = 0; pos < size;) {
+        size_t const length = cut(bytes + pos, size - pos);
+        uint64_t const hash = pack_hash(bytes + pos, length);
+        uint64_t offset = find(pack, hash, bytes + pos, length);
+
+        if (offset == 0) {
+            pack_record_t const record = {PACK_CHUNK, 0, length, hash};
+            offset = pack->size;
+
+            if (!reserve_slots(pack) || !append(pack, &record, bytes + pos, length)) {
+                return false;
+            }
+
+            insert(pack, hash, offset);
+            pack->chunk_bytes += length;
+        }
+
+        pack->refs[count++] = offset;
+        pos += length;
+    }
+
+    pack_record_t const record = {PACK_STATE, (uint32_t)count, size, pack_hash(data, size)};
+    uint64_t const offset = pack->size;
+
+    if (!push_state(pack, offset)) {
+        return false;
+    }
+
+    if (!append(pack, &record, pack->refs, count * sizeof(*pack->refs))) {
+        pack->state_count--;
+        return false;
+    }
+
+    pack->state_bytes += size;
+    *index = pack->state_count - 1;
+    return true;
+}
+
+bool pack_info(pack_t* const pack, size_t const index, size_t* const size, uint64_t* const hash, size_t* const chunks) {
+    if (index >= pack->state_count) {
+        return false;
+    }
+
+    uint8_t const* const p = at(pack, pack->states[index], sizeof(pack_record_t));
+    pack_record_t record;
+
+    if (p == NULL) {
+        return false;
+    }
+
+    memcpy(&record, p, sizeof(record));
+    *size = (size_t)record.size;
+    *hash = record.hash;
+    *chunks = record.count;
+    return true;
+}
+
+bool pack_load(pack_t* const pack, size_t const index, void* const data) {
+    if (index >= pack->state_count) {
+        return false;
+    }
+
+    /* Map the whole file once, so the pointers below stay valid */
+    if (at(pack, 0, (size_t)pack->size) == NULL) {
+        return false;
+    }
+
+    uint8_t const* const state = pack->map + pack->states[index];
+    pack_record_t record;
+    memcpy(&record, state, sizeof(record));
+
+    uint8_t* out = (uint8_t*)data;
+    uint64_t loaded = 0;
+
+    for (uint32_t i = 0; i < record.count; i++) {
+        uint64_t offset;
+        memcpy(&offset, state + sizeof(record) + i * sizeof(offset), sizeof(offset));
+
+        if (offset + sizeof(pack_record_t) > pack->size) {
+            return false;
+        }
+
+        pack_record_t chunk;
+        memcpy(&chunk, pack->map + offset, sizeof(chunk));
+
+        if (chunk.type != PACK_CHUNK || offset + sizeof(chunk) + chunk.size > pack->size || loaded + chunk.size > record.size) {
+            return false;
+        }
+
+        memcpy(out, pack->map + offset + sizeof(chunk), (size_t)chunk.size);
+        out += chunk.size;
+        loaded += chunk.size;
+    }
+
+    return loaded == record.size;
+}
@@ -0,0 +1,105 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+A pack keeps many states of a core, storing the bytes they have in common
+only once. States are cut into chunks where the content says so, with a gear
+hash of the last bytes, so an insertion or removal only changes the chunks
+around it. Chunks are found by their hash, and compared with the bytes
+already in the pack before being reused.
+
+Pack files are this header followed by records, and are only appended to. A
+chunk record is followed by its bytes, with count 0, size the number of
+bytes, and hash their hash. A state record is followed by the offsets in the
+file of the records of its chunks, as count uint64_t, with size the size of
+the state and hash the hash of the whole state. The chunks of a state are
+always written before it, so a file cut at any record is still valid, and
+records cut short by a crash are dropped when the pack is opened again.
+*/
+#define PACK_MAGIC "LRPXPAK1"
+#define PACK_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+}
+pack_header_t;
+
+typedef enum {
+    PACK_CHUNK = 1,
+    PACK_STATE
+}
+pack_record_type_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t count;
+    uint64_t size;
+    uint64_t hash;
+}
+pack_record_t;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset; /* 0 for an empty slot */
+}
+pack_slot_t;
+
+typedef struct {
+    int fd;
+    bool writable;
+    uint64_t size;
+
+    /* The file is mapped to read chunks, and mapped again when it grows past the mapping */
+    uint8_t* map;
+    size_t mapped;
+
+    /* Open addressing hash table of the chunks */
+    pack_slot_t* slots;
+    size_t slot_count;
+    size_t chunk_count;
+
+    /* Offsets of the state records */
+    uint64_t* states;
+    size_t state_count;
+    size_t state_capacity;
+
+    /* Offsets of the chunks of the state being added */
+    uint64_t* refs;
+    size_t ref_capacity;
+
+    uint64_t chunk_bytes; /* of all distinct chunks */
+    uint64_t state_bytes; /* of all states */
+}
+pack_t;
+
+/* Opens the pack, creating it if it doesn't exist and writable is true */
+bool pack_open(pack_t* pack, char const* path, bool writable);
+void pack_close(pack_t* pack);
+
+/* Adds a state to the pack, index is set to its position in the pack, starting at 0 */
+bool pack_add(pack_t* pack, void const* data, size_t size, size_t* index);
+
+/* Size, hash and number of chunks of a state, false if index is out of range */
+bool pack_info(pack_t* pack, size_t index, size_t* size, uint64_t* hash, size_t* chunks);
+
+/* Assembles a state from its chunks into data, which must have room for its size */
+bool pack_load(pack_t* pack, size_t index, void* data);
+
+/* The hash of the chunks and states in the file, hash_data from HASH_SEED */
+uint64_t pack_hash(void const* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACK_H */
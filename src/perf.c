@@ -0,0 +1,147 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "perf.h"
+
+#include <stdio.h>
+
+#define TAG "[LRPROXY] "
+
+static char const* const s_names[PERF_COUNT] = {
+    "cycles",
+    "instructions",
+    "cache-misses",
+    "branch-misses",
+    "page-faults"
+};
+
+char const* perf_counter_name(perf_counter_t const counter) {
+    return s_names[counter];
+}
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* Counters are per thread, so each thread that calls retro_run gets its own group */
+static _Thread_local int t_leader = -1;
+static _Thread_local bool t_failed;
+static _Thread_local unsigned t_available;
+
+static int open_counter(uint32_t const type, uint64_t const config, int const group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static bool open_group(void) {
+    static struct {uint32_t type; uint64_t config;} const events[PERF_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+    };
+
+    t_leader = open_counter(events[PERF_CYCLES].type, events[PERF_CYCLES].config, -1);
+
+    if (t_leader == -1) {
+        fprintf(stderr, TAG "Performance counters not available: %s\n", strerror(errno));
+        return false;
+    }
+
+    t_available = 1U << PERF_CYCLES;
+
+    /* The other counters are optional, not every PMU has all of them */
+    for (unsigned i = PERF_CYCLES + 1; i < PERF_COUNT; i++) {
+        if (open_counter(events[i].type, events[i].config, t_leader) != -1) {
+            t_available |= 1U << i;
+        }
+        else {
+            fprintf(stderr, TAG "Performance counter %s not available: %s\n", s_names[i], strerror(errno));
+        }
+    }
+
+    ioctl(t_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+bool perf_read(perf_sample_t* const sample) {
+    if (t_failed) {
+        return false;
+    }
+
+    if (t_leader == -1 && !open_group()) {
+        t_failed = true;
+        return false;
+    }
+
+    /* With PERF_FORMAT_GROUP the values come in the order the counters were added */
+    uint64_t data[1 + PERF_COUNT];
+
+    if (read(t_leader, data, sizeof(data)) < (ssize_t)sizeof(uint64_t)) {
+        return false;
+    }
+
+    uint64_t const* value = data + 1;
+
+    for (unsigned i = 0; i < PERF_COUNT; i++) {
+        sample->values[i] = (t_available & (1U << i)) != 0 ? *value++ : 0;
+    }
+
+    sample->available = t_available;
+    return true;
+}
+
+#else
+
+bool perf_read(perf_sample_t* const sample) {
+    static bool warned;
+
+    (void)sample;
+
+    if (!warned) {
+        fprintf(stderr, TAG "Performance counters are only available on Linux\n");
+        warned = true;
+    }
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hardware and software counters read around each retro_run */
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_PAGE_FAULTS,
+
+    PERF_COUNT
+}
+perf_counter_t;
+
+typedef struct {
+    uint64_t values[PERF_COUNT];
+    unsigned available; /* one bit per perf_counter_t that could be opened */
+}
+perf_sample_t;
+
+/*
+Reads the counters of the calling thread, opening them the first time. Returns
+false if perf events aren't available, i.e. when not on Linux, when the kernel
+doesn't allow them, or on virtual machines without a PMU. In that case it
+says why once and keeps returning false without trying again.
+*/
+bool perf_read(perf_sample_t* sample);
+
+char const* perf_counter_name(perf_counter_t counter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERF_H */
@@ -0,0 +1,495 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifdef __linux__
+    #define _GNU_SOURCE /* dladdr, SIGEV_THREAD_ID */
+#endif
+
+#include "profiler.h"
+#include "hash.h"
+
+#include <stdio.h>
+
+#define TAG "[LRPROXY] "
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define PROFILER_DEPTH 64
+#define PROFILER_STACKS 16384 /* must be a power of two */
+#define PROFILER_SKIP 2 /* the signal handler and the signal trampoline */
+
+typedef struct {
+    uint64_t hash;
+    unsigned count;
+    unsigned depth;
+    void* frames[PROFILER_DEPTH]; /* leaf first */
+}
+profile_stack_t;
+
+static profile_stack_t* s_stacks;
+static unsigned s_lost;
+static bool s_timer_created;
+static bool s_has_timer;
+static timer_t s_timer;
+static bool s_installed;
+static struct sigaction s_old_action;
+static unsigned s_hz;
+static volatile sig_atomic_t s_sampling;
+static bool s_written;
+
+static uint64_t hash_frames(void* const* const frames, unsigned const depth) {
+    uint64_t hash = HASH_SEED;
+
+    for (unsigned i = 0; i < depth; i++) {
+        hash = hash_word(hash, (uint64_t)(uintptr_t)frames[i]);
+    }
+
+    return hash | 1; /* 0 marks an empty slot */
+}
+
+/* Only async-signal-safe code from here on, backtrace was already called once so libgcc is loaded */
+static void sample(int const signum, siginfo_t* const info, void* const context) {
+    (void)signum;
+    (void)info;
+    (void)context;
+
+    if (!s_sampling) {
+        return;
+    }
+
+    int const saved = errno;
+    void* frames[PROFILER_DEPTH + PROFILER_SKIP];
+    int const count = backtrace(frames, PROFILER_DEPTH + PROFILER_SKIP);
+
+    if (count > PROFILER_SKIP) {
+        unsigned const depth = (unsigned)count - PROFILER_SKIP;
+        void* const* const stack = frames + PROFILER_SKIP;
+        uint64_t const hash = hash_frames(stack, depth);
+
+        for (unsigned i = 0; i < PROFILER_STACKS; i++) {
+            profile_stack_t* const slot = &s_stacks[(hash + i) & (PROFILER_STACKS - 1)];
+
+            if (slot->hash == 0) {
+                slot->hash = hash;
+                slot->depth = depth;
+                memcpy(slot->frames, stack, depth * sizeof(stack[0]));
+                slot->count = 1;
+                goto done;
+            }
+            else if (slot->hash == hash && slot->depth == depth && memcmp(slot->frames, stack, depth * sizeof(stack[0])) == 0) {
+                slot->count++;
+                goto done;
+            }
+        }
+
+        s_lost++;
+    }
+
+done:
+    errno = saved;
+}
+
+bool profiler_start(unsigned const hz) {
+    if (s_stacks != NULL) {
+        return true;
+    }
+
+    s_stacks = (profile_stack_t*)calloc(PROFILER_STACKS, sizeof(*s_stacks));
+
+    if (s_stacks == NULL) {
+        fprintf(stderr, TAG "Out of memory for the profiler\n");
+        return false;
+    }
+
+    /* The first call to backtrace loads libgcc, which can't happen inside the signal handler */
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = sample;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+
+    if (sigaction(SIGPROF, &sa, &s_old_action) != 0) {
+        fprintf(stderr, TAG "Couldn't install the SIGPROF handler: %s\n", strerror(errno));
+        free(s_stacks);
+        s_stacks = NULL;
+        return false;
+    }
+
+    s_installed = true;
+    s_hz = hz != 0 ? hz : 1;
+    return true;
+}
+
+void profiler_stop(void) {
+    s_sampling = 0;
+
+    /* No SIGPROF can arrive after the timer is deleted, so the handler can go */
+    if (s_has_timer) {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        timer_settime(s_timer, 0, &its, NULL);
+        timer_delete(s_timer);
+        s_has_timer = false;
+    }
+
+    if (s_installed) {
+        sigaction(SIGPROF, &s_old_action, NULL);
+        s_installed = false;
+    }
+
+    free(s_stacks);
+    s_stacks = NULL;
+    s_timer_created = false;
+    s_lost = 0;
+}
+
+/* The timer follows the CPU time of the thread running the core and is delivered to it */
+static void create_timer(void) {
+    s_timer_created = true;
+
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+#ifdef sigev_notify_thread_id
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+#else
+    sev._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+#endif
+
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &s_timer) != 0) {
+        fprintf(stderr, TAG "Couldn't create the profiler timer: %s\n", strerror(errno));
+        free(s_stacks);
+        s_stacks = NULL;
+        return;
+    }
+
+    s_has_timer = true;
+    long const interval = 1000000000L / (long)s_hz;
+    struct itimerspec its;
+    its.it_interval.tv_sec = interval / 1000000000L;
+    its.it_interval.tv_nsec = interval % 1000000000L;
+    its.it_value = its.it_interval;
+
+    timer_settime(s_timer, 0, &its, NULL);
+}
+
+void profiler_enter(void) {
+    if (!s_timer_created) {
+        create_timer();
+    }
+
+    s_sampling = s_stacks != NULL;
+}
+
+void profiler_leave(void) {
+    s_sampling = 0;
+}
+
+/* Function symbols of an ELF file, sorted by address */
+typedef struct {
+    uintptr_t address;
+    size_t size;
+    char const* name;
+}
+symbol_t;
+
+typedef struct {
+    void* map;
+    size_t map_size;
+    uintptr_t base;
+    bool relative;
+    symbol_t* symbols;
+    size_t count;
+}
+symtab_t;
+
+static int compare_symbols(void const* const a, void const* const b) {
+    uintptr_t const x = ((symbol_t const*)a)->address;
+    uintptr_t const y = ((symbol_t const*)b)->address;
+    return x < y ? -1 : x > y;
+}
+
+static void symtab_load(symtab_t* const symtab, char const* const path, uintptr_t const base) {
+    memset(symtab, 0, sizeof(*symtab));
+    symtab->base = base;
+
+    int const fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+        close(fd);
+        return;
+    }
+
+    void* const map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    symtab->map = map;
+    symtab->map_size = (size_t)st.st_size;
+
+    ElfW(Ehdr) const* const ehdr = (ElfW(Ehdr) const*)map;
+
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_shoff == 0 ||
+        ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > symtab->map_size) {
+        return;
+    }
+
+    /* Symbols of shared objects are relative to where they're loaded */
+    symtab->relative = ehdr->e_type == ET_DYN;
+
+    ElfW(Shdr) const* const shdrs = (ElfW(Shdr) const*)((char const*)map + ehdr->e_shoff);
+    ElfW(Shdr) const* table = NULL;
+
+    /* Prefer the full symbol table, stripped cores only have the dynamic one */
+    for (unsigned i = 0; i < ehdr->e_shnum; i++) {
+        if (shdrs[i].sh_type == SHT_SYMTAB || (shdrs[i].sh_type == SHT_DYNSYM && table == NULL)) {
+            table = &shdrs[i];
+        }
+    }
+
+    if (table == NULL || table->sh_link >= ehdr->e_shnum) {
+        return;
+    }
+
+    ElfW(Shdr) const* const strings = &shdrs[table->sh_link];
+
+    if (table->sh_offset + table->sh_size > symtab->map_size || strings->sh_offset + strings->sh_size > symtab->map_size) {
+        return;
+    }
+
+    ElfW(Sym) const* const syms = (ElfW(Sym) const*)((char const*)map + table->sh_offset);
+    size_t const count = table->sh_size / sizeof(ElfW(Sym));
+    symtab->symbols = (symbol_t*)malloc(count * sizeof(symbol_t));
+
+    if (symtab->symbols == NULL) {
+        return;
+    }
+
+    /* ELF32_ST_TYPE and ELF64_ST_TYPE are the same */
+    for (size_t i = 0; i < count; i++) {
+        if (ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_value == 0 || syms[i].st_name >= strings->sh_size) {
+            continue;
+        }
+
+        symbol_t* const symbol = &symtab->symbols[symtab->count++];
+        symbol->address = (uintptr_t)syms[i].st_value;
+        symbol->size = (size_t)syms[i].st_size;
+        symbol->name = (char const*)map + strings->sh_offset + syms[i].st_name;
+    }
+
+    qsort(symtab->symbols, symtab->count, sizeof(symbol_t), compare_symbols);
+}
+
+static char const* symtab_find(symtab_t const* const symtab, uintptr_t address) {
+    if (symtab->relative) {
+        address -= symtab->base;
+    }
+
+    size_t low = 0, high = symtab->count;
+
+    /* Last symbol starting at or before the address */
+    while (low < high) {
+        size_t const mid = low + (high - low) / 2;
+
+        if (symtab->symbols[mid].address <= address) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (low == 0) {
+        return NULL;
+    }
+
+    symbol_t const* const symbol = &symtab->symbols[low - 1];
+    return symbol->size == 0 || address < symbol->address + symbol->size ? symbol->name : NULL;
+}
+
+static void symtab_free(symtab_t* const symtab) {
+    free(symtab->symbols);
+
+    if (symtab->map != NULL) {
+        munmap(symtab->map, symtab->map_size);
+    }
+}
+
+static void write_frame(FILE* const file, symtab_t const* const symtab, void* const frame) {
+    Dl_info info;
+
+    if (dladdr(frame, &info) == 0 || info.dli_fname == NULL) {
+        fprintf(file, "%p", frame);
+        return;
+    }
+
+    char const* name = NULL;
+
+    if ((uintptr_t)info.dli_fbase == symtab->base) {
+        name = symtab_find(symtab, (uintptr_t)frame);
+    }
+
+    if (name == NULL) {
+        name = info.dli_sname;
+    }
+
+    if (name != NULL) {
+        fputs(name, file);
+        return;
+    }
+
+    char const* const slash = strrchr(info.dli_fname, '/');
+    fprintf(file, "%s+0x%zx", slash != NULL ? slash + 1 : info.dli_fname, (size_t)((uintptr_t)frame - (uintptr_t)info.dli_fbase));
+}
+
+void profiler_write(char const* const path, void const* const core_symbol) {
+    if (s_stacks == NULL) {
+        return;
+    }
+
+    /* Stop sampling while the table is read */
+    bool const sampling = s_sampling;
+    s_sampling = 0;
+
+    /* Start a new file the first time, append to it when the core is reinitialized */
+    FILE* const file = fopen(path, s_written ? "a" : "w");
+
+    if (file == NULL) {
+        fprintf(stderr, TAG "Couldn't open profile file \"%s\"\n", path);
+        s_sampling = sampling;
+        return;
+    }
+
+    s_written = true;
+
+    Dl_info core, proxy;
+    symtab_t symtab;
+
+    if (dladdr(core_symbol, &core) != 0 && core.dli_fname != NULL) {
+        symtab_load(&symtab, core.dli_fname, (uintptr_t)core.dli_fbase);
+    }
+    else {
+        memset(&symtab, 0, sizeof(symtab));
+    }
+
+    if (dladdr((void*)profiler_write, &proxy) == 0) {
+        proxy.dli_fbase = NULL;
+    }
+
+    unsigned long long samples = 0;
+
+    for (unsigned i = 0; i < PROFILER_STACKS; i++) {
+        profile_stack_t* const stack = &s_stacks[i];
+
+        if (stack->hash == 0) {
+            continue;
+        }
+
+        /* Everything from the proxy's retro_run to the root is the frontend, cut it */
+        unsigned depth = stack->depth;
+
+        for (unsigned j = stack->depth; j > 0; j--) {
+            Dl_info info;
+
+            if (dladdr(stack->frames[j - 1], &info) != 0 && info.dli_fbase == proxy.dli_fbase) {
+                depth = j - 1;
+                break;
+            }
+        }
+
+        fputs("retro_run", file);
+
+        for (unsigned j = depth; j > 0; j--) {
+            /* Return addresses point after the call, step back into it except for the interrupted frame */
+            void* const frame = j == 1 ? stack->frames[0] : (void*)((uintptr_t)stack->frames[j - 1] - 1);
+
+            fputc(';', file);
+            write_frame(file, &symtab, frame);
+        }
+
+        fprintf(file, " %u\n", stack->count);
+        samples += stack->count;
+    }
+
+    fclose(file);
+    symtab_free(&symtab);
+
+    if (s_lost != 0) {
+        fprintf(stderr, TAG "Profiler table full, %u samples lost\n", s_lost);
+    }
+
+    fprintf(stderr, TAG "Wrote %llu samples to \"%s\"\n", samples, path);
+
+    memset(s_stacks, 0, PROFILER_STACKS * sizeof(*s_stacks));
+    s_lost = 0;
+    s_sampling = sampling;
+}
+
+#else
+
+bool profiler_start(unsigned const hz) {
+    (void)hz;
+    fprintf(stderr, TAG "The profiler is only available on Linux\n");
+    return false;
+}
+
+void profiler_stop(void) {}
+void profiler_enter(void) {}
+void profiler_leave(void) {}
+
+void profiler_write(char const* const path, void const* const core_symbol) {
+    (void)path;
+    (void)core_symbol;
+}
+
+#endif
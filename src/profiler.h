@@ -0,0 +1,38 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Sampling profiler for the core. A SIGPROF timer on the CPU time of the thread
+that calls retro_run takes a backtrace hz times per second, and samples are
+only kept while the core is running. Stacks are counted in a table allocated
+up front, so the signal handler never allocates memory.
+*/
+bool profiler_start(unsigned hz);
+
+/* Deletes the timer, puts the previous SIGPROF handler back, and frees the samples */
+void profiler_stop(void);
+
+/* Called around s_run */
+void profiler_enter(void);
+void profiler_leave(void);
+
+/*
+Writes the stacks in the collapsed format used by flamegraph.pl, one line per
+distinct stack with the frames from the root to the leaf separated by
+semicolons, followed by the number of samples. Frames are resolved with
+dladdr and with the symbol table of the core's file, so static functions get
+names too. The samples are cleared afterwards.
+*/
+void profiler_write(char const* path, void const* core_symbol);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILER_H */
@@ -0,0 +1,588 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+lrproxy-replay: a headless frontend that makes the calls of a session
+recorded by the proxy, answering the core's input_state and environment
+calls with what the frontend answered at the time, and reports how fast the
+core ran it. With more than one session, each one gets its own copy of the
+core in a separate namespace, and they're replayed in parallel by a pool of
+worker threads.
+*/
+
+#include "libretro.h"
+#include "core.h"
+#include "session.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* glibc has 16 namespaces and the first one belongs to the executable */
+#define MAX_JOBS 15
+
+/* Everything about the replay of one session, the callbacks find it through s_replay */
+typedef struct {
+    char const* path;
+    core_t core;
+    session_reader_t reader;
+
+    bool failed;
+    uint64_t frame;
+    uint64_t elapsed;
+    uint64_t cpu;
+    histogram_t latency;
+
+    /* Callbacks the core made that weren't in the session, or were made with other arguments */
+    uint64_t divergences;
+    uint64_t first_divergence;
+    uint64_t skipped;
+
+    /* Copies of the strings, they belong to the core and the proxy unloads it in retro_deinit */
+    char* library_name;
+    char* library_version;
+    double fps;
+}
+replay_t;
+
+static _Thread_local replay_t* s_replay;
+
+static char const* s_core_path;
+static unsigned long s_frames;
+static unsigned long s_warmup;
+static bool s_verbose;
+static bool s_isolated;
+
+static replay_t* s_replays;
+static unsigned s_replay_count;
+static atomic_uint s_next_replay;
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cpu_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void diverged(void) {
+    if (s_replay->divergences++ == 0) {
+        s_replay->first_divergence = s_replay->frame;
+    }
+}
+
+static void RETRO_CALLCONV log_printf(enum retro_log_level level, char const* fmt, ...) {
+    if (!s_verbose && level < RETRO_LOG_WARN) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+/* Interfaces can't be recorded, only the log one is provided and the others aren't available */
+static bool unsupported(unsigned const cmd, void* const data) {
+    if (cmd == RETRO_ENVIRONMENT_GET_LOG_INTERFACE) {
+        ((struct retro_log_callback*)data)->log = log_printf;
+        return true;
+    }
+
+    return false;
+}
+
+static bool environment(unsigned cmd, void* data) {
+    session_event_t const* const event = session_peek(&s_replay->reader);
+
+    if (event == NULL || event->type != SESSION_ENV || event->id != cmd) {
+        diverged();
+        return session_env_kind(cmd) == SESSION_ENV_UNSUPPORTED && unsupported(cmd, data);
+    }
+
+    bool result = event->result;
+
+    switch (session_env_kind(cmd)) {
+        case SESSION_ENV_VALUE:
+            if (result && data != NULL) {
+                memcpy(data, event->data, event->size);
+            }
+
+            break;
+
+        case SESSION_ENV_STRING:
+            if (result) {
+                *(char const**)data = event->string;
+            }
+
+            break;
+
+        case SESSION_ENV_VARIABLE:
+            if (result) {
+                ((struct retro_variable*)data)->value = event->string;
+            }
+
+            break;
+
+        case SESSION_ENV_UNSUPPORTED:
+            result = unsupported(cmd, data);
+            break;
+
+        case SESSION_ENV_RESULT:
+            break;
+    }
+
+    session_next(&s_replay->reader, NULL);
+    return result;
+}
+
+static void video_refresh(void const* data, unsigned width, unsigned height, size_t pitch) {
+    (void)data;
+    (void)width;
+    (void)height;
+    (void)pitch;
+}
+
+static void audio_sample(int16_t left, int16_t right) {
+    (void)left;
+    (void)right;
+}
+
+static size_t audio_sample_batch(int16_t const* data, size_t frames) {
+    (void)data;
+    return frames;
+}
+
+static void input_poll(void) {}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    session_event_t const* const event = session_peek(&s_replay->reader);
+
+    if (
+        event == NULL || event->type != SESSION_INPUT ||
+        event->args[0] != port || event->args[1] != device || event->args[2] != index || event->args[3] != id
+    ) {
+        diverged();
+        return 0;
+    }
+
+    int16_t const value = event->input;
+    session_next(&s_replay->reader, NULL);
+    return value;
+}
+
+static void replay(replay_t* const rep) {
+    s_replay = rep;
+    histogram_reset(&rep->latency);
+
+    if (!(s_isolated ? core_load_isolated : core_load)(&rep->core, s_core_path)) {
+        rep->failed = true;
+        return;
+    }
+
+    if (!session_open(&rep->reader, rep->path)) {
+        core_unload(&rep->core);
+        rep->failed = true;
+        return;
+    }
+
+    core_t const* const core = &rep->core;
+    struct retro_system_info info;
+    struct retro_system_av_info av_info;
+    bool initialized = false;
+    bool loaded = false;
+    void* state = NULL;
+    size_t state_size = 0;
+    session_event_t event;
+
+    memset(&info, 0, sizeof(info));
+    memset(&av_info, 0, sizeof(av_info));
+
+    uint64_t const start = now();
+    uint64_t const cpu = cpu_time();
+
+    while (s_frames == 0 || rep->frame < s_warmup + s_frames) {
+        if (!session_next(&rep->reader, &event)) {
+            break;
+        }
+
+        /* Callbacks left over from the previous call, the core made fewer of them this time */
+        if (event.type != SESSION_CALL) {
+            rep->skipped++;
+            diverged();
+            continue;
+        }
+
+        switch (event.id) {
+            case TRACE_RETRO_INIT:
+                core->init();
+                initialized = true;
+                break;
+
+            case TRACE_RETRO_DEINIT:
+                core->deinit();
+                initialized = false;
+                break;
+
+            case TRACE_RETRO_API_VERSION:
+                core->api_version();
+                break;
+
+            case TRACE_RETRO_GET_SYSTEM_INFO:
+                core->get_system_info(&info);
+
+                free(rep->library_name);
+                free(rep->library_version);
+                rep->library_name = strdup(info.library_name != NULL ? info.library_name : "");
+                rep->library_version = strdup(info.library_version != NULL ? info.library_version : "");
+                break;
+
+            case TRACE_RETRO_GET_SYSTEM_AV_INFO:
+                core->get_system_av_info(&av_info);
+                rep->fps = av_info.timing.fps;
+                break;
+
+            case TRACE_RETRO_SET_ENVIRONMENT:
+                core->set_environment(environment);
+                break;
+
+            case TRACE_RETRO_SET_VIDEO_REFRESH:
+                core->set_video_refresh(video_refresh);
+                break;
+
+            case TRACE_RETRO_SET_AUDIO_SAMPLE:
+                core->set_audio_sample(audio_sample);
+                break;
+
+            case TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH:
+                core->set_audio_sample_batch(audio_sample_batch);
+                break;
+
+            case TRACE_RETRO_SET_INPUT_POLL:
+                core->set_input_poll(input_poll);
+                break;
+
+            case TRACE_RETRO_SET_INPUT_STATE:
+                core->set_input_state(input_state);
+                break;
+
+            case TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE:
+                core->set_controller_port_device((unsigned)event.args[0], (unsigned)event.args[1]);
+                break;
+
+            case TRACE_RETRO_RESET:
+                core->reset();
+                break;
+
+            case TRACE_RETRO_RUN: {
+                uint64_t const t0 = now();
+                core->run();
+
+                if (rep->frame++ >= s_warmup) {
+                    histogram_add(&rep->latency, now() - t0);
+                }
+
+                break;
+            }
+
+            case TRACE_RETRO_SERIALIZE_SIZE:
+                core->serialize_size();
+                break;
+
+            case TRACE_RETRO_SERIALIZE:
+                if (event.args[0] > state_size) {
+                    void* const buffer = realloc(state, (size_t)event.args[0]);
+
+                    if (buffer == NULL) {
+                        break;
+                    }
+
+                    state = buffer;
+                    state_size = (size_t)event.args[0];
+                }
+
+                core->serialize(state, (size_t)event.args[0]);
+                break;
+
+            case TRACE_RETRO_UNSERIALIZE:
+                core->unserialize(event.data, event.size);
+                break;
+
+            case TRACE_RETRO_CHEAT_RESET:
+                core->cheat_reset();
+                break;
+
+            case TRACE_RETRO_CHEAT_SET:
+                core->cheat_set((unsigned)event.args[0], event.args[1] != 0, event.string);
+                break;
+
+            case TRACE_RETRO_LOAD_GAME:
+                loaded = core->load_game(event.game_count != 0 ? event.games : NULL);
+                break;
+
+            case TRACE_RETRO_LOAD_GAME_SPECIAL:
+                loaded = core->load_game_special((unsigned)event.args[0], event.games, event.game_count);
+                break;
+
+            case TRACE_RETRO_UNLOAD_GAME:
+                core->unload_game();
+                loaded = false;
+                break;
+
+            case TRACE_RETRO_GET_REGION:
+                core->get_region();
+                break;
+
+            case TRACE_RETRO_GET_MEMORY_DATA:
+                core->get_memory_data((unsigned)event.args[0]);
+                break;
+
+            case TRACE_RETRO_GET_MEMORY_SIZE:
+                core->get_memory_size((unsigned)event.args[0]);
+                break;
+
+            default:
+                fprintf(stderr, "Unknown call %u in \"%s\"\n", event.id, rep->path);
+                break;
+        }
+    }
+
+    rep->elapsed = now() - start;
+    rep->cpu = cpu_time() - cpu;
+
+    /* Sessions often end without unloading, i.e. when recorded with RetroArch */
+    if (loaded) {
+        core->unload_game();
+    }
+
+    if (initialized) {
+        core->deinit();
+    }
+
+    core_unload(&rep->core);
+    session_close(&rep->reader);
+    free(state);
+}
+
+static void* worker(void* const arg) {
+    (void)arg;
+
+    for (;;) {
+        unsigned const index = atomic_fetch_add(&s_next_replay, 1);
+
+        if (index >= s_replay_count) {
+            return NULL;
+        }
+
+        replay(&s_replays[index]);
+    }
+}
+
+static void report(replay_t const* const rep) {
+    if (s_replay_count > 1) {
+        printf("%s\n", rep->path);
+    }
+
+    if (rep->failed) {
+        printf("failed\n");
+        return;
+    }
+
+    printf(
+        "core        %s %s\n",
+        rep->library_name != NULL ? rep->library_name : "",
+        rep->library_version != NULL ? rep->library_version : ""
+    );
+
+    printf("session     %llu frames in %.3f s\n", (unsigned long long)rep->frame, rep->elapsed / 1e9);
+
+    histogram_t const* const latency = &rep->latency;
+
+    if (latency->count != 0) {
+        double const fps = latency->count / (latency->total / 1e9);
+
+        printf("speed       %.2f fps in retro_run", fps);
+
+        if (rep->fps > 0.0) {
+            printf(", %.2fx real time at %.2f fps", fps / rep->fps, rep->fps);
+        }
+
+        printf("\n");
+        printf(
+            "frame (us)  mean %.2f, p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+            (double)latency->total / (double)latency->count / 1000.0,
+            histogram_percentile(latency, 50.0) / 1000.0,
+            histogram_percentile(latency, 90.0) / 1000.0,
+            histogram_percentile(latency, 99.0) / 1000.0,
+            histogram_percentile(latency, 99.9) / 1000.0,
+            latency->max / 1000.0
+        );
+    }
+
+    /* A core that doesn't behave the same as when recorded isn't running the same game anymore */
+    if (rep->divergences != 0) {
+        printf(
+            "diverged    %llu callbacks didn't match the session (%llu left over), first at frame %llu\n",
+            (unsigned long long)rep->divergences,
+            (unsigned long long)rep->skipped,
+            (unsigned long long)rep->first_divergence
+        );
+    }
+}
+
+static int usage(char const* const name) {
+    fprintf(stderr, "Usage: %s [-n frames] [-w warmup frames] [-j jobs] [-v] core session...\n", name);
+    fprintf(stderr, "  -n  stops after this number of frames, defaults to the whole session\n");
+    fprintf(stderr, "  -w  frames at the start of the session that aren't measured, defaults to 0\n");
+    fprintf(stderr, "  -j  sessions replayed at the same time, up to %d, defaults to 1\n", MAX_JOBS);
+    fprintf(stderr, "  -v  shows all the messages logged by the core\n");
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long jobs = 1;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            s_frames = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            s_warmup = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            s_verbose = true;
+        }
+        else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (argc - i < 2 || jobs == 0 || jobs > MAX_JOBS) {
+        return usage(argv[0]);
+    }
+
+    s_core_path = argv[i];
+    s_replay_count = (unsigned)(argc - i - 1);
+    s_replays = (replay_t*)calloc(s_replay_count, sizeof(replay_t));
+
+    if (s_replays == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (unsigned j = 0; j < s_replay_count; j++) {
+        s_replays[j].path = argv[i + 1 + j];
+    }
+
+    /* A core isn't guaranteed to start over when loaded again after dlclose, so each session gets a new namespace */
+    s_isolated = s_replay_count > 1;
+
+    if (jobs > s_replay_count) {
+        jobs = s_replay_count;
+    }
+
+    uint64_t const start = now();
+
+    pthread_t threads[MAX_JOBS];
+    unsigned started = 0;
+
+    if (jobs > 1) {
+        for (; started < jobs; started++) {
+            if (pthread_create(&threads[started], NULL, worker, NULL) != 0) {
+                fprintf(stderr, "Couldn't start worker thread\n");
+                break;
+            }
+        }
+    }
+
+    /* With a single job, or if no thread could be started, the sessions are replayed here */
+    if (started == 0) {
+        worker(NULL);
+    }
+
+    for (unsigned j = 0; j < started; j++) {
+        pthread_join(threads[j], NULL);
+    }
+
+    uint64_t const wall = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    int status = 0;
+    uint64_t frames = 0;
+    uint64_t busy = 0;
+
+    for (unsigned j = 0; j < s_replay_count; j++) {
+        replay_t* const rep = &s_replays[j];
+
+        report(rep);
+
+        frames += rep->frame;
+        busy += rep->cpu;
+
+        if (rep->failed) {
+            status = 1;
+        }
+        else if (rep->divergences != 0 && status == 0) {
+            status = 2;
+        }
+
+        free(rep->library_name);
+        free(rep->library_version);
+    }
+
+    /* The CPU time of all the sessions over the time it took to replay them, it's the number of jobs when they scale linearly */
+    if (s_replay_count > 1) {
+        printf(
+            "total       %u sessions, %llu frames in %.3f s, %.2f fps, %.2f cores busy with %u jobs\n",
+            s_replay_count,
+            (unsigned long long)frames,
+            wall / 1e9,
+            frames / (wall / 1e9),
+            (double)busy / (double)wall,
+            started != 0 ? started : 1
+        );
+    }
+
+    printf("peak RSS    %ld KiB\n", usage.ru_maxrss);
+
+    free(s_replays);
+    return status;
+}
@@ -0,0 +1,359 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "rewind.h"
+#include "trace.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[LRPROXY] "
+
+/* Runs of equal bytes shorter than this are cheaper to keep in the literal than to end it */
+#define MIN_ZEROS 4
+
+/*
+The deltas are stored one after the other, with their size before and after
+them so the ring can be walked from both ends. When a delta doesn't fit
+before the end of the ring it goes to its start, and the deltas wrap around.
+*/
+static uint8_t* s_ring;
+static size_t s_capacity;
+static size_t s_head;    /* where the next delta goes */
+static size_t s_tail;    /* the oldest delta */
+static size_t s_end;     /* the end of the deltas before the start of the ring when they wrap around */
+static bool s_wrapped;
+static size_t s_count;
+
+static uint8_t* s_current;
+static uint8_t* s_scratch;
+static size_t s_size;
+static bool s_has_current;
+
+static unsigned s_interval;
+static uint64_t s_pushed;
+static uint64_t s_popped;
+static uint64_t s_dropped;
+static uint64_t s_raw_bytes;
+static uint64_t s_delta_bytes;
+static size_t s_max_count;
+static size_t s_max_used;
+static histogram_t s_times;
+
+static uint8_t* put_uint(uint8_t* p, size_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static uint8_t const* get_uint(uint8_t const* p, size_t* const value) {
+    size_t v = 0;
+    unsigned shift = 0;
+
+    do {
+        v |= (size_t)(*p & 0x7f) << shift;
+        shift += 7;
+    }
+    while ((*p++ & 0x80) != 0);
+
+    *value = v;
+    return p;
+}
+
+/* Worst case is a single equal byte between each pair of different ones, each costing two bytes of run lengths */
+static size_t max_delta_size(size_t const size) {
+    return size + size / 2 + 32;
+}
+
+/*
+Encodes a XOR b as pairs of the length of a run of zeros and the length of
+the literal after it, followed by the literal. Whole words are compared
+while skipping the zeros, which is most of the state.
+*/
+static size_t encode(uint8_t* const out, uint8_t const* const a, uint8_t const* const b, size_t const size) {
+    uint8_t* p = out;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t const zeros = i;
+
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t x, y;
+            memcpy(&x, a + i, sizeof(x));
+            memcpy(&y, b + i, sizeof(y));
+
+            if (x != y) {
+                break;
+            }
+        }
+
+        while (i < size && a[i] == b[i]) {
+            i++;
+        }
+
+        size_t const literal = i;
+
+        while (i < size) {
+            if (a[i] != b[i]) {
+                i++;
+                continue;
+            }
+
+            size_t equal = 1;
+
+            while (equal < MIN_ZEROS && i + equal < size && a[i + equal] == b[i + equal]) {
+                equal++;
+            }
+
+            if (equal == MIN_ZEROS || i + equal == size) {
+                break;
+            }
+
+            i += equal;
+        }
+
+        p = put_uint(p, literal - zeros);
+        p = put_uint(p, i - literal);
+
+        for (size_t j = literal; j < i; j++) {
+            *p++ = a[j] ^ b[j];
+        }
+    }
+
+    return (size_t)(p - out);
+}
+
+static void apply(uint8_t* const state, uint8_t const* p, size_t const size) {
+    uint8_t const* const end = p + size;
+    size_t offset = 0;
+
+    while (p < end) {
+        size_t zeros, literal;
+        p = get_uint(p, &zeros);
+        p = get_uint(p, &literal);
+        offset += zeros;
+
+        for (size_t j = 0; j < literal; j++) {
+            state[offset + j] ^= p[j];
+        }
+
+        offset += literal;
+        p += literal;
+    }
+}
+
+static void clear(void) {
+    s_head = s_tail = s_end = 0;
+    s_wrapped = false;
+    s_count = 0;
+}
+
+static size_t get_size(size_t const offset) {
+    size_t size;
+    memcpy(&size, s_ring + offset, sizeof(size));
+    return size;
+}
+
+static void drop_oldest(void) {
+    s_tail += get_size(s_tail) + 2 * sizeof(size_t);
+
+    if (s_wrapped && s_tail == s_end) {
+        s_tail = 0;
+        s_wrapped = false;
+    }
+
+    if (--s_count == 0) {
+        clear();
+    }
+
+    s_dropped++;
+}
+
+/* Finds room for the delta dropping the oldest ones, returns false if it's larger than the ring */
+static bool put(uint8_t const* const delta, size_t const size) {
+    size_t const total = size + 2 * sizeof(size_t);
+
+    if (total > s_capacity) {
+        return false;
+    }
+
+    for (;;) {
+        if (s_count == 0) {
+            break;
+        }
+        else if (s_wrapped) {
+            if (s_head + total <= s_tail) {
+                break;
+            }
+        }
+        else if (s_head + total <= s_capacity) {
+            break;
+        }
+        else if (total <= s_tail) {
+            s_end = s_head;
+            s_head = 0;
+            s_wrapped = true;
+            break;
+        }
+
+        drop_oldest();
+    }
+
+    memcpy(s_ring + s_head, &size, sizeof(size));
+    memcpy(s_ring + s_head + sizeof(size), delta, size);
+    memcpy(s_ring + s_head + sizeof(size) + size, &size, sizeof(size));
+    s_head += total;
+    s_count++;
+    s_max_count = s_count > s_max_count ? s_count : s_max_count;
+
+    size_t const used = s_wrapped ? s_end - s_tail + s_head : s_head - s_tail;
+    s_max_used = used > s_max_used ? used : s_max_used;
+    return true;
+}
+
+bool rewind_start(size_t const capacity, unsigned const interval) {
+    s_ring = (uint8_t*)malloc(capacity);
+
+    if (s_ring == NULL) {
+        fprintf(stderr, TAG "Couldn't allocate %zu bytes for rewind\n", capacity);
+        return false;
+    }
+
+    s_capacity = capacity;
+    s_interval = interval;
+    clear();
+
+    s_current = s_scratch = NULL;
+    s_size = 0;
+    s_has_current = false;
+
+    s_pushed = s_popped = s_dropped = 0;
+    s_raw_bytes = s_delta_bytes = 0;
+    s_max_count = s_max_used = 0;
+    histogram_reset(&s_times);
+    return true;
+}
+
+void rewind_stop(void) {
+    if (s_pushed != 0) {
+        fprintf(
+            stderr,
+            TAG "Rewind: %llu states of %zu bytes, deltas are %.2f%% of the states, %.2f us mean and %.2f us p99 to make\n",
+            (unsigned long long)s_pushed,
+            s_size,
+            s_raw_bytes != 0 ? (double)s_delta_bytes * 100.0 / (double)s_raw_bytes : 0.0,
+            (double)s_times.total / (double)s_times.count / 1000.0,
+            histogram_percentile(&s_times, 99.0) / 1000.0
+        );
+
+        fprintf(
+            stderr,
+            TAG "Rewind: up to %zu states, %zu frames back, in %zu of %zu KiB plus %zu KiB for the newest state and the scratch delta, %llu dropped, %llu rewound\n",
+            s_max_count + 1,
+            s_max_count * s_interval,
+            s_max_used / 1024,
+            s_capacity / 1024,
+            (s_size + max_delta_size(s_size)) / 1024,
+            (unsigned long long)s_dropped,
+            (unsigned long long)s_popped
+        );
+    }
+
+    free(s_ring);
+    free(s_current);
+    free(s_scratch);
+    s_ring = s_current = s_scratch = NULL;
+}
+
+void rewind_push(void const* const state, size_t const size) {
+    uint64_t const t0 = trace_now();
+
+    if (size != s_size) {
+        uint8_t* const current = (uint8_t*)realloc(s_current, size);
+        uint8_t* const scratch = (uint8_t*)realloc(s_scratch, max_delta_size(size));
+
+        s_current = current != NULL ? current : s_current;
+        s_scratch = scratch != NULL ? scratch : s_scratch;
+
+        if (current == NULL || scratch == NULL) {
+            s_size = 0;
+            s_has_current = false;
+            clear();
+            return;
+        }
+
+        s_size = size;
+        s_has_current = false;
+        clear();
+    }
+
+    if (s_has_current) {
+        /* The older state is what's left after XORing the delta to the newer */
+        size_t const delta = encode(s_scratch, (uint8_t const*)state, s_current, size);
+
+        if (!put(s_scratch, delta)) {
+            clear();
+        }
+
+        s_raw_bytes += size;
+        s_delta_bytes += delta;
+    }
+
+    memcpy(s_current, state, size);
+    s_has_current = true;
+    s_pushed++;
+    histogram_add(&s_times, trace_now() - t0);
+}
+
+void const* rewind_pop(size_t* const size) {
+    if (!s_has_current) {
+        return NULL;
+    }
+
+    if (s_count != 0) {
+        if (s_head == 0 && s_wrapped) {
+            s_head = s_end;
+            s_wrapped = false;
+        }
+
+        size_t const delta = get_size(s_head - sizeof(size_t));
+        s_head -= delta + 2 * sizeof(size_t);
+        apply(s_current, s_ring + s_head + sizeof(size_t), delta);
+
+        if (--s_count == 0) {
+            clear();
+        }
+
+        s_popped++;
+    }
+
+    *size = s_size;
+    return s_current;
+}
@@ -0,0 +1,39 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Savestates kept for rewinding, in a ring of at most capacity bytes. Only the
+newest state is kept whole, each older one is the XOR of it with the state
+that came after it, with the runs of zeros taken out, which is little more
+than the bytes that changed between them. When the ring is full the oldest
+states are dropped. interval is the number of frames between states, used
+only in the report.
+*/
+bool rewind_start(size_t capacity, unsigned interval);
+
+/* Prints the report and frees the memory */
+void rewind_stop(void);
+
+/* Adds a state, a state with a different size drops all the others */
+void rewind_push(void const* state, size_t size);
+
+/*
+Goes back to the state before the newest one, which becomes the newest, and
+returns it. Returns the oldest state once there's nothing before it, and
+NULL if there are no states. The state is valid until the next push or pop.
+*/
+void const* rewind_pop(size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REWIND_H */
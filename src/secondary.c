@@ -0,0 +1,215 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "secondary.h"
+#include "core.h"
+
+#include <stdio.h>
+
+#define TAG "[LRPROXY] "
+
+#define AV_VIDEO_AUDIO 3
+
+static core_t s_core;
+static char const* s_path;
+
+static retro_environment_t s_env;
+static retro_input_state_t s_input_state;
+static retro_video_refresh_t s_video_refresh;
+static retro_audio_sample_batch_t s_audio_sample_batch;
+
+static enum retro_pixel_format s_format;
+static bool s_variable_update;
+static int s_av_enable;
+
+/* The requests for information go to the frontend, the ones that would change its state are accepted and ignored */
+static bool environment(unsigned cmd, void* data) {
+    switch (cmd) {
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+            s_format = *(enum retro_pixel_format const*)data;
+            return true;
+
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+            /* Asking the frontend would clear the flag before the first copy sees it */
+            *(bool*)data = s_variable_update;
+            s_variable_update = false;
+            return true;
+
+        case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE: {
+            if (s_av_enable < 0) {
+                return s_env != NULL && s_env(cmd, data);
+            }
+
+            int const frontend = s_env != NULL && s_env(cmd, data) ? *(int*)data : AV_VIDEO_AUDIO;
+            *(int*)data = (frontend & s_av_enable) | (s_av_enable & ~AV_VIDEO_AUDIO);
+            return true;
+        }
+
+        case RETRO_ENVIRONMENT_SET_HW_RENDER:
+        case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK:
+        case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+        case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER:
+        case RETRO_ENVIRONMENT_GET_HW_RENDER_INTERFACE:
+            return false;
+
+        case RETRO_ENVIRONMENT_GET_OVERSCAN:
+        case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+        case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_VARIABLE:
+        case RETRO_ENVIRONMENT_GET_LIBRETRO_PATH:
+        case RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES:
+        case RETRO_ENVIRONMENT_GET_SENSOR_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_LOCATION_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_CORE_ASSETS_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_USERNAME:
+        case RETRO_ENVIRONMENT_GET_LANGUAGE:
+        case RETRO_ENVIRONMENT_GET_VFS_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_LED_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_MIDI_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_FASTFORWARDING:
+        case RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE:
+        case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
+        case RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION:
+        case RETRO_ENVIRONMENT_GET_PREFERRED_HW_RENDER:
+        case RETRO_ENVIRONMENT_GET_DISK_CONTROL_INTERFACE_VERSION:
+            return s_env != NULL && s_env(cmd, data);
+
+        default:
+            return true;
+    }
+}
+
+static void audio_sample(int16_t left, int16_t right) {
+    int16_t const frame[2] = {left, right};
+    s_audio_sample_batch(frame, 1);
+}
+
+/* The frontend already polled for the first copy, and gives the same answers until the next frame */
+static void input_poll(void) {}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    return s_input_state != NULL ? s_input_state(port, device, index, id) : 0;
+}
+
+bool secondary_load(char const* const path, retro_video_refresh_t const video_refresh, retro_audio_sample_batch_t const audio_sample_batch) {
+    if (!core_load_isolated(&s_core, path)) {
+        return false;
+    }
+
+    s_path = path;
+    s_video_refresh = video_refresh;
+    s_audio_sample_batch = audio_sample_batch;
+    s_format = RETRO_PIXEL_FORMAT_0RGB1555;
+    s_variable_update = false;
+    s_av_enable = -1;
+
+    s_core.set_video_refresh(s_video_refresh);
+    s_core.set_audio_sample(audio_sample);
+    s_core.set_audio_sample_batch(s_audio_sample_batch);
+    s_core.set_input_poll(input_poll);
+    s_core.set_input_state(input_state);
+    return true;
+}
+
+void secondary_set_environment(retro_environment_t const cb) {
+    s_env = cb;
+    s_core.set_environment(environment);
+}
+
+void secondary_set_input_state(retro_input_state_t const cb) {
+    s_input_state = cb;
+}
+
+void secondary_init(void) {
+    s_core.init();
+}
+
+void secondary_get_system_av_info(void) {
+    struct retro_system_av_info info;
+    s_core.get_system_av_info(&info);
+}
+
+void secondary_set_controller_port_device(unsigned const port, unsigned const device) {
+    s_core.set_controller_port_device(port, device);
+}
+
+void secondary_reset(void) {
+    s_core.reset();
+}
+
+void secondary_cheat_reset(void) {
+    s_core.cheat_reset();
+}
+
+void secondary_cheat_set(unsigned const index, bool const enabled, char const* const code) {
+    s_core.cheat_set(index, enabled, code);
+}
+
+void secondary_load_game(struct retro_game_info const* const game) {
+    if (!s_core.load_game(game)) {
+        fprintf(stderr, TAG "\"%s\" couldn't load the content\n", s_path);
+    }
+}
+
+void secondary_load_game_special(unsigned const game_type, struct retro_game_info const* const info, size_t const num_info) {
+    if (!s_core.load_game_special(game_type, info, num_info)) {
+        fprintf(stderr, TAG "\"%s\" couldn't load the content\n", s_path);
+    }
+}
+
+void secondary_unload_game(void) {
+    s_core.unload_game();
+}
+
+void secondary_deinit(void) {
+    s_core.deinit();
+    core_unload(&s_core);
+}
+
+void secondary_environment(unsigned const cmd, void const* const data, bool const result) {
+    if (cmd == RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE && result && *(bool const*)data) {
+        s_variable_update = true;
+    }
+}
+
+void secondary_set_av_enable(int const av_enable) {
+    s_av_enable = av_enable;
+}
+
+enum retro_pixel_format secondary_pixel_format(void) {
+    return s_format;
+}
+
+void secondary_run(void) {
+    s_core.run();
+}
+
+bool secondary_unserialize(void const* const data, size_t const size) {
+    return s_core.unserialize(data, size);
+}
@@ -0,0 +1,58 @@
+#ifndef SECONDARY_H
+#define SECONDARY_H
+
+#include "libretro.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+A second copy of a core, loaded in its own namespace so it has its own
+global variables, that runs next to the one the frontend sees without the
+frontend knowing about it. Its environment calls that ask the frontend for
+something are forwarded to it, the ones that would change the frontend's
+state are answered here, and it reads the input from the frontend after the
+first copy polled it. Its video and audio go to the callbacks given here.
+*/
+bool secondary_load(char const* path, retro_video_refresh_t video_refresh, retro_audio_sample_batch_t audio_sample_batch);
+
+/* Mirrors of the calls the frontend made to the first copy */
+void secondary_set_environment(retro_environment_t cb);
+void secondary_set_input_state(retro_input_state_t cb);
+void secondary_init(void);
+void secondary_get_system_av_info(void);
+void secondary_set_controller_port_device(unsigned port, unsigned device);
+void secondary_reset(void);
+void secondary_cheat_reset(void);
+void secondary_cheat_set(unsigned index, bool enabled, char const* code);
+void secondary_load_game(struct retro_game_info const* game);
+void secondary_load_game_special(unsigned game_type, struct retro_game_info const* info, size_t num_info);
+void secondary_unload_game(void);
+
+/* Deinitializes and unloads the second copy */
+void secondary_deinit(void);
+
+/* Environment calls made by the first copy, for the core options updates that the second copy must see too */
+void secondary_environment(unsigned cmd, void const* data, bool result);
+
+/*
+What the second copy gets from GET_AUDIO_VIDEO_ENABLE. The video and audio
+bits are cleared from the frontend's answer, and the others are added to it.
+Negative forwards the frontend's answer as is, which is the default.
+*/
+void secondary_set_av_enable(int av_enable);
+
+enum retro_pixel_format secondary_pixel_format(void);
+
+void secondary_run(void);
+bool secondary_unserialize(void const* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SECONDARY_H */
@@ -0,0 +1,624 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[LRPROXY] "
+
+/* Most events are a few bytes, so they're written to a large stdio buffer and only go to disk once in a while */
+#define SESSION_BUFFER (1 << 20)
+
+static FILE* s_file;
+static bool s_truncated;
+
+session_env_kind_t session_env_kind(unsigned const cmd) {
+    switch (cmd) {
+        case RETRO_ENVIRONMENT_GET_OVERSCAN:
+        case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+        case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES:
+        case RETRO_ENVIRONMENT_GET_LANGUAGE:
+        case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+        case RETRO_ENVIRONMENT_GET_FASTFORWARDING:
+        case RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE:
+        case RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION:
+        case RETRO_ENVIRONMENT_GET_PREFERRED_HW_RENDER:
+        case RETRO_ENVIRONMENT_GET_DISK_CONTROL_INTERFACE_VERSION:
+            return SESSION_ENV_VALUE;
+
+        case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_LIBRETRO_PATH:
+        case RETRO_ENVIRONMENT_GET_CORE_ASSETS_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY:
+        case RETRO_ENVIRONMENT_GET_USERNAME:
+            return SESSION_ENV_STRING;
+
+        case RETRO_ENVIRONMENT_GET_VARIABLE:
+            return SESSION_ENV_VARIABLE;
+
+        case RETRO_ENVIRONMENT_SET_HW_RENDER:
+        case RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_SENSOR_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_LOCATION_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER:
+        case RETRO_ENVIRONMENT_GET_HW_RENDER_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_VFS_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_LED_INTERFACE:
+        case RETRO_ENVIRONMENT_GET_MIDI_INTERFACE:
+            return SESSION_ENV_UNSUPPORTED;
+
+        default:
+            return SESSION_ENV_RESULT;
+    }
+}
+
+/* Size of the scalar written by SESSION_ENV_VALUE commands */
+static size_t value_size(unsigned const cmd) {
+    switch (cmd) {
+        case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES:
+            return sizeof(uint64_t);
+
+        case RETRO_ENVIRONMENT_GET_LANGUAGE:
+        case RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION:
+        case RETRO_ENVIRONMENT_GET_PREFERRED_HW_RENDER:
+        case RETRO_ENVIRONMENT_GET_DISK_CONTROL_INTERFACE_VERSION:
+            return sizeof(unsigned);
+
+        case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+            return sizeof(int);
+
+        case RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE:
+            return sizeof(float);
+
+        default:
+            return sizeof(bool);
+    }
+}
+
+/* The writers are only called with the file locked */
+static void put_uint(uint64_t value) {
+    while (value >= 0x80) {
+        putc_unlocked((int)((value & 0x7f) | 0x80), s_file);
+        value >>= 7;
+    }
+
+    putc_unlocked((int)value, s_file);
+}
+
+static void put_string(char const* const str) {
+    if (str == NULL) {
+        put_uint(0);
+        return;
+    }
+
+    size_t const length = strlen(str);
+    put_uint(length + 1);
+    fwrite(str, 1, length, s_file);
+}
+
+static void put_blob(void const* const data, size_t const size) {
+    put_uint(size);
+
+    if (size != 0) {
+        fwrite(data, 1, size, s_file);
+    }
+}
+
+static void begin(session_event_type_t const type, unsigned const id) {
+    flockfile(s_file);
+    putc_unlocked((int)type, s_file);
+    put_uint(id);
+}
+
+static void end(void) {
+    funlockfile(s_file);
+}
+
+bool session_start(char const* const path) {
+    if (s_file != NULL) {
+        return true;
+    }
+
+    s_file = fopen(path, s_truncated ? "ab" : "wb");
+
+    if (s_file == NULL) {
+        fprintf(stderr, TAG "Couldn't open session file \"%s\"\n", path);
+        return false;
+    }
+
+    setvbuf(s_file, NULL, _IOFBF, SESSION_BUFFER);
+
+    if (!s_truncated) {
+        session_header_t header;
+        memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+        header.version = SESSION_VERSION;
+        header.reserved = 0;
+
+        fwrite(&header, sizeof(header), 1, s_file);
+        s_truncated = true;
+    }
+
+    return true;
+}
+
+void session_stop(void) {
+    if (s_file != NULL) {
+        fclose(s_file);
+        s_file = NULL;
+    }
+}
+
+void session_call(trace_id_t const id, uint64_t const arg0, uint64_t const arg1) {
+    if (s_file == NULL) {
+        return;
+    }
+
+    begin(SESSION_CALL, id);
+
+    switch (id) {
+        case TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE:
+            put_uint(arg0);
+            put_uint(arg1);
+            break;
+
+        case TRACE_RETRO_SERIALIZE:
+        case TRACE_RETRO_GET_MEMORY_DATA:
+        case TRACE_RETRO_GET_MEMORY_SIZE:
+            put_uint(arg0);
+            break;
+
+        default:
+            break;
+    }
+
+    end();
+}
+
+void session_cheat(unsigned const index, bool const enabled, char const* const code) {
+    if (s_file == NULL) {
+        return;
+    }
+
+    begin(SESSION_CALL, TRACE_RETRO_CHEAT_SET);
+    put_uint(index);
+    put_uint(enabled);
+    put_string(code);
+    end();
+}
+
+void session_load_game(trace_id_t const id, unsigned const game_type, struct retro_game_info const* const info, size_t const num_info) {
+    if (s_file == NULL) {
+        return;
+    }
+
+    size_t const count = info == NULL ? 0 : num_info < SESSION_MAX_GAMES ? num_info : SESSION_MAX_GAMES;
+
+    begin(SESSION_CALL, id);
+
+    if (id == TRACE_RETRO_LOAD_GAME_SPECIAL) {
+        put_uint(game_type);
+    }
+
+    put_uint(count);
+
+    /* The content itself is only there when the core doesn't need the full path */
+    for (size_t i = 0; i < count; i++) {
+        put_string(info[i].path);
+        put_string(info[i].meta);
+        put_uint(info[i].data != NULL);
+
+        if (info[i].data != NULL) {
+            put_blob(info[i].data, info[i].size);
+        }
+        else {
+            put_uint(info[i].size);
+        }
+    }
+
+    end();
+}
+
+void session_unserialize(void const* const data, size_t const size) {
+    if (s_file == NULL) {
+        return;
+    }
+
+    begin(SESSION_CALL, TRACE_RETRO_UNSERIALIZE);
+    put_blob(data, size);
+    end();
+}
+
+void session_input(unsigned const port, unsigned const device, unsigned const index, unsigned const id, int16_t const value) {
+    if (s_file == NULL) {
+        return;
+    }
+
+    /* Zigzag encoding, so small negative values like analog sticks at rest are small too */
+    uint32_t const zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value < 0 ? -1 : 0);
+
+    begin(SESSION_INPUT, port);
+    put_uint(device);
+    put_uint(index);
+    put_uint(id);
+    put_uint(zigzag & 0xffff);
+    end();
+}
+
+void session_env(unsigned const cmd, void const* const data, bool const result) {
+    if (s_file == NULL) {
+        return;
+    }
+
+    bool const written = result && data != NULL;
+
+    begin(SESSION_ENV, cmd);
+    put_uint(result);
+
+    switch (session_env_kind(cmd)) {
+        case SESSION_ENV_VALUE:
+            put_blob(data, written ? value_size(cmd) : 0);
+            break;
+
+        case SESSION_ENV_STRING:
+            put_string(written ? *(char const* const*)data : NULL);
+            break;
+
+        case SESSION_ENV_VARIABLE:
+            put_string(written ? ((struct retro_variable const*)data)->value : NULL);
+            break;
+
+        default:
+            break;
+    }
+
+    end();
+}
+
+/* Only flushed when the frontend deinitializes the core, or not at all if it doesn't */
+__attribute__((destructor)) static void session_fini(void) {
+    session_stop();
+}
+
+static bool get_uint(session_reader_t* const reader, uint64_t* const value) {
+    *value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int const byte = getc(reader->file);
+
+        if (byte == EOF) {
+            return false;
+        }
+
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool get_bytes(session_reader_t* const reader, void* const data, size_t const size) {
+    return size == 0 || fread(data, 1, size, reader->file) == size;
+}
+
+static bool grow(void*** const array, size_t* const capacity, size_t const count) {
+    if (count < *capacity) {
+        return true;
+    }
+
+    size_t const new_capacity = *capacity != 0 ? *capacity * 2 : 64;
+    void** const new_array = (void**)realloc(*array, new_capacity * sizeof(void*));
+
+    if (new_array == NULL) {
+        return false;
+    }
+
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+/* Strings are interned, so core options read every frame don't take more memory each time */
+static bool get_string(session_reader_t* const reader, char const** const str) {
+    uint64_t length;
+
+    if (!get_uint(reader, &length)) {
+        return false;
+    }
+
+    if (length == 0) {
+        *str = NULL;
+        return true;
+    }
+
+    char* const copy = (char*)malloc(length);
+
+    if (copy == NULL || !get_bytes(reader, copy, length - 1)) {
+        free(copy);
+        return false;
+    }
+
+    copy[length - 1] = 0;
+
+    for (size_t i = 0; i < reader->string_count; i++) {
+        if (strcmp(reader->strings[i], copy) == 0) {
+            free(copy);
+            *str = reader->strings[i];
+            return true;
+        }
+    }
+
+    if (!grow((void***)&reader->strings, &reader->string_capacity, reader->string_count)) {
+        free(copy);
+        return false;
+    }
+
+    reader->strings[reader->string_count++] = copy;
+    *str = copy;
+    return true;
+}
+
+static bool get_games(session_reader_t* const reader, session_event_t* const event) {
+    uint64_t count;
+
+    if (!get_uint(reader, &count) || count > SESSION_MAX_GAMES) {
+        return false;
+    }
+
+    event->game_count = (size_t)count;
+
+    for (size_t i = 0; i < event->game_count; i++) {
+        struct retro_game_info* const game = &event->games[i];
+        uint64_t has_data, size;
+
+        if (!get_string(reader, &game->path) || !get_string(reader, &game->meta) || !get_uint(reader, &has_data) || !get_uint(reader, &size)) {
+            return false;
+        }
+
+        game->data = NULL;
+        game->size = (size_t)size;
+
+        if (has_data == 0) {
+            continue;
+        }
+
+        void* const data = malloc(size != 0 ? (size_t)size : 1);
+
+        if (data == NULL || !get_bytes(reader, data, (size_t)size) || !grow(&reader->contents, &reader->content_capacity, reader->content_count)) {
+            free(data);
+            return false;
+        }
+
+        reader->contents[reader->content_count++] = data;
+        game->data = data;
+    }
+
+    return true;
+}
+
+static bool get_state(session_reader_t* const reader, session_event_t* const event) {
+    uint64_t size;
+
+    if (!get_uint(reader, &size)) {
+        return false;
+    }
+
+    unsigned const which = reader->current ^= 1;
+
+    if (size > reader->capacities[which]) {
+        uint8_t* const state = (uint8_t*)realloc(reader->states[which], (size_t)size);
+
+        if (state == NULL) {
+            return false;
+        }
+
+        reader->states[which] = state;
+        reader->capacities[which] = (size_t)size;
+    }
+
+    event->data = reader->states[which];
+    event->size = (size_t)size;
+    return get_bytes(reader, reader->states[which], (size_t)size);
+}
+
+static bool get_call(session_reader_t* const reader, session_event_t* const event) {
+    switch (event->id) {
+        case TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE:
+        case TRACE_RETRO_CHEAT_SET:
+            if (!get_uint(reader, &event->args[0]) || !get_uint(reader, &event->args[1])) {
+                return false;
+            }
+
+            return event->id != TRACE_RETRO_CHEAT_SET || get_string(reader, &event->string);
+
+        case TRACE_RETRO_SERIALIZE:
+        case TRACE_RETRO_GET_MEMORY_DATA:
+        case TRACE_RETRO_GET_MEMORY_SIZE:
+            return get_uint(reader, &event->args[0]);
+
+        case TRACE_RETRO_UNSERIALIZE:
+            return get_state(reader, event);
+
+        case TRACE_RETRO_LOAD_GAME_SPECIAL:
+            if (!get_uint(reader, &event->args[0])) {
+                return false;
+            }
+
+            /* fallthrough */
+
+        case TRACE_RETRO_LOAD_GAME:
+            return get_games(reader, event);
+
+        default:
+            return true;
+    }
+}
+
+static bool get_env(session_reader_t* const reader, session_event_t* const event) {
+    uint64_t result;
+
+    if (!get_uint(reader, &result)) {
+        return false;
+    }
+
+    event->result = result != 0;
+
+    switch (session_env_kind(event->id)) {
+        case SESSION_ENV_VALUE: {
+            uint64_t size;
+
+            if (!get_uint(reader, &size) || size > sizeof(event->value)) {
+                return false;
+            }
+
+            event->data = event->value;
+            event->size = (size_t)size;
+            return get_bytes(reader, event->value, (size_t)size);
+        }
+
+        case SESSION_ENV_STRING:
+        case SESSION_ENV_VARIABLE:
+            return get_string(reader, &event->string);
+
+        default:
+            return true;
+    }
+}
+
+static bool get_event(session_reader_t* const reader, session_event_t* const event) {
+    int const type = getc(reader->file);
+    uint64_t id;
+
+    memset(event, 0, sizeof(*event));
+
+    if (type == EOF || !get_uint(reader, &id)) {
+        return false;
+    }
+
+    event->type = (session_event_type_t)type;
+    event->id = (unsigned)id;
+
+    switch (event->type) {
+        case SESSION_CALL:
+            return get_call(reader, event);
+
+        case SESSION_INPUT: {
+            uint64_t zigzag;
+            event->args[0] = id;
+
+            if (!get_uint(reader, &event->args[1]) || !get_uint(reader, &event->args[2]) || !get_uint(reader, &event->args[3]) || !get_uint(reader, &zigzag)) {
+                return false;
+            }
+
+            event->input = (int16_t)((zigzag >> 1) ^ (uint64_t)-(int64_t)(zigzag & 1));
+            return true;
+        }
+
+        case SESSION_ENV:
+            return get_env(reader, event);
+
+        default:
+            return false;
+    }
+}
+
+bool session_open(session_reader_t* const reader, char const* const path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+
+    if (reader->file == NULL) {
+        fprintf(stderr, "Couldn't open \"%s\"\n", path);
+        return false;
+    }
+
+    session_header_t header;
+
+    if (fread(&header, sizeof(header), 1, reader->file) != 1 || memcmp(header.magic, SESSION_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "\"%s\" is not a session file\n", path);
+        session_close(reader);
+        return false;
+    }
+
+    if (header.version != SESSION_VERSION) {
+        fprintf(stderr, "Unsupported session version %u\n", header.version);
+        session_close(reader);
+        return false;
+    }
+
+    return true;
+}
+
+void session_close(session_reader_t* const reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+
+    for (size_t i = 0; i < reader->string_count; i++) {
+        free(reader->strings[i]);
+    }
+
+    for (size_t i = 0; i < reader->content_count; i++) {
+        free(reader->contents[i]);
+    }
+
+    free(reader->strings);
+    free(reader->contents);
+    free(reader->states[0]);
+    free(reader->states[1]);
+    memset(reader, 0, sizeof(*reader));
+}
+
+session_event_t const* session_peek(session_reader_t* const reader) {
+    if (!reader->peeked) {
+        /* A session cut short, i.e. when the frontend crashed, ends at the last complete event */
+        if (reader->file == NULL || !get_event(reader, &reader->next)) {
+            return NULL;
+        }
+
+        reader->peeked = true;
+    }
+
+    return &reader->next;
+}
+
+bool session_next(session_reader_t* const reader, session_event_t* const event) {
+    if (session_peek(reader) == NULL) {
+        return false;
+    }
+
+    if (event != NULL) {
+        *event = reader->next;
+    }
+
+    reader->peeked = false;
+    return true;
+}
@@ -0,0 +1,143 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "libretro.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+A session is everything a core needs to run again exactly as it did with the
+frontend: the calls the frontend made, in order, and what the core got back
+from the input_state and environment callbacks while running them. Calls are
+recorded before going into the core, callbacks after they return, so the
+callbacks made by a call follow it in the file.
+
+Session files are this header followed by the events. Each event is a tag
+byte and its fields, with integers as LEB128 varints, strings as their
+length + 1 (0 for NULL) followed by the characters, and blobs as their size
+followed by the bytes.
+*/
+#define SESSION_MAGIC "LRPXSES1"
+#define SESSION_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+}
+session_header_t;
+
+typedef enum {
+    SESSION_END = 0,
+    SESSION_CALL,  /* id is the trace_id_t of the entry point */
+    SESSION_INPUT, /* args are port, device, index and id */
+    SESSION_ENV    /* id is the command */
+}
+session_event_type_t;
+
+/* What the frontend gave back to the core in an environment call, besides the result */
+typedef enum {
+    SESSION_ENV_RESULT,      /* nothing, i.e. the SET commands */
+    SESSION_ENV_VALUE,       /* a scalar written to data, up to 8 bytes */
+    SESSION_ENV_STRING,      /* a char const* written to data */
+    SESSION_ENV_VARIABLE,    /* the value of a retro_variable */
+    SESSION_ENV_UNSUPPORTED  /* interfaces and hardware rendering, can't be recorded */
+}
+session_env_kind_t;
+
+/* Load game calls with more content than this are recorded with only the first ones */
+#define SESSION_MAX_GAMES 8
+
+typedef struct {
+    session_event_type_t type;
+    unsigned id;
+
+    /*
+    retro_set_controller_port_device: port and device
+    retro_cheat_set: index and enabled
+    retro_load_game_special: game_type
+    retro_get_memory_data and retro_get_memory_size: id
+    retro_serialize: size
+    SESSION_INPUT: port, device, index and id
+    */
+    uint64_t args[4];
+
+    int16_t input;
+    bool result;
+
+    /* The cheat code, or the string given to the core by an environment call */
+    char const* string;
+
+    /* The state of retro_unserialize, or the scalar of an environment call */
+    void const* data;
+    size_t size;
+    uint8_t value[8];
+
+    /* Content of retro_load_game and retro_load_game_special, none when the core started without content */
+    struct retro_game_info games[SESSION_MAX_GAMES];
+    size_t game_count;
+}
+session_event_t;
+
+session_env_kind_t session_env_kind(unsigned cmd);
+
+/*
+Recording, used by the proxy. The file is created the first time, and later
+sessions, i.e. when the frontend deinitializes the core and initializes it
+again, are appended to it. Events are written with a single buffered write
+each so they don't interleave when callbacks come from other threads.
+*/
+bool session_start(char const* path);
+void session_stop(void);
+
+void session_call(trace_id_t id, uint64_t arg0, uint64_t arg1);
+void session_cheat(unsigned index, bool enabled, char const* code);
+void session_load_game(trace_id_t id, unsigned game_type, struct retro_game_info const* info, size_t num_info);
+void session_unserialize(void const* data, size_t size);
+void session_input(unsigned port, unsigned device, unsigned index, unsigned id, int16_t value);
+void session_env(unsigned cmd, void const* data, bool result);
+
+/* Replay, used by lrproxy-replay */
+typedef struct {
+    FILE* file;
+
+    session_event_t next;
+    bool peeked;
+
+    /* Two buffers so the state of an unserialize still being run survives a peek at the next one */
+    uint8_t* states[2];
+    size_t capacities[2];
+    unsigned current;
+
+    /* Strings are kept until the session is closed, the core may hold on to them */
+    char** strings;
+    size_t string_count;
+    size_t string_capacity;
+
+    void** contents;
+    size_t content_count;
+    size_t content_capacity;
+}
+session_reader_t;
+
+bool session_open(session_reader_t* reader, char const* path);
+void session_close(session_reader_t* reader);
+
+/* Decodes the next event without consuming it, returns NULL at the end of the session */
+session_event_t const* session_peek(session_reader_t* reader);
+
+/* Consumes the next event and copies it to event if it's not NULL, returns false at the end of the session */
+bool session_next(session_reader_t* reader, session_event_t* event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SESSION_H */
@@ -0,0 +1,346 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "statediff.h"
+#include "trace.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STATEDIFF_X86
+#include <immintrin.h>
+#endif
+
+#define TAG "[LRPROXY] "
+
+/* States are compared in chunks of this many bytes, which is also the resolution of the hot regions */
+#define CHUNK 64
+
+/* Regions that changed in at least this percentage of the frames are listed in the report */
+#define HOT_PERCENT 10.0
+#define MAX_HOT 8
+
+/* Bit i is set when byte i of the chunk changed */
+typedef uint64_t (*chunk_diff_t)(uint8_t const* a, uint8_t const* b);
+
+static chunk_diff_t s_diff;
+static char const* s_kernel;
+
+static uint8_t* s_buffers[2];
+static size_t s_capacities[2];
+static unsigned s_current;
+static size_t s_size;
+static bool s_has_previous;
+static uint64_t s_t0;
+
+/* How many frames each chunk changed in */
+static uint32_t* s_chunks;
+static size_t s_chunk_count;
+
+static uint64_t s_frames;
+static uint64_t s_changed_total;
+static histogram_t s_changed;
+static histogram_t s_ranges;
+static histogram_t s_deltas;
+static histogram_t s_times;
+
+static uint64_t diff_scalar(uint8_t const* const a, uint8_t const* const b) {
+    uint64_t mask = 0;
+
+    for (unsigned i = 0; i < CHUNK; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+
+        if (x == y) {
+            continue;
+        }
+
+        for (unsigned j = 0; j < sizeof(uint64_t); j++) {
+            mask |= (uint64_t)(a[i + j] != b[i + j]) << (i + j);
+        }
+    }
+
+    return mask;
+}
+
+#ifdef STATEDIFF_X86
+__attribute__((target("sse2"))) static uint64_t diff_sse2(uint8_t const* const a, uint8_t const* const b) {
+    uint64_t equal = 0;
+
+    for (unsigned i = 0; i < CHUNK; i += 16) {
+        __m128i const x = _mm_loadu_si128((__m128i const*)(a + i));
+        __m128i const y = _mm_loadu_si128((__m128i const*)(b + i));
+        equal |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) << i;
+    }
+
+    return ~equal;
+}
+
+__attribute__((target("avx2"))) static uint64_t diff_avx2(uint8_t const* const a, uint8_t const* const b) {
+    __m256i const x0 = _mm256_loadu_si256((__m256i const*)a);
+    __m256i const y0 = _mm256_loadu_si256((__m256i const*)b);
+    __m256i const x1 = _mm256_loadu_si256((__m256i const*)(a + 32));
+    __m256i const y1 = _mm256_loadu_si256((__m256i const*)(b + 32));
+
+    uint64_t const low = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, y0));
+    uint64_t const high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x1, y1));
+    return ~(low | high << 32);
+}
+#endif
+
+static void count(uint64_t const mask, uint64_t* const changed, uint64_t* const ranges, uint64_t* const carry) {
+    *changed += (uint64_t)__builtin_popcountll(mask);
+
+    /* A range starts at every changed byte whose previous byte didn't change */
+    *ranges += (uint64_t)__builtin_popcountll(mask & ~(mask << 1 | *carry));
+    *carry = mask >> 63;
+}
+
+bool statediff_start(void) {
+    s_diff = diff_scalar;
+    s_kernel = "scalar";
+
+#ifdef STATEDIFF_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        s_diff = diff_avx2;
+        s_kernel = "AVX2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        s_diff = diff_sse2;
+        s_kernel = "SSE2";
+    }
+#endif
+
+    s_buffers[0] = s_buffers[1] = NULL;
+    s_capacities[0] = s_capacities[1] = 0;
+    s_current = 0;
+    s_size = 0;
+    s_has_previous = false;
+
+    s_chunks = NULL;
+    s_chunk_count = 0;
+
+    s_frames = 0;
+    s_changed_total = 0;
+    histogram_reset(&s_changed);
+    histogram_reset(&s_ranges);
+    histogram_reset(&s_deltas);
+    histogram_reset(&s_times);
+    return true;
+}
+
+void* statediff_buffer(size_t const size) {
+    s_t0 = trace_now();
+
+    if (size > s_capacities[s_current]) {
+        void* const buffer = realloc(s_buffers[s_current], size);
+
+        if (buffer == NULL) {
+            return NULL;
+        }
+
+        s_buffers[s_current] = (uint8_t*)buffer;
+        s_capacities[s_current] = size;
+    }
+
+    return s_buffers[s_current];
+}
+
+void statediff_add(size_t const size) {
+    if (size != s_size) {
+        /* A different state, start over */
+        uint32_t* const chunks = (uint32_t*)calloc((size + CHUNK - 1) / CHUNK, sizeof(uint32_t));
+
+        if (chunks == NULL) {
+            return;
+        }
+
+        free(s_chunks);
+        s_chunks = chunks;
+        s_chunk_count = (size + CHUNK - 1) / CHUNK;
+        s_size = size;
+        s_has_previous = false;
+        s_frames = 0;
+        s_changed_total = 0;
+        histogram_reset(&s_changed);
+        histogram_reset(&s_ranges);
+        histogram_reset(&s_deltas);
+    }
+
+    if (s_has_previous) {
+        uint8_t const* const a = s_buffers[s_current];
+        uint8_t const* const b = s_buffers[s_current ^ 1];
+        uint64_t changed = 0, ranges = 0, carry = 0;
+        size_t const whole = size / CHUNK * CHUNK;
+
+        for (size_t i = 0; i < whole; i += CHUNK) {
+            uint64_t const mask = s_diff(a + i, b + i);
+
+            if (mask != 0) {
+                s_chunks[i / CHUNK]++;
+                count(mask, &changed, &ranges, &carry);
+            }
+            else {
+                carry = 0;
+            }
+        }
+
+        if (whole != size) {
+            uint64_t mask = 0;
+
+            for (size_t i = whole; i < size; i++) {
+                mask |= (uint64_t)(a[i] != b[i]) << (i - whole);
+            }
+
+            if (mask != 0) {
+                s_chunks[whole / CHUNK]++;
+                count(mask, &changed, &ranges, &carry);
+            }
+        }
+
+        /* What a delta with the runs of unchanged bytes taken out would take, two bytes per range for the run lengths */
+        histogram_add(&s_changed, changed);
+        histogram_add(&s_ranges, ranges);
+        histogram_add(&s_deltas, changed + ranges * 2);
+        s_changed_total += changed;
+        s_frames++;
+    }
+
+    s_has_previous = true;
+    s_current ^= 1;
+    histogram_add(&s_times, trace_now() - s_t0);
+}
+
+static void print_row(char const* const name, histogram_t const* const hist) {
+    fprintf(
+        stderr,
+        TAG "  %-30s %12.1f %12llu %12llu %12llu\n",
+        name,
+        (double)hist->total / (double)hist->count,
+        (unsigned long long)histogram_percentile(hist, 50.0),
+        (unsigned long long)histogram_percentile(hist, 99.0),
+        (unsigned long long)hist->max
+    );
+}
+
+static void print_hot(void) {
+    /* Rounded up without libm, a chunk that changed in exactly HOT_PERCENT of the frames is shown */
+    double const exact = (double)s_frames * HOT_PERCENT / 100.0;
+    uint32_t threshold = (uint32_t)exact;
+
+    if ((double)threshold < exact || threshold == 0) {
+        threshold++;
+    }
+
+    size_t shown = 0;
+
+    fprintf(stderr, TAG "Regions that changed in at least %.0f%% of the frames:\n", HOT_PERCENT);
+
+    for (size_t i = 0; i < s_chunk_count && shown < MAX_HOT;) {
+        if (s_chunks[i] < threshold) {
+            i++;
+            continue;
+        }
+
+        size_t const first = i;
+        uint32_t most = 0;
+
+        for (; i < s_chunk_count && s_chunks[i] >= threshold; i++) {
+            most = s_chunks[i] > most ? s_chunks[i] : most;
+        }
+
+        size_t const end = i * CHUNK < s_size ? i * CHUNK : s_size;
+
+        fprintf(
+            stderr,
+            TAG "  0x%08zx-0x%08zx %10zu bytes, in up to %.1f%% of the frames\n",
+            first * CHUNK,
+            end - 1,
+            end - first * CHUNK,
+            most * 100.0 / (double)s_frames
+        );
+
+        shown++;
+    }
+
+    if (shown == 0) {
+        fprintf(stderr, TAG "  none\n");
+    }
+}
+
+void statediff_stop(void) {
+    if (s_frames != 0) {
+        fprintf(stderr, TAG "State diff (%s): %llu frames, state of %zu bytes\n", s_kernel, (unsigned long long)s_frames, s_size);
+        fprintf(stderr, TAG "%-32s %12s %12s %12s %12s\n", "per frame", "mean", "p50", "p99", "max");
+        print_row("changed bytes", &s_changed);
+        print_row("changed ranges", &s_ranges);
+        print_row("delta bytes", &s_deltas);
+
+        fprintf(
+            stderr,
+            TAG "%.3f%% of the state changes per frame, deltas would be %.3f%% of it\n",
+            (double)s_changed_total * 100.0 / (double)s_frames / (double)s_size,
+            (double)s_deltas.total * 100.0 / (double)s_frames / (double)s_size
+        );
+
+        /* How much of the state is in chunks that never, rarely, sometimes, and often change */
+        size_t bytes[4] = {0, 0, 0, 0};
+
+        for (size_t i = 0; i < s_chunk_count; i++) {
+            double const percent = s_chunks[i] * 100.0 / (double)s_frames;
+            size_t const size = i == s_chunk_count - 1 ? s_size - i * CHUNK : CHUNK;
+            bytes[s_chunks[i] == 0 ? 0 : percent < 1.0 ? 1 : percent <= 50.0 ? 2 : 3] += size;
+        }
+
+        fprintf(
+            stderr,
+            TAG "%.2f%% of the state never changed, %.2f%% changed in less than 1%% of the frames, %.2f%% in up to half of them, %.2f%% in more\n",
+            bytes[0] * 100.0 / (double)s_size,
+            bytes[1] * 100.0 / (double)s_size,
+            bytes[2] * 100.0 / (double)s_size,
+            bytes[3] * 100.0 / (double)s_size
+        );
+
+        print_hot();
+
+        fprintf(
+            stderr,
+            TAG "Saving and comparing the state took %.2f us mean, %.2f us p99 per frame\n",
+            (double)s_times.total / (double)s_times.count / 1000.0,
+            histogram_percentile(&s_times, 99.0) / 1000.0
+        );
+    }
+
+    free(s_buffers[0]);
+    free(s_buffers[1]);
+    free(s_chunks);
+    s_buffers[0] = s_buffers[1] = NULL;
+    s_chunks = NULL;
+}
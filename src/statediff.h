@@ -0,0 +1,34 @@
+#ifndef STATEDIFF_H
+#define STATEDIFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Compares the state of the core after each frame with the one after the
+previous frame, to know how much of it changes, in how many ranges, and
+where, before choosing the rewind and run-ahead settings. States are saved
+in two buffers used in turns so they're never copied, and compared 64 bytes
+at a time with AVX2 or SSE2 when the CPU has them.
+*/
+bool statediff_start(void);
+
+/* Prints the report and frees the memory */
+void statediff_stop(void);
+
+/* Returns the buffer where the state of this frame must be saved, or NULL if there's no memory for it */
+void* statediff_buffer(size_t size);
+
+/* Compares the state saved in the buffer with the previous one */
+void statediff_add(size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATEDIFF_H */
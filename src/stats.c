@@ -0,0 +1,316 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "stats.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#define TAG "[LRPROXY] "
+
+#define STATS_FIRST TRACE_RETRO_INIT
+#define STATS_COUNT (TRACE_RETRO_GET_MEMORY_SIZE - TRACE_RETRO_INIT + 1)
+
+static char const* const s_names[STATS_COUNT] = {
+    "retro_init",
+    "retro_deinit",
+    "retro_api_version",
+    "retro_get_system_info",
+    "retro_get_system_av_info",
+    "retro_set_environment",
+    "retro_set_video_refresh",
+    "retro_set_audio_sample",
+    "retro_set_audio_sample_batch",
+    "retro_set_input_poll",
+    "retro_set_input_state",
+    "retro_set_controller_port_device",
+    "retro_reset",
+    "retro_run",
+    "retro_serialize_size",
+    "retro_serialize",
+    "retro_unserialize",
+    "retro_cheat_reset",
+    "retro_cheat_set",
+    "retro_load_game",
+    "retro_load_game_special",
+    "retro_unload_game",
+    "retro_get_region",
+    "retro_get_memory_data",
+    "retro_get_memory_size"
+};
+
+static histogram_t s_histograms[STATS_COUNT];
+
+/* Frame time split between the core and the frontend callbacks */
+typedef enum {
+    FRAME_TOTAL,
+    FRAME_CORE,
+    FRAME_VIDEO,
+    FRAME_AUDIO,
+    FRAME_INPUT,
+    FRAME_RUN_AHEAD,
+    FRAME_REWIND,
+    FRAME_CHECKPOINT,
+
+    FRAME_COUNT
+}
+frame_part_t;
+
+static char const* const s_frame_names[FRAME_COUNT] = {
+    "frame",
+    "  core",
+    "  video_refresh",
+    "  audio_sample(_batch)",
+    "  input_poll/input_state",
+    "  run-ahead",
+    "  rewind",
+    "  checkpoint"
+};
+
+static histogram_t s_frames[FRAME_COUNT];
+
+/* Performance counters added over all frames, and the range of IPC seen in a single frame */
+static uint64_t s_counters[PERF_COUNT];
+static unsigned s_counters_available;
+static uint64_t s_counted_frames;
+static double s_ipc_min;
+static double s_ipc_max;
+static uint64_t s_budget;
+static uint64_t s_over_budget;
+static volatile sig_atomic_t s_requested;
+
+#ifndef _WIN32
+static struct sigaction s_old_action;
+static bool s_installed;
+
+static void request(int const signum) {
+    (void)signum;
+    s_requested = 1;
+}
+#endif
+
+void stats_start(void) {
+    for (unsigned i = 0; i < STATS_COUNT; i++) {
+        histogram_reset(&s_histograms[i]);
+    }
+
+    for (unsigned i = 0; i < FRAME_COUNT; i++) {
+        histogram_reset(&s_frames[i]);
+    }
+
+    s_over_budget = 0;
+
+    memset(s_counters, 0, sizeof(s_counters));
+    s_counted_frames = 0;
+
+#ifndef _WIN32
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = request;
+    sa.sa_flags = SA_RESTART;
+    s_installed = sigaction(SIGUSR1, &sa, &s_old_action) == 0;
+#endif
+}
+
+void stats_stop(void) {
+#ifndef _WIN32
+    if (s_installed) {
+        sigaction(SIGUSR1, &s_old_action, NULL);
+        s_installed = false;
+    }
+#endif
+}
+
+void stats_add(trace_id_t const id, uint64_t const ns) {
+    histogram_add(&s_histograms[id - STATS_FIRST], ns);
+}
+
+void stats_set_fps(double const fps) {
+    s_budget = fps > 0.0 ? (uint64_t)(1000000000.0 / fps) : 0;
+}
+
+void stats_frame(stats_frame_t const* const frame) {
+    uint64_t const others = frame->video + frame->audio + frame->input + frame->run_ahead + frame->rewind + frame->checkpoint;
+
+    histogram_add(&s_frames[FRAME_TOTAL], frame->total);
+    histogram_add(&s_frames[FRAME_CORE], frame->total > others ? frame->total - others : 0);
+    histogram_add(&s_frames[FRAME_VIDEO], frame->video);
+    histogram_add(&s_frames[FRAME_AUDIO], frame->audio);
+    histogram_add(&s_frames[FRAME_INPUT], frame->input);
+    histogram_add(&s_frames[FRAME_RUN_AHEAD], frame->run_ahead);
+    histogram_add(&s_frames[FRAME_REWIND], frame->rewind);
+    histogram_add(&s_frames[FRAME_CHECKPOINT], frame->checkpoint);
+
+    s_over_budget += s_budget != 0 && frame->total > s_budget;
+}
+
+void stats_counters(perf_sample_t const* const before, perf_sample_t const* const after) {
+    for (unsigned i = 0; i < PERF_COUNT; i++) {
+        s_counters[i] += after->values[i] - before->values[i];
+    }
+
+    s_counters_available = after->available;
+
+    uint64_t const cycles = after->values[PERF_CYCLES] - before->values[PERF_CYCLES];
+    uint64_t const instructions = after->values[PERF_INSTRUCTIONS] - before->values[PERF_INSTRUCTIONS];
+
+    if (cycles != 0 && (after->available & (1U << PERF_INSTRUCTIONS)) != 0) {
+        double const ipc = (double)instructions / (double)cycles;
+
+        s_ipc_min = s_counted_frames == 0 || ipc < s_ipc_min ? ipc : s_ipc_min;
+        s_ipc_max = s_counted_frames == 0 || ipc > s_ipc_max ? ipc : s_ipc_max;
+    }
+
+    s_counted_frames++;
+}
+
+static void print_counters(void) {
+    fprintf(stderr, TAG "%-32s %16s %16s\n", "retro_run counters", "total", "per frame");
+
+    for (unsigned i = 0; i < PERF_COUNT; i++) {
+        if ((s_counters_available & (1U << i)) != 0) {
+            fprintf(
+                stderr,
+                TAG "  %-30s %16llu %16.1f\n",
+                perf_counter_name((perf_counter_t)i),
+                (unsigned long long)s_counters[i],
+                (double)s_counters[i] / (double)s_counted_frames
+            );
+        }
+    }
+
+    unsigned const ipc = (1U << PERF_CYCLES) | (1U << PERF_INSTRUCTIONS);
+
+    if ((s_counters_available & ipc) != ipc || s_counters[PERF_CYCLES] == 0 || s_counters[PERF_INSTRUCTIONS] == 0) {
+        return;
+    }
+
+    double const kinstructions = s_counters[PERF_INSTRUCTIONS] / 1000.0;
+
+    fprintf(
+        stderr,
+        TAG "IPC %.2f (%.2f to %.2f per frame)\n",
+        (double)s_counters[PERF_INSTRUCTIONS] / (double)s_counters[PERF_CYCLES],
+        s_ipc_min,
+        s_ipc_max
+    );
+
+    if ((s_counters_available & (1U << PERF_CACHE_MISSES)) != 0) {
+        fprintf(stderr, TAG "%.2f cache misses per 1000 instructions\n", s_counters[PERF_CACHE_MISSES] / kinstructions);
+    }
+
+    if ((s_counters_available & (1U << PERF_BRANCH_MISSES)) != 0) {
+        fprintf(stderr, TAG "%.2f branch misses per 1000 instructions\n", s_counters[PERF_BRANCH_MISSES] / kinstructions);
+    }
+}
+
+void stats_poll(void) {
+    if (s_requested) {
+        s_requested = 0;
+        stats_print();
+    }
+}
+
+void stats_print(void) {
+    fprintf(
+        stderr,
+        TAG "%-32s %10s %10s %10s %10s %10s %12s\n",
+        "entry point (us)", "calls", "p50", "p99", "p99.9", "max", "total"
+    );
+
+    for (unsigned i = 0; i < STATS_COUNT; i++) {
+        histogram_t const* const hist = &s_histograms[i];
+
+        if (hist->count == 0) {
+            continue;
+        }
+
+        fprintf(
+            stderr,
+            TAG "%-32s %10llu %10.2f %10.2f %10.2f %10.2f %12.2f\n",
+            s_names[i],
+            (unsigned long long)hist->count,
+            histogram_percentile(hist, 50.0) / 1000.0,
+            histogram_percentile(hist, 99.0) / 1000.0,
+            histogram_percentile(hist, 99.9) / 1000.0,
+            hist->max / 1000.0,
+            hist->total / 1000.0
+        );
+    }
+
+    histogram_t const* const frames = &s_frames[FRAME_TOTAL];
+
+    if (frames->count == 0) {
+        return;
+    }
+
+    /* Mean time of each part as a percentage of the budget */
+    fprintf(
+        stderr,
+        TAG "%-32s %10s %10s %10s %10s %10s %12s\n",
+        "retro_run breakdown (us)", "mean", "p50", "p99", "p99.9", "max", "% budget"
+    );
+
+    for (unsigned i = 0; i < FRAME_COUNT; i++) {
+        histogram_t const* const hist = &s_frames[i];
+
+        /* Parts that are only there when their features are enabled */
+        if (i >= FRAME_RUN_AHEAD && hist->max == 0) {
+            continue;
+        }
+
+        double const mean = (double)hist->total / (double)hist->count;
+
+        fprintf(
+            stderr,
+            TAG "%-32s %10.2f %10.2f %10.2f %10.2f %10.2f %12.1f\n",
+            s_frame_names[i],
+            mean / 1000.0,
+            histogram_percentile(hist, 50.0) / 1000.0,
+            histogram_percentile(hist, 99.0) / 1000.0,
+            histogram_percentile(hist, 99.9) / 1000.0,
+            hist->max / 1000.0,
+            s_budget != 0 ? mean * 100.0 / (double)s_budget : 0.0
+        );
+    }
+
+    if (s_budget != 0) {
+        fprintf(
+            stderr,
+            TAG "Frame budget %.2f us, %llu of %llu frames over budget (%.2f%%)\n",
+            s_budget / 1000.0,
+            (unsigned long long)s_over_budget,
+            (unsigned long long)frames->count,
+            s_over_budget * 100.0 / (double)frames->count
+        );
+    }
+
+    if (s_counted_frames != 0) {
+        print_counters();
+    }
+}
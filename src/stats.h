@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "trace.h"
+#include "perf.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Clears the histograms and makes SIGUSR1 request a report */
+void stats_start(void);
+
+/* Puts back the SIGUSR1 handler that was there before stats_start */
+void stats_stop(void);
+
+/* Adds the time spent in the core by one call to the entry point's histogram */
+void stats_add(trace_id_t id, uint64_t ns);
+
+/* Sets the frame budget to 1 / fps, from retro_get_system_av_info or RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO */
+void stats_set_fps(double fps);
+
+/* Where the time of one retro_run went, the core's own time is what's left after the callbacks and the proxy's own work */
+typedef struct {
+    uint64_t total;
+    uint64_t video;
+    uint64_t audio;
+    uint64_t input;
+    uint64_t run_ahead;  /* the frames run ahead, with their callbacks, and saving and loading the state around them */
+    uint64_t rewind;     /* saving the state for rewind */
+    uint64_t checkpoint; /* saving the state for the checkpoint writer */
+}
+stats_frame_t;
+
+void stats_frame(stats_frame_t const* frame);
+
+/* Adds the counters of one retro_run, the difference between the two samples */
+void stats_counters(perf_sample_t const* before, perf_sample_t const* after);
+
+/* Prints the report if it was requested with SIGUSR1, called once per frame */
+void stats_poll(void);
+
+/* Prints the percentiles of all entry points that were called to stderr */
+void stats_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H */
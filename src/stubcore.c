@@ -0,0 +1,233 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+A synthetic core to measure the proxy with. It exports all the entry points
+and its behavior is set with environment variables read in retro_init:
+
+STUBCORE_WORK   iterations of a busy loop per frame, defaults to 0
+STUBCORE_INPUTS input_state calls per frame, defaults to 0
+STUBCORE_AUDIO  audio frames sent in a single batch per frame, defaults to 0
+STUBCORE_STATE  size of the savestate, and of the system RAM, in bytes, defaults to 4096
+
+The savestate starts with the frame number and the value of the generator,
+so loading a state takes the stub back to that frame like a real core, and
+each frame only shows the pixel it wrote.
+*/
+
+#include "libretro.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STUB_WIDTH 320
+#define STUB_HEIGHT 240
+#define STUB_STATE_MIN (sizeof(uint64_t) + sizeof(uint32_t))
+
+static retro_environment_t s_env;
+static retro_video_refresh_t s_video_refresh;
+static retro_audio_sample_batch_t s_audio_sample_batch;
+static retro_input_poll_t s_input_poll;
+static retro_input_state_t s_input_state;
+
+static unsigned long s_work;
+static unsigned long s_inputs;
+static unsigned long s_audio;
+static size_t s_state_size;
+
+static uint8_t* s_state;
+static int16_t* s_samples;
+static uint16_t s_framebuffer[STUB_WIDTH * STUB_HEIGHT];
+static uint64_t s_frame;
+
+static unsigned long getenv_ulong(char const* const name, unsigned long const def) {
+    char const* const value = getenv(name);
+    return value != NULL && *value != 0 ? strtoul(value, NULL, 0) : def;
+}
+
+void retro_init(void) {
+    s_work = getenv_ulong("STUBCORE_WORK", 0);
+    s_inputs = getenv_ulong("STUBCORE_INPUTS", 0);
+    s_audio = getenv_ulong("STUBCORE_AUDIO", 0);
+    s_state_size = getenv_ulong("STUBCORE_STATE", 4096);
+    s_state_size = s_state_size > STUB_STATE_MIN ? s_state_size : STUB_STATE_MIN;
+
+    s_state = (uint8_t*)calloc(s_state_size, 1);
+    s_samples = (int16_t*)calloc(s_audio != 0 ? s_audio * 2 : 1, sizeof(int16_t));
+    s_frame = 0;
+}
+
+void retro_deinit(void) {
+    free(s_state);
+    free(s_samples);
+    s_state = NULL;
+    s_samples = NULL;
+}
+
+unsigned retro_api_version(void) {
+    return RETRO_API_VERSION;
+}
+
+void retro_get_system_info(struct retro_system_info* info) {
+    memset(info, 0, sizeof(*info));
+    info->library_name = "stub";
+    info->library_version = "1.0";
+    info->valid_extensions = "";
+}
+
+void retro_get_system_av_info(struct retro_system_av_info* info) {
+    memset(info, 0, sizeof(*info));
+    info->geometry.base_width = info->geometry.max_width = STUB_WIDTH;
+    info->geometry.base_height = info->geometry.max_height = STUB_HEIGHT;
+    info->geometry.aspect_ratio = 4.0f / 3.0f;
+    info->timing.fps = 60.0;
+    info->timing.sample_rate = 44100.0;
+}
+
+void retro_set_environment(retro_environment_t cb) {
+    bool no_game = true;
+
+    s_env = cb;
+    s_env(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &no_game);
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb) {
+    s_video_refresh = cb;
+}
+
+void retro_set_audio_sample(retro_audio_sample_t cb) {
+    (void)cb;
+}
+
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) {
+    s_audio_sample_batch = cb;
+}
+
+void retro_set_input_poll(retro_input_poll_t cb) {
+    s_input_poll = cb;
+}
+
+void retro_set_input_state(retro_input_state_t cb) {
+    s_input_state = cb;
+}
+
+void retro_set_controller_port_device(unsigned port, unsigned device) {
+    (void)port;
+    (void)device;
+}
+
+void retro_reset(void) {
+    s_frame = 0;
+    memset(s_state, 0, s_state_size);
+}
+
+void retro_run(void) {
+    s_input_poll();
+
+    unsigned buttons = 0;
+
+    for (unsigned long i = 0; i < s_inputs; i++) {
+        buttons += (unsigned)s_input_state(0, RETRO_DEVICE_JOYPAD, 0, (unsigned)(i % 16));
+    }
+
+    /* A linear congruential generator the compiler can't remove */
+    uint32_t x = (uint32_t)s_frame + buttons;
+
+    for (unsigned long i = 0; i < s_work; i++) {
+        x = x * 1664525U + 1013904223U;
+    }
+
+    size_t const pixel = s_frame % (STUB_WIDTH * STUB_HEIGHT);
+    s_framebuffer[pixel] = (uint16_t)x;
+    s_video_refresh(s_framebuffer, STUB_WIDTH, STUB_HEIGHT, STUB_WIDTH * sizeof(uint16_t));
+    s_framebuffer[pixel] = 0;
+
+    if (s_audio != 0) {
+        s_audio_sample_batch(s_samples, s_audio);
+    }
+
+    s_frame++;
+    memcpy(s_state, &s_frame, sizeof(s_frame));
+    memcpy(s_state + sizeof(s_frame), &x, sizeof(x));
+}
+
+size_t retro_serialize_size(void) {
+    return s_state_size;
+}
+
+bool retro_serialize(void* data, size_t size) {
+    if (size < s_state_size) {
+        return false;
+    }
+
+    memcpy(data, s_state, s_state_size);
+    return true;
+}
+
+bool retro_unserialize(void const* data, size_t size) {
+    if (size < s_state_size) {
+        return false;
+    }
+
+    memcpy(s_state, data, s_state_size);
+    memcpy(&s_frame, s_state, sizeof(s_frame));
+    return true;
+}
+
+void retro_cheat_reset(void) {}
+
+void retro_cheat_set(unsigned index, bool enabled, char const* code) {
+    (void)index;
+    (void)enabled;
+    (void)code;
+}
+
+bool retro_load_game(struct retro_game_info const* game) {
+    (void)game;
+
+    enum retro_pixel_format format = RETRO_PIXEL_FORMAT_RGB565;
+    return s_env(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+}
+
+bool retro_load_game_special(unsigned game_type, struct retro_game_info const* info, size_t num_info) {
+    (void)game_type;
+    (void)info;
+    (void)num_info;
+    return false;
+}
+
+void retro_unload_game(void) {}
+
+unsigned retro_get_region(void) {
+    return RETRO_REGION_NTSC;
+}
+
+void* retro_get_memory_data(unsigned id) {
+    return id == RETRO_MEMORY_SYSTEM_RAM ? s_state : NULL;
+}
+
+size_t retro_get_memory_size(unsigned id) {
+    return id == RETRO_MEMORY_SYSTEM_RAM ? s_state_size : 0;
+}
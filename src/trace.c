@@ -0,0 +1,557 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "trace.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TAG "[LRPROXY] "
+
+/*
+Records are written by whatever thread calls into the proxy and read by a
+single writer thread. Producers reserve a run of consecutive slots with a CAS
+on s_head, fill them, and publish each one by storing its position + 1 in
+s_seq. The writer only advances s_tail over published slots, so a record is
+never read half-written and a string and its TRACE_TEXT continuations are
+always contiguous. The writer dumps the records as-is to the trace file,
+formatting them is left to lrproxy-dump. When the ring is full the event is
+dropped and counted instead of blocking the emulation thread.
+*/
+
+#define TRACE_CAPACITY 65536 /* must be a power of two */
+#define TRACE_MASK (TRACE_CAPACITY - 1)
+#define TRACE_IDLE_NS 1000000
+#define TRACE_DEFAULT_PATH "lrproxy.trace"
+
+static trace_record_t s_ring[TRACE_CAPACITY];
+static _Atomic uint64_t s_seq[TRACE_CAPACITY];
+static _Atomic uint64_t s_head;
+static _Atomic uint64_t s_tail;
+static _Atomic uint64_t s_dropped;
+
+/*
+When only slow frames are wanted, the writer keeps the records in s_history
+instead of writing them. s_frame_start has the position in s_history where
+each of the last s_window frames started, and when a TRACE_RETRO_RUN record
+flagged with TRACE_RUN_SLOW arrives the frames in the window are written out
+and the history starts over.
+*/
+#define TRACE_HISTORY 65536 /* must be a power of two */
+#define TRACE_HISTORY_MASK (TRACE_HISTORY - 1)
+
+static unsigned s_window;
+static trace_record_t s_history[TRACE_HISTORY];
+static uint64_t s_history_head;
+static uint64_t s_frame_start[TRACE_MAX_WINDOW];
+static uint64_t s_frame;
+
+/* Crash dumps are written from the signal handler to a file opened beforehand */
+#define TRACE_CRASH_STACK 65536
+#define TRACE_CRASH_SIGNALS 3
+
+static int const s_crash_signals[TRACE_CRASH_SIGNALS] = {SIGSEGV, SIGABRT, SIGBUS};
+static struct sigaction s_crash_old_actions[TRACE_CRASH_SIGNALS];
+static stack_t s_crash_old_stack;
+static int s_crash_fd = -1;
+static unsigned s_crash_records;
+static volatile sig_atomic_t s_crashed;
+
+static FILE* s_file;
+static bool s_truncated;
+static pthread_t s_writer;
+static atomic_bool s_running;
+static bool s_started;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned text_records(uint16_t const length) {
+    return length == TRACE_NULL_STRING ? 0 : (length + TRACE_TEXT_SIZE - 1) / TRACE_TEXT_SIZE;
+}
+
+static uint16_t string_length(char const* const str) {
+    if (str == NULL) {
+        return TRACE_NULL_STRING;
+    }
+
+    size_t const length = strlen(str);
+    return length > TRACE_MAX_STRING ? TRACE_MAX_STRING : (uint16_t)length;
+}
+
+static void push(trace_record_t* const rec, char const* const str) {
+    unsigned const count = 1 + text_records(rec->length);
+    uint64_t head = atomic_load_explicit(&s_head, memory_order_relaxed);
+
+    do {
+        uint64_t const tail = atomic_load_explicit(&s_tail, memory_order_acquire);
+
+        if (head + count - tail > TRACE_CAPACITY) {
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
+    while (!atomic_compare_exchange_weak_explicit(&s_head, &head, head + count, memory_order_acq_rel, memory_order_relaxed));
+
+    s_ring[head & TRACE_MASK] = *rec;
+    atomic_store_explicit(&s_seq[head & TRACE_MASK], head + 1, memory_order_release);
+
+    size_t offset = 0;
+
+    for (unsigned i = 1; i < count; i++) {
+        uint64_t const pos = head + i;
+        trace_record_t* const text = &s_ring[pos & TRACE_MASK];
+        size_t const chunk = rec->length - offset < TRACE_TEXT_SIZE ? rec->length - offset : TRACE_TEXT_SIZE;
+
+        text->id = TRACE_TEXT;
+        text->kind = 0;
+        text->length = (uint16_t)chunk;
+        text->aux = i - 1;
+        memcpy(text->u.text, str + offset, chunk);
+        offset += chunk;
+
+        atomic_store_explicit(&s_seq[pos & TRACE_MASK], pos + 1, memory_order_release);
+    }
+}
+
+void trace_call(trace_id_t const id, uint64_t const arg0, uint64_t const arg1, uint64_t const arg2, uint64_t const result) {
+    trace_record_t rec;
+
+    rec.id = id;
+    rec.kind = 0;
+    rec.length = 0;
+    rec.aux = 0;
+    rec.u.call.time = trace_now();
+    rec.u.call.args[0] = arg0;
+    rec.u.call.args[1] = arg1;
+    rec.u.call.args[2] = arg2;
+    rec.u.call.args[3] = 0;
+    rec.u.call.result = result;
+
+    push(&rec, NULL);
+}
+
+void trace_run(uint64_t const duration, bool const slow) {
+    trace_record_t rec;
+
+    rec.id = TRACE_RETRO_RUN;
+    rec.kind = 0;
+    rec.length = 0;
+    rec.aux = slow ? TRACE_RUN_SLOW : 0;
+    rec.u.call.time = trace_now();
+    rec.u.call.args[0] = duration;
+    rec.u.call.args[1] = 0;
+    rec.u.call.args[2] = 0;
+    rec.u.call.args[3] = 0;
+    rec.u.call.result = 0;
+
+    push(&rec, NULL);
+}
+
+void trace_call_string(trace_id_t const id, uint64_t const arg0, uint64_t const arg1, char const* const str) {
+    trace_record_t rec;
+
+    rec.id = id;
+    rec.kind = 0;
+    rec.length = string_length(str);
+    rec.aux = 0;
+    rec.u.call.time = trace_now();
+    rec.u.call.args[0] = arg0;
+    rec.u.call.args[1] = arg1;
+    rec.u.call.args[2] = 0;
+    rec.u.call.args[3] = 0;
+    rec.u.call.result = 0;
+
+    push(&rec, str);
+}
+
+void trace_env(unsigned const cmd, void const* const data, uint64_t const value, bool const result) {
+    trace_record_t rec;
+
+    rec.id = TRACE_ENVIRONMENT;
+    rec.kind = 0;
+    rec.length = 0;
+    rec.aux = cmd;
+    rec.u.call.time = trace_now();
+    rec.u.call.args[0] = TRACE_PTR(data);
+    rec.u.call.args[1] = value;
+    rec.u.call.args[2] = 0;
+    rec.u.call.args[3] = 0;
+    rec.u.call.result = result;
+
+    push(&rec, NULL);
+}
+
+void trace_env_string(unsigned const cmd, void const* const data, char const* const str, bool const result) {
+    trace_record_t rec;
+
+    rec.id = TRACE_ENVIRONMENT;
+    rec.kind = 0;
+    rec.length = string_length(str);
+    rec.aux = cmd;
+    rec.u.call.time = trace_now();
+    rec.u.call.args[0] = TRACE_PTR(data);
+    rec.u.call.args[1] = TRACE_PTR(str);
+    rec.u.call.args[2] = 0;
+    rec.u.call.args[3] = 0;
+    rec.u.call.result = result;
+
+    push(&rec, str);
+}
+
+static void init_field(trace_record_t* const rec, char const* const name, unsigned const index, trace_kind_t const kind) {
+    rec->id = TRACE_FIELD;
+    rec->kind = kind;
+    rec->length = 0;
+    rec->aux = index;
+    rec->u.field.time = trace_now();
+
+    /* Names are padded for alignment and not necessarily nul-terminated */
+    size_t const length = strlen(name);
+    memset(rec->u.field.name, 0, sizeof(rec->u.field.name));
+    memcpy(rec->u.field.name, name, length < sizeof(rec->u.field.name) ? length : sizeof(rec->u.field.name));
+
+    rec->u.field.value = 0;
+    rec->u.field.extra = 0;
+}
+
+void trace_field(char const* const name, unsigned const index, trace_kind_t const kind, uint64_t const value, uint64_t const extra) {
+    trace_record_t rec;
+
+    init_field(&rec, name, index, kind);
+    rec.u.field.value = value;
+    rec.u.field.extra = extra;
+
+    push(&rec, NULL);
+}
+
+void trace_field_string(char const* const name, unsigned const index, char const* const str) {
+    trace_record_t rec;
+
+    init_field(&rec, name, index, TRACE_KIND_STRING);
+    rec.length = string_length(str);
+    rec.u.field.value = TRACE_PTR(str);
+
+    push(&rec, str);
+}
+
+void trace_field_double(char const* const name, unsigned const index, double const value) {
+    trace_record_t rec;
+
+    init_field(&rec, name, index, TRACE_KIND_DOUBLE);
+    memcpy(&rec.u.field.value, &value, sizeof(value));
+
+    push(&rec, NULL);
+}
+
+static void history_reset(void) {
+    s_frame = 0;
+    s_frame_start[0] = s_history_head;
+}
+
+static void history_add(FILE* const file, trace_record_t const* const rec) {
+    s_history[s_history_head++ & TRACE_HISTORY_MASK] = *rec;
+
+    if (rec->id != TRACE_RETRO_RUN) {
+        return;
+    }
+
+    uint64_t const frame = s_frame++;
+
+    if ((rec->aux & TRACE_RUN_SLOW) == 0) {
+        s_frame_start[s_frame % s_window] = s_history_head;
+        return;
+    }
+
+    /* Write the slow frame and the ones before it still in the history */
+    uint64_t start = frame + 1 >= s_window ? s_frame_start[(frame + 1 - s_window) % s_window] : s_frame_start[0];
+
+    if (s_history_head - start > TRACE_HISTORY) {
+        start = s_history_head - TRACE_HISTORY;
+    }
+
+    for (uint64_t pos = start; pos != s_history_head; pos++) {
+        fwrite(&s_history[pos & TRACE_HISTORY_MASK], sizeof(trace_record_t), 1, file);
+    }
+
+    history_reset();
+}
+
+static void output(FILE* const file, trace_record_t const* const rec) {
+    if (file == NULL) {
+        /* Records are only kept in the ring for a crash dump */
+        return;
+    }
+
+    if (s_window == 0) {
+        fwrite(rec, sizeof(*rec), 1, file);
+    }
+    else {
+        history_add(file, rec);
+    }
+}
+
+static size_t drain(FILE* const file, uint64_t* const reported) {
+    uint64_t tail = atomic_load_explicit(&s_tail, memory_order_relaxed);
+    size_t count = 0;
+
+    while (atomic_load_explicit(&s_seq[tail & TRACE_MASK], memory_order_acquire) == tail + 1) {
+        output(file, &s_ring[tail & TRACE_MASK]);
+        atomic_store_explicit(&s_tail, ++tail, memory_order_release);
+        count++;
+    }
+
+    uint64_t const dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+
+    if (dropped != *reported) {
+        trace_record_t rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.id = TRACE_DROPPED;
+        rec.u.call.time = trace_now();
+        rec.u.call.args[0] = dropped - *reported;
+
+        output(file, &rec);
+        *reported = dropped;
+        count++;
+    }
+
+    return count;
+}
+
+static void* writer(void* const arg) {
+    (void)arg;
+
+    uint64_t reported = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+
+    for (;;) {
+        if (drain(s_file, &reported) != 0) {
+            continue;
+        }
+
+        if (s_file != NULL) {
+            fflush(s_file);
+        }
+
+        if (!atomic_load_explicit(&s_running, memory_order_acquire)) {
+            break;
+        }
+
+        struct timespec const idle = {0, TRACE_IDLE_NS};
+        nanosleep(&idle, NULL);
+    }
+
+    return NULL;
+}
+
+void trace_start(unsigned const window) {
+    if (s_started) {
+        return;
+    }
+
+    s_window = window < TRACE_MAX_WINDOW ? window : TRACE_MAX_WINDOW;
+    history_reset();
+
+    char const* const path = config_string("trace", TRACE_DEFAULT_PATH);
+
+    if (*path == 0) {
+        s_file = NULL;
+    }
+    else {
+        /* Start a new file the first time, append to it when the core is reinitialized */
+        s_file = fopen(path, s_truncated ? "ab" : "wb");
+
+        if (s_file == NULL) {
+            fprintf(stderr, TAG "Couldn't open trace file \"%s\"\n", path);
+            return;
+        }
+    }
+
+    if (s_file != NULL && !s_truncated) {
+        trace_header_t header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(trace_record_t);
+
+        fwrite(&header, sizeof(header), 1, s_file);
+        s_truncated = true;
+    }
+
+    atomic_store_explicit(&s_running, true, memory_order_release);
+
+    if (pthread_create(&s_writer, NULL, writer, NULL) != 0) {
+        fprintf(stderr, TAG "Couldn't start the trace writer thread\n");
+
+        if (s_file != NULL) {
+            fclose(s_file);
+            s_file = NULL;
+        }
+
+        return;
+    }
+
+    s_started = true;
+}
+
+static void crash_restore(void);
+
+void trace_stop(void) {
+    crash_restore();
+
+    if (!s_started) {
+        return;
+    }
+
+    atomic_store_explicit(&s_running, false, memory_order_release);
+    pthread_join(s_writer, NULL);
+    s_started = false;
+
+    if (s_file != NULL) {
+        fclose(s_file);
+        s_file = NULL;
+    }
+}
+
+static void write_all(int const fd, void const* const data, size_t size) {
+    char const* ptr = (char const*)data;
+
+    while (size != 0) {
+        ssize_t const written = write(fd, ptr, size);
+
+        if (written <= 0) {
+            return;
+        }
+
+        ptr += written;
+        size -= (size_t)written;
+    }
+}
+
+/* Only async-signal-safe calls from here on */
+static void crash(int const signum, siginfo_t* const info, void* const context) {
+    (void)context;
+
+    if (!s_crashed) {
+        s_crashed = 1;
+
+        trace_header_t header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(trace_record_t);
+        write_all(s_crash_fd, &header, sizeof(header));
+
+        uint64_t const head = atomic_load_explicit(&s_head, memory_order_acquire);
+        uint64_t const count = head < s_crash_records ? head : s_crash_records;
+
+        /* Slots that were reserved but not filled yet have old sequence numbers and are skipped */
+        for (uint64_t pos = head - count; pos != head; pos++) {
+            if (atomic_load_explicit(&s_seq[pos & TRACE_MASK], memory_order_acquire) == pos + 1) {
+                write_all(s_crash_fd, &s_ring[pos & TRACE_MASK], sizeof(trace_record_t));
+            }
+        }
+
+        fsync(s_crash_fd);
+    }
+
+    /*
+    Hand the signal over to whatever was installed before us. A fault happens
+    again when the instruction is retried after we return, a signal sent with
+    kill, raise or abort has to be raised again.
+    */
+    for (int i = 0; i < TRACE_CRASH_SIGNALS; i++) {
+        if (s_crash_signals[i] == signum) {
+            sigaction(signum, &s_crash_old_actions[i], NULL);
+            break;
+        }
+    }
+
+    if (info->si_code <= 0) {
+        raise(signum);
+    }
+}
+
+static void crash_restore(void) {
+    if (s_crash_fd == -1) {
+        return;
+    }
+
+    for (int i = 0; i < TRACE_CRASH_SIGNALS; i++) {
+        sigaction(s_crash_signals[i], &s_crash_old_actions[i], NULL);
+    }
+
+    sigaltstack(&s_crash_old_stack, NULL);
+    close(s_crash_fd);
+    s_crash_fd = -1;
+}
+
+void trace_crash_dump(char const* const path, unsigned const records) {
+    if (s_crash_fd != -1) {
+        return;
+    }
+
+    s_crash_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (s_crash_fd == -1) {
+        fprintf(stderr, TAG "Couldn't open crash dump file \"%s\"\n", path);
+        return;
+    }
+
+    s_crash_records = records < TRACE_CAPACITY ? records : TRACE_CAPACITY;
+
+    /*
+    Run the handler on its own stack so it also works when the stack overflows.
+    The alternate stack is per thread and only the one calling this gets it,
+    a stack overflow in any other thread kills the process without a dump.
+    */
+    static char stack[TRACE_CRASH_STACK];
+    stack_t ss;
+    ss.ss_sp = stack;
+    ss.ss_size = sizeof(stack);
+    ss.ss_flags = 0;
+    sigaltstack(&ss, &s_crash_old_stack);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = crash;
+    sa.sa_flags = SA_SIGINFO | SA_RESETHAND | SA_ONSTACK;
+
+    for (int i = 0; i < TRACE_CRASH_SIGNALS; i++) {
+        sigaction(s_crash_signals[i], &sa, &s_crash_old_actions[i]);
+    }
+}
+
+/* The writer thread must be gone before the frontend unmaps the proxy */
+__attribute__((destructor)) static void trace_fini(void) {
+    trace_stop();
+}
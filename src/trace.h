@@ -0,0 +1,155 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Record ids, one per libretro entry point plus the auxiliary records */
+typedef enum {
+    TRACE_NONE = 0,
+
+    TRACE_RETRO_INIT,
+    TRACE_RETRO_DEINIT,
+    TRACE_RETRO_API_VERSION,
+    TRACE_RETRO_GET_SYSTEM_INFO,
+    TRACE_RETRO_GET_SYSTEM_AV_INFO,
+    TRACE_RETRO_SET_ENVIRONMENT,
+    TRACE_RETRO_SET_VIDEO_REFRESH,
+    TRACE_RETRO_SET_AUDIO_SAMPLE,
+    TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH,
+    TRACE_RETRO_SET_INPUT_POLL,
+    TRACE_RETRO_SET_INPUT_STATE,
+    TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE,
+    TRACE_RETRO_RESET,
+    TRACE_RETRO_RUN,
+    TRACE_RETRO_SERIALIZE_SIZE,
+    TRACE_RETRO_SERIALIZE,
+    TRACE_RETRO_UNSERIALIZE,
+    TRACE_RETRO_CHEAT_RESET,
+    TRACE_RETRO_CHEAT_SET,
+    TRACE_RETRO_LOAD_GAME,
+    TRACE_RETRO_LOAD_GAME_SPECIAL,
+    TRACE_RETRO_UNLOAD_GAME,
+    TRACE_RETRO_GET_REGION,
+    TRACE_RETRO_GET_MEMORY_DATA,
+    TRACE_RETRO_GET_MEMORY_SIZE,
+
+    TRACE_ENVIRONMENT, /* aux is the command, args[0] the data pointer, args[1] the dereferenced value */
+    TRACE_FIELD,       /* a member of the structure passed to the previous call */
+    TRACE_TEXT,        /* continuation carrying the characters of the string of the previous record */
+    TRACE_DROPPED,     /* args[0] records were lost because the ring was full */
+
+    TRACE_COUNT
+}
+trace_id_t;
+
+/* How the value of a TRACE_FIELD record is to be rendered */
+typedef enum {
+    TRACE_KIND_UINT,
+    TRACE_KIND_INT,
+    TRACE_KIND_INT64,
+    TRACE_KIND_SIZE,
+    TRACE_KIND_BOOL,
+    TRACE_KIND_PTR,
+    TRACE_KIND_DOUBLE,
+    TRACE_KIND_STRING,
+    TRACE_KIND_PIXEL_FORMAT,
+    TRACE_KIND_DEVICE,
+    TRACE_KIND_DEVICE_INDEX, /* extra is the device */
+    TRACE_KIND_DEVICE_ID,    /* extra is the device */
+    TRACE_KIND_HW_CONTEXT_TYPE,
+    TRACE_KIND_DEVICE_CAPABILITIES
+}
+trace_kind_t;
+
+#define TRACE_NO_INDEX 0xffffffffU
+#define TRACE_NULL_STRING 0xffffU
+#define TRACE_MAX_STRING 1024
+#define TRACE_TEXT_SIZE 56
+#define TRACE_NAME_SIZE 24
+
+/* TRACE_RETRO_RUN records have the duration of the frame in args[0] when known, and this bit in aux if it went over the budget */
+#define TRACE_RUN_SLOW 1U
+
+/* Maximum number of frames kept in memory when only slow frames are written */
+#define TRACE_MAX_WINDOW 256
+
+#define TRACE_PTR(p) ((uint64_t)(uintptr_t)(p))
+
+typedef struct {
+    uint8_t id;      /* trace_id_t */
+    uint8_t kind;    /* trace_kind_t for TRACE_FIELD */
+    uint16_t length; /* length of the string carried by the following TRACE_TEXT records */
+    uint32_t aux;    /* environment command, array index */
+
+    union {
+        struct {
+            uint64_t time; /* nanoseconds, CLOCK_MONOTONIC */
+            uint64_t args[4];
+            uint64_t result;
+        }
+        call;
+
+        struct {
+            uint64_t time;
+            char name[TRACE_NAME_SIZE];
+            uint64_t value;
+            uint64_t extra;
+        }
+        field;
+
+        char text[TRACE_TEXT_SIZE];
+    }
+    u;
+}
+trace_record_t;
+
+/* Trace files are this header followed by the raw records */
+#define TRACE_MAGIC "LRPXTRC1"
+#define TRACE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+}
+trace_header_t;
+
+/*
+Starts the writer thread, does nothing if it's already running. With a
+window of 0 all records are written, otherwise the records of the last window
+frames are kept in memory and written only when a frame is flagged as slow.
+*/
+void trace_start(unsigned window);
+
+/* Drains all pending records and stops the writer thread */
+void trace_stop(void);
+
+/*
+Writes the last records in the ring to path if the process gets a SIGSEGV,
+SIGABRT or SIGBUS. The file is opened here and written with write() from the
+signal handler, so the dump survives a corrupted heap. The handlers that were
+installed before are called after the dump, and put back by trace_stop.
+*/
+void trace_crash_dump(char const* path, unsigned records);
+
+uint64_t trace_now(void);
+
+void trace_call(trace_id_t id, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t result);
+void trace_run(uint64_t duration, bool slow);
+void trace_call_string(trace_id_t id, uint64_t arg0, uint64_t arg1, char const* str);
+void trace_env(unsigned cmd, void const* data, uint64_t value, bool result);
+void trace_env_string(unsigned cmd, void const* data, char const* str, bool result);
+void trace_field(char const* name, unsigned index, trace_kind_t kind, uint64_t value, uint64_t extra);
+void trace_field_string(char const* name, unsigned index, char const* str);
+void trace_field_double(char const* name, unsigned index, double value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
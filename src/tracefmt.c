@@ -0,0 +1,865 @@
+/*
+MIT License
+
+Copyright (c) 2021 Andre Leiradella
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "tracefmt.h"
+#include "libretro.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define TAG "[LRPROXY] "
+
+#define PTR(v) ((void*)(uintptr_t)(v))
+#define STR(s) ((s) != NULL ? (s) : "(null)")
+
+static char const* pixel_format_str(enum retro_pixel_format const format) {
+    static char unknown[32];
+
+    switch (format) {
+        case RETRO_PIXEL_FORMAT_0RGB1555: return "RETRO_PIXEL_FORMAT_0RGB1555";
+        case RETRO_PIXEL_FORMAT_XRGB8888: return "RETRO_PIXEL_FORMAT_XRGB8888";
+        case RETRO_PIXEL_FORMAT_RGB565: return "RETRO_PIXEL_FORMAT_RGB565";
+        case RETRO_PIXEL_FORMAT_UNKNOWN: return "RETRO_PIXEL_FORMAT_UNKNOWN";
+
+        default:
+            snprintf(unknown, sizeof(unknown), "%d", format);
+            return unknown;
+    }
+}
+
+static char const* device_str(unsigned const device) {
+    static char unknown[32];
+
+    switch (device & RETRO_DEVICE_MASK) {
+        case RETRO_DEVICE_NONE: return "RETRO_DEVICE_NONE";
+        case RETRO_DEVICE_JOYPAD: return "RETRO_DEVICE_JOYPAD";
+        case RETRO_DEVICE_MOUSE: return "RETRO_DEVICE_MOUSE";
+        case RETRO_DEVICE_KEYBOARD: return "RETRO_DEVICE_KEYBOARD";
+        case RETRO_DEVICE_LIGHTGUN: return "RETRO_DEVICE_LIGHTGUN";
+        case RETRO_DEVICE_ANALOG: return "RETRO_DEVICE_ANALOG";
+        case RETRO_DEVICE_POINTER: return "RETRO_DEVICE_POINTER";
+
+        default:
+            snprintf(unknown, sizeof(unknown), "%u", device & RETRO_DEVICE_MASK);
+            return unknown;
+    }
+}
+
+static char const* device_index_str(unsigned const device, unsigned const index) {
+    static char unknown[32];
+
+    if (device == RETRO_DEVICE_ANALOG) {
+        switch (index) {
+            case RETRO_DEVICE_INDEX_ANALOG_LEFT: return "RETRO_DEVICE_INDEX_ANALOG_LEFT";
+            case RETRO_DEVICE_INDEX_ANALOG_RIGHT: return "RETRO_DEVICE_INDEX_ANALOG_RIGHT";
+            case RETRO_DEVICE_INDEX_ANALOG_BUTTON: return "RETRO_DEVICE_INDEX_ANALOG_BUTTON";
+        }
+    }
+
+    snprintf(unknown, sizeof(unknown), "%u", index);
+    return unknown;
+}
+
+static char const* device_id_str(unsigned const device, unsigned const id) {
+    static char unknown[32];
+
+    switch (device & RETRO_DEVICE_MASK) {
+        case RETRO_DEVICE_JOYPAD:
+            switch (id) {
+                case RETRO_DEVICE_ID_JOYPAD_B: return "RETRO_DEVICE_ID_JOYPAD_B";
+                case RETRO_DEVICE_ID_JOYPAD_Y: return "RETRO_DEVICE_ID_JOYPAD_Y";
+                case RETRO_DEVICE_ID_JOYPAD_SELECT: return "RETRO_DEVICE_ID_JOYPAD_SELECT";
+                case RETRO_DEVICE_ID_JOYPAD_START: return "RETRO_DEVICE_ID_JOYPAD_START";
+                case RETRO_DEVICE_ID_JOYPAD_UP: return "RETRO_DEVICE_ID_JOYPAD_UP";
+                case RETRO_DEVICE_ID_JOYPAD_DOWN: return "RETRO_DEVICE_ID_JOYPAD_DOWN";
+                case RETRO_DEVICE_ID_JOYPAD_LEFT: return "RETRO_DEVICE_ID_JOYPAD_LEFT";
+                case RETRO_DEVICE_ID_JOYPAD_RIGHT: return "RETRO_DEVICE_ID_JOYPAD_RIGHT";
+                case RETRO_DEVICE_ID_JOYPAD_A: return "RETRO_DEVICE_ID_JOYPAD_A";
+                case RETRO_DEVICE_ID_JOYPAD_X: return "RETRO_DEVICE_ID_JOYPAD_X";
+                case RETRO_DEVICE_ID_JOYPAD_L: return "RETRO_DEVICE_ID_JOYPAD_L";
+                case RETRO_DEVICE_ID_JOYPAD_R: return "RETRO_DEVICE_ID_JOYPAD_R";
+                case RETRO_DEVICE_ID_JOYPAD_L2: return "RETRO_DEVICE_ID_JOYPAD_L2";
+                case RETRO_DEVICE_ID_JOYPAD_R2: return "RETRO_DEVICE_ID_JOYPAD_R2";
+                case RETRO_DEVICE_ID_JOYPAD_L3: return "RETRO_DEVICE_ID_JOYPAD_L3";
+                case RETRO_DEVICE_ID_JOYPAD_R3: return "RETRO_DEVICE_ID_JOYPAD_R3";
+            }
+
+            break;
+
+        case RETRO_DEVICE_MOUSE:
+            switch (id) {
+                case RETRO_DEVICE_ID_MOUSE_X: return "RETRO_DEVICE_ID_MOUSE_X";
+                case RETRO_DEVICE_ID_MOUSE_Y: return "RETRO_DEVICE_ID_MOUSE_Y";
+                case RETRO_DEVICE_ID_MOUSE_LEFT: return "RETRO_DEVICE_ID_MOUSE_LEFT";
+                case RETRO_DEVICE_ID_MOUSE_RIGHT: return "RETRO_DEVICE_ID_MOUSE_RIGHT";
+                case RETRO_DEVICE_ID_MOUSE_WHEELUP: return "RETRO_DEVICE_ID_MOUSE_WHEELUP";
+                case RETRO_DEVICE_ID_MOUSE_WHEELDOWN: return "RETRO_DEVICE_ID_MOUSE_WHEELDOWN";
+                case RETRO_DEVICE_ID_MOUSE_MIDDLE: return "RETRO_DEVICE_ID_MOUSE_MIDDLE";
+                case RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELUP: return "RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELUP";
+                case RETRO_DEVICE_ID_MOUSE_BUTTON_4: return "RETRO_DEVICE_ID_MOUSE_BUTTON_4";
+                case RETRO_DEVICE_ID_MOUSE_BUTTON_5: return "RETRO_DEVICE_ID_MOUSE_BUTTON_5";
+            }
+
+            break;
+
+        case RETRO_DEVICE_LIGHTGUN:
+            switch (id) {
+                case RETRO_DEVICE_ID_LIGHTGUN_SCREEN_X: return "RETRO_DEVICE_ID_LIGHTGUN_SCREEN_X";
+                case RETRO_DEVICE_ID_LIGHTGUN_SCREEN_Y: return "RETRO_DEVICE_ID_LIGHTGUN_SCREEN_Y";
+                case RETRO_DEVICE_ID_LIGHTGUN_IS_OFFSCREEN: return "RETRO_DEVICE_ID_LIGHTGUN_IS_OFFSCREEN";
+                case RETRO_DEVICE_ID_LIGHTGUN_TRIGGER: return "RETRO_DEVICE_ID_LIGHTGUN_TRIGGER";
+                case RETRO_DEVICE_ID_LIGHTGUN_RELOAD: return "RETRO_DEVICE_ID_LIGHTGUN_RELOAD";
+                case RETRO_DEVICE_ID_LIGHTGUN_AUX_A: return "RETRO_DEVICE_ID_LIGHTGUN_AUX_A";
+                case RETRO_DEVICE_ID_LIGHTGUN_AUX_B: return "RETRO_DEVICE_ID_LIGHTGUN_AUX_B";
+                case RETRO_DEVICE_ID_LIGHTGUN_START: return "RETRO_DEVICE_ID_LIGHTGUN_START";
+                case RETRO_DEVICE_ID_LIGHTGUN_SELECT: return "RETRO_DEVICE_ID_LIGHTGUN_SELECT";
+                case RETRO_DEVICE_ID_LIGHTGUN_AUX_C: return "RETRO_DEVICE_ID_LIGHTGUN_AUX_C";
+                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_UP: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_UP";
+                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_DOWN: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_DOWN";
+                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_LEFT: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_LEFT";
+                case RETRO_DEVICE_ID_LIGHTGUN_DPAD_RIGHT: return "RETRO_DEVICE_ID_LIGHTGUN_DPAD_RIGHT";
+                case RETRO_DEVICE_ID_LIGHTGUN_X: return "RETRO_DEVICE_ID_LIGHTGUN_X";
+                case RETRO_DEVICE_ID_LIGHTGUN_Y: return "RETRO_DEVICE_ID_LIGHTGUN_Y";
+                case RETRO_DEVICE_ID_LIGHTGUN_PAUSE: return "RETRO_DEVICE_ID_LIGHTGUN_PAUSE";
+            }
+
+            break;
+
+        case RETRO_DEVICE_ANALOG:
+            switch (id) {
+                case RETRO_DEVICE_ID_ANALOG_X: return "RETRO_DEVICE_ID_ANALOG_X";
+                case RETRO_DEVICE_ID_ANALOG_Y: return "RETRO_DEVICE_ID_ANALOG_Y";
+            }
+
+            break;
+
+        case RETRO_DEVICE_POINTER:
+            switch (id) {
+                case RETRO_DEVICE_ID_POINTER_X: return "RETRO_DEVICE_ID_POINTER_X";
+                case RETRO_DEVICE_ID_POINTER_Y: return "RETRO_DEVICE_ID_POINTER_Y";
+                case RETRO_DEVICE_ID_POINTER_PRESSED: return "RETRO_DEVICE_ID_POINTER_PRESSED";
+                case RETRO_DEVICE_ID_POINTER_COUNT: return "RETRO_DEVICE_ID_POINTER_COUNT";
+            }
+
+            break;
+    }
+
+    snprintf(unknown, sizeof(unknown), "%u", id);
+    return unknown;
+}
+
+static char const* hw_context_type_str(enum retro_hw_context_type const ctxtype)
+{
+    static char unknown[32];
+
+    switch (ctxtype) {
+        case RETRO_HW_CONTEXT_NONE: return "RETRO_HW_CONTEXT_NONE";
+        case RETRO_HW_CONTEXT_OPENGL: return "RETRO_HW_CONTEXT_OPENGL";
+        case RETRO_HW_CONTEXT_OPENGLES2: return "RETRO_HW_CONTEXT_OPENGLES2";
+        case RETRO_HW_CONTEXT_OPENGL_CORE: return "RETRO_HW_CONTEXT_OPENGL_CORE";
+        case RETRO_HW_CONTEXT_OPENGLES3: return "RETRO_HW_CONTEXT_OPENGLES3";
+        case RETRO_HW_CONTEXT_OPENGLES_VERSION: return "RETRO_HW_CONTEXT_OPENGLES_VERSION";
+        case RETRO_HW_CONTEXT_VULKAN: return "RETRO_HW_CONTEXT_VULKAN";
+        case RETRO_HW_CONTEXT_DIRECT3D: return "RETRO_HW_CONTEXT_DIRECT3D";
+        case RETRO_HW_CONTEXT_DUMMY: return "RETRO_HW_CONTEXT_DUMMY";
+
+        default:
+            snprintf(unknown, sizeof(unknown), "%d", ctxtype);
+            return unknown;
+    }
+}
+
+static char const* env_command_str(unsigned const cmd) {
+    switch (cmd) {
+        case RETRO_ENVIRONMENT_SET_ROTATION: return "RETRO_ENVIRONMENT_SET_ROTATION";
+        case RETRO_ENVIRONMENT_GET_OVERSCAN: return "RETRO_ENVIRONMENT_GET_OVERSCAN";
+        case RETRO_ENVIRONMENT_GET_CAN_DUPE: return "RETRO_ENVIRONMENT_GET_CAN_DUPE";
+        case RETRO_ENVIRONMENT_SET_MESSAGE: return "RETRO_ENVIRONMENT_SET_MESSAGE";
+        case RETRO_ENVIRONMENT_SHUTDOWN: return "RETRO_ENVIRONMENT_SHUTDOWN";
+        case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL: return "RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL";
+        case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY: return "RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY";
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT: return "RETRO_ENVIRONMENT_SET_PIXEL_FORMAT";
+        case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS: return "RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS";
+        case RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK: return "RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK";
+        case RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE: return "RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE";
+        case RETRO_ENVIRONMENT_SET_HW_RENDER: return "RETRO_ENVIRONMENT_SET_HW_RENDER";
+        case RETRO_ENVIRONMENT_GET_VARIABLE: return "RETRO_ENVIRONMENT_GET_VARIABLE";
+        case RETRO_ENVIRONMENT_SET_VARIABLES: return "RETRO_ENVIRONMENT_SET_VARIABLES";
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE: return "RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE";
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME: return "RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME";
+        case RETRO_ENVIRONMENT_GET_LIBRETRO_PATH: return "RETRO_ENVIRONMENT_GET_LIBRETRO_PATH";
+        case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK: return "RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK";
+        case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK: return "RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK";
+        case RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE: return "RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES: return "RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES";
+        case RETRO_ENVIRONMENT_GET_SENSOR_INTERFACE: return "RETRO_ENVIRONMENT_GET_SENSOR_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE: return "RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_LOG_INTERFACE: return "RETRO_ENVIRONMENT_GET_LOG_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_PERF_INTERFACE: return "RETRO_ENVIRONMENT_GET_PERF_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_LOCATION_INTERFACE: return "RETRO_ENVIRONMENT_GET_LOCATION_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_CORE_ASSETS_DIRECTORY: return "RETRO_ENVIRONMENT_GET_CORE_ASSETS_DIRECTORY";
+        case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY: return "RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY";
+        case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO: return "RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO";
+        case RETRO_ENVIRONMENT_SET_PROC_ADDRESS_CALLBACK: return "RETRO_ENVIRONMENT_SET_PROC_ADDRESS_CALLBACK";
+        case RETRO_ENVIRONMENT_SET_SUBSYSTEM_INFO: return "RETRO_ENVIRONMENT_SET_SUBSYSTEM_INFO";
+        case RETRO_ENVIRONMENT_SET_CONTROLLER_INFO: return "RETRO_ENVIRONMENT_SET_CONTROLLER_INFO";
+        case RETRO_ENVIRONMENT_SET_MEMORY_MAPS: return "RETRO_ENVIRONMENT_SET_MEMORY_MAPS";
+        case RETRO_ENVIRONMENT_SET_GEOMETRY: return "RETRO_ENVIRONMENT_SET_GEOMETRY";
+        case RETRO_ENVIRONMENT_GET_USERNAME: return "RETRO_ENVIRONMENT_GET_USERNAME";
+        case RETRO_ENVIRONMENT_GET_LANGUAGE: return "RETRO_ENVIRONMENT_GET_LANGUAGE";
+        case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER: return "RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER";
+        case RETRO_ENVIRONMENT_GET_HW_RENDER_INTERFACE: return "RETRO_ENVIRONMENT_GET_HW_RENDER_INTERFACE";
+        case RETRO_ENVIRONMENT_SET_SUPPORT_ACHIEVEMENTS: return "RETRO_ENVIRONMENT_SET_SUPPORT_ACHIEVEMENTS";
+        case RETRO_ENVIRONMENT_SET_HW_RENDER_CONTEXT_NEGOTIATION_INTERFACE: return "RETRO_ENVIRONMENT_SET_HW_RENDER_CONTEXT_NEGOTIATION_INTERFACE";
+        case RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS: return "RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS";
+        case RETRO_ENVIRONMENT_SET_HW_SHARED_CONTEXT: return "RETRO_ENVIRONMENT_SET_HW_SHARED_CONTEXT";
+        case RETRO_ENVIRONMENT_GET_VFS_INTERFACE: return "RETRO_ENVIRONMENT_GET_VFS_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_LED_INTERFACE: return "RETRO_ENVIRONMENT_GET_LED_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE: return "RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE";
+        case RETRO_ENVIRONMENT_GET_MIDI_INTERFACE: return "RETRO_ENVIRONMENT_GET_MIDI_INTERFACE";
+        case RETRO_ENVIRONMENT_GET_FASTFORWARDING: return "RETRO_ENVIRONMENT_GET_FASTFORWARDING";
+        case RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE: return "RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE";
+        case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS: return "RETRO_ENVIRONMENT_GET_INPUT_BITMASKS";
+        case RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION: return "RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION";
+        case RETRO_ENVIRONMENT_SET_CORE_OPTIONS: return "RETRO_ENVIRONMENT_SET_CORE_OPTIONS";
+        case RETRO_ENVIRONMENT_SET_CORE_OPTIONS_INTL: return "RETRO_ENVIRONMENT_SET_CORE_OPTIONS_INTL";
+        case RETRO_ENVIRONMENT_SET_CORE_OPTIONS_DISPLAY: return "RETRO_ENVIRONMENT_SET_CORE_OPTIONS_DISPLAY";
+        case RETRO_ENVIRONMENT_GET_PREFERRED_HW_RENDER: return "RETRO_ENVIRONMENT_GET_PREFERRED_HW_RENDER";
+        case RETRO_ENVIRONMENT_GET_DISK_CONTROL_INTERFACE_VERSION: return "RETRO_ENVIRONMENT_GET_DISK_CONTROL_INTERFACE_VERSION";
+        case RETRO_ENVIRONMENT_SET_DISK_CONTROL_EXT_INTERFACE: return "RETRO_ENVIRONMENT_SET_DISK_CONTROL_EXT_INTERFACE";
+
+        default: return NULL;
+    }
+}
+
+static char const* device_capabilities_str(uint64_t const caps, char* const buf, size_t const size) {
+    static struct {unsigned device; char const* name;} const devices[] = {
+        {RETRO_DEVICE_JOYPAD, "RETRO_DEVICE_JOYPAD"},
+        {RETRO_DEVICE_MOUSE, "RETRO_DEVICE_MOUSE"},
+        {RETRO_DEVICE_KEYBOARD, "RETRO_DEVICE_KEYBOARD"},
+        {RETRO_DEVICE_LIGHTGUN, "RETRO_DEVICE_LIGHTGUN"},
+        {RETRO_DEVICE_ANALOG, "RETRO_DEVICE_ANALOG"},
+        {RETRO_DEVICE_POINTER, "RETRO_DEVICE_POINTER"}
+    };
+
+    size_t length = 0;
+    buf[0] = 0;
+
+    if (caps == 0) {
+        snprintf(buf, size, "-");
+        return buf;
+    }
+
+    for (size_t i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        if ((caps & (1 << devices[i].device)) != 0 && length < size) {
+            length += snprintf(buf + length, size - length, "%s%s", length != 0 ? " " : "", devices[i].name);
+        }
+    }
+
+    return buf;
+}
+
+static void log_environment(FILE* const out, trace_record_t const* const rec, char const* const str) {
+    void* const data = PTR(rec->u.call.args[0]);
+    uint64_t const value = rec->u.call.args[1];
+    int const result = (int)rec->u.call.result;
+
+    switch (rec->aux) {
+        case RETRO_ENVIRONMENT_SET_ROTATION:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_ROTATION(%u) = %d\n", (unsigned)value, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_OVERSCAN:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_OVERSCAN() = %d, %d\n", (int)value, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_CAN_DUPE() = %d, %d\n", (int)value, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_MESSAGE:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_MESSAGE(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SHUTDOWN:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SHUTDOWN() = %d\n", result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL(%u) = %d\n", (unsigned)value, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY() = \"%s\", %d\n", STR(str), result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_PIXEL_FORMAT(%s) = %d\n", pixel_format_str((enum retro_pixel_format)value), result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_HW_RENDER:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_HW_RENDER(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_VARIABLE:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_VARIABLE() = %p, %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_VARIABLES:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_VARIABLES(%p), %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE() = %d, %d\n", (int)value, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME(%d) = %d\n", (int)value, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_LIBRETRO_PATH:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_LIBRETRO_PATH() = \"%s\", %d\n", STR(str), result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK(%p) = %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE() = %p, %d\n", data, result);
+            break;
+
+        case RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES:
+            fprintf(out, TAG "RETRO_ENVIRONMENT_GET_INPUT_DEVICE_CAPABILITIES() = %02" PRIx64 ", %d\n", value, result);
+            break;
+
+        default:
+            fprintf(out, TAG "Unknown environment call (%u, %p) = %d\n", rec->aux, data, result);
+            break;
+    }
+}
+
+/* Renders the value of a TRACE_FIELD record the way it appears after the = in the text log, minus the quotes around strings */
+static char const* field_value_str(trace_record_t const* const rec, char const* const str, char* const buf, size_t const size) {
+    uint64_t const value = rec->u.field.value;
+    uint64_t const extra = rec->u.field.extra;
+
+    switch (rec->kind) {
+        case TRACE_KIND_UINT: snprintf(buf, size, "%u", (unsigned)value); break;
+        case TRACE_KIND_INT: snprintf(buf, size, "%d", (int)value); break;
+        case TRACE_KIND_INT64: snprintf(buf, size, "%" PRId64, (int64_t)value); break;
+        case TRACE_KIND_SIZE: snprintf(buf, size, "%" PRIu64, value); break;
+        case TRACE_KIND_BOOL: snprintf(buf, size, "%d", (int)value); break;
+        case TRACE_KIND_PTR: snprintf(buf, size, "%p", PTR(value)); break;
+        case TRACE_KIND_STRING: return STR(str);
+
+        case TRACE_KIND_DOUBLE: {
+            double d;
+            memcpy(&d, &value, sizeof(d));
+            snprintf(buf, size, "%f", d);
+            break;
+        }
+
+        case TRACE_KIND_PIXEL_FORMAT:
+            return pixel_format_str((enum retro_pixel_format)value);
+
+        case TRACE_KIND_DEVICE:
+            snprintf(buf, size, "%u << RETRO_DEVICE_TYPE_SHIFT | %s", (unsigned)value >> RETRO_DEVICE_TYPE_SHIFT, device_str((unsigned)value));
+            break;
+
+        case TRACE_KIND_DEVICE_INDEX:
+            return device_index_str((unsigned)extra, (unsigned)value);
+
+        case TRACE_KIND_DEVICE_ID:
+            return device_id_str((unsigned)extra, (unsigned)value);
+
+        case TRACE_KIND_HW_CONTEXT_TYPE:
+            return hw_context_type_str((enum retro_hw_context_type)value);
+
+        case TRACE_KIND_DEVICE_CAPABILITIES:
+            return device_capabilities_str(value, buf, size);
+
+        default:
+            snprintf(buf, size, "0x%016" PRIx64, value);
+            break;
+    }
+
+    return buf;
+}
+
+static void log_field(FILE* const out, trace_record_t const* const rec, char const* const str) {
+    char buf[256];
+    char const* const value = field_value_str(rec, str, buf, sizeof(buf));
+
+    if (rec->kind == TRACE_KIND_DEVICE_CAPABILITIES) {
+        fprintf(out, TAG "    = %s\n", value);
+        return;
+    }
+
+    if (rec->aux == TRACE_NO_INDEX) {
+        fprintf(out, TAG "    ->%.*s = ", TRACE_NAME_SIZE, rec->u.field.name);
+    }
+    else {
+        fprintf(out, TAG "    [%u].%.*s = ", rec->aux, TRACE_NAME_SIZE, rec->u.field.name);
+    }
+
+    fprintf(out, rec->kind == TRACE_KIND_STRING ? "\"%s\"\n" : "%s\n", value);
+}
+
+static void log_record(FILE* const out, trace_record_t const* const rec, char const* const str) {
+    uint64_t const* const args = rec->u.call.args;
+    uint64_t const result = rec->u.call.result;
+
+    switch (rec->id) {
+        case TRACE_RETRO_INIT:
+            fprintf(out, TAG "retro_init()\n");
+            break;
+
+        case TRACE_RETRO_DEINIT:
+            fprintf(out, TAG "retro_deinit()\n");
+            break;
+
+        case TRACE_RETRO_API_VERSION:
+            fprintf(out, TAG "retro_api_version() = %u\n", (unsigned)result);
+            break;
+
+        case TRACE_RETRO_GET_SYSTEM_INFO:
+            fprintf(out, TAG "retro_get_system_info(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_GET_SYSTEM_AV_INFO:
+            fprintf(out, TAG "retro_get_system_av_info(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_ENVIRONMENT:
+            fprintf(out, TAG "retro_set_environment(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_VIDEO_REFRESH:
+            fprintf(out, TAG "retro_set_video_refresh(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_AUDIO_SAMPLE:
+            fprintf(out, TAG "retro_set_audio_sample(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH:
+            fprintf(out, TAG "retro_set_audio_sample_batch(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_INPUT_POLL:
+            fprintf(out, TAG "retro_set_input_poll(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_INPUT_STATE:
+            fprintf(out, TAG "retro_set_input_state(%p)\n", PTR(args[0]));
+            break;
+
+        case TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE:
+            fprintf(out, TAG "retro_set_controller_port_device(%u, %u)\n", (unsigned)args[0], (unsigned)args[1]);
+            break;
+
+        case TRACE_RETRO_RESET:
+            fprintf(out, TAG "retro_reset()\n");
+            break;
+
+        case TRACE_RETRO_RUN:
+            if ((rec->aux & TRACE_RUN_SLOW) != 0) {
+                fprintf(out, TAG "retro_run() slow frame, %.2f us\n", args[0] / 1000.0);
+            }
+            else {
+                fprintf(out, TAG "retro_run()\n");
+            }
+
+            break;
+
+        case TRACE_RETRO_SERIALIZE_SIZE:
+            fprintf(out, TAG "retro_serialize_size() = %" PRIu64 "\n", result);
+            break;
+
+        case TRACE_RETRO_SERIALIZE:
+            fprintf(out, TAG "retro_serialize(%p, %" PRIu64 ") = %d\n", PTR(args[0]), args[1], (int)result);
+            break;
+
+        case TRACE_RETRO_UNSERIALIZE:
+            fprintf(out, TAG "retro_unserialize(%p, %" PRIu64 ") = %d\n", PTR(args[0]), args[1], (int)result);
+            break;
+
+        case TRACE_RETRO_CHEAT_RESET:
+            fprintf(out, TAG "retro_cheat_reset()\n");
+            break;
+
+        case TRACE_RETRO_CHEAT_SET:
+            fprintf(out, TAG "retro_cheat_set(%u, %d, \"%s\")\n", (unsigned)args[0], (int)args[1], STR(str));
+            break;
+
+        case TRACE_RETRO_LOAD_GAME:
+            fprintf(out, TAG "retro_load_game(%p) = %d\n", PTR(args[0]), (int)result);
+            break;
+
+        case TRACE_RETRO_LOAD_GAME_SPECIAL:
+            fprintf(out, TAG "retro_load_game_special(%u, %p, %" PRIu64 ") = %d\n", (unsigned)args[0], PTR(args[1]), args[2], (int)result);
+            break;
+
+        case TRACE_RETRO_UNLOAD_GAME:
+            fprintf(out, TAG "retro_unload_game()\n");
+            break;
+
+        case TRACE_RETRO_GET_REGION:
+            fprintf(out, TAG "retro_get_region() = %u\n", (unsigned)result);
+            break;
+
+        case TRACE_RETRO_GET_MEMORY_DATA:
+            fprintf(out, TAG "retro_get_memory_data(%u) = %p\n", (unsigned)args[0], PTR(result));
+            break;
+
+        case TRACE_RETRO_GET_MEMORY_SIZE:
+            fprintf(out, TAG "retro_get_memory_size(%u) = %" PRIu64 "\n", (unsigned)args[0], result);
+            break;
+
+        case TRACE_ENVIRONMENT:
+            log_environment(out, rec, str);
+            break;
+
+        case TRACE_FIELD:
+            log_field(out, rec, str);
+            break;
+
+        case TRACE_DROPPED:
+            fprintf(out, TAG "%" PRIu64 " trace records dropped, the writer couldn't keep up\n", args[0]);
+            break;
+
+        default:
+            fprintf(out, TAG "Unknown trace record %u\n", rec->id);
+            break;
+    }
+}
+
+static struct {
+    char const* name;
+    unsigned args;
+    bool result;
+}
+const s_calls[TRACE_COUNT] = {
+    [TRACE_RETRO_INIT] = {"retro_init", 0, false},
+    [TRACE_RETRO_DEINIT] = {"retro_deinit", 0, false},
+    [TRACE_RETRO_API_VERSION] = {"retro_api_version", 0, true},
+    [TRACE_RETRO_GET_SYSTEM_INFO] = {"retro_get_system_info", 1, false},
+    [TRACE_RETRO_GET_SYSTEM_AV_INFO] = {"retro_get_system_av_info", 1, false},
+    [TRACE_RETRO_SET_ENVIRONMENT] = {"retro_set_environment", 1, false},
+    [TRACE_RETRO_SET_VIDEO_REFRESH] = {"retro_set_video_refresh", 1, false},
+    [TRACE_RETRO_SET_AUDIO_SAMPLE] = {"retro_set_audio_sample", 1, false},
+    [TRACE_RETRO_SET_AUDIO_SAMPLE_BATCH] = {"retro_set_audio_sample_batch", 1, false},
+    [TRACE_RETRO_SET_INPUT_POLL] = {"retro_set_input_poll", 1, false},
+    [TRACE_RETRO_SET_INPUT_STATE] = {"retro_set_input_state", 1, false},
+    [TRACE_RETRO_SET_CONTROLLER_PORT_DEVICE] = {"retro_set_controller_port_device", 2, false},
+    [TRACE_RETRO_RESET] = {"retro_reset", 0, false},
+    [TRACE_RETRO_RUN] = {"retro_run", 1, false}, /* frame duration */
+    [TRACE_RETRO_SERIALIZE_SIZE] = {"retro_serialize_size", 0, true},
+    [TRACE_RETRO_SERIALIZE] = {"retro_serialize", 2, true},
+    [TRACE_RETRO_UNSERIALIZE] = {"retro_unserialize", 2, true},
+    [TRACE_RETRO_CHEAT_RESET] = {"retro_cheat_reset", 0, false},
+    [TRACE_RETRO_CHEAT_SET] = {"retro_cheat_set", 2, false},
+    [TRACE_RETRO_LOAD_GAME] = {"retro_load_game", 1, true},
+    [TRACE_RETRO_LOAD_GAME_SPECIAL] = {"retro_load_game_special", 3, true},
+    [TRACE_RETRO_UNLOAD_GAME] = {"retro_unload_game", 0, false},
+    [TRACE_RETRO_GET_REGION] = {"retro_get_region", 0, true},
+    [TRACE_RETRO_GET_MEMORY_DATA] = {"retro_get_memory_data", 1, true},
+    [TRACE_RETRO_GET_MEMORY_SIZE] = {"retro_get_memory_size", 1, true},
+    [TRACE_ENVIRONMENT] = {"environment", 2, true},
+    [TRACE_FIELD] = {"field", 0, false},
+    [TRACE_DROPPED] = {"dropped", 1, false}
+};
+
+static char const* record_name(unsigned const id) {
+    return id < TRACE_COUNT && s_calls[id].name != NULL ? s_calls[id].name : "unknown";
+}
+
+/* Field names are padded to align the text log */
+static int field_name_length(trace_record_t const* const rec) {
+    int length = 0;
+
+    while (length < TRACE_NAME_SIZE && rec->u.field.name[length] != 0 && rec->u.field.name[length] != ' ') {
+        length++;
+    }
+
+    return length;
+}
+
+static void json_string(FILE* const out, char const* str) {
+    if (str == NULL) {
+        fputs("null", out);
+        return;
+    }
+
+    fputc('"', out);
+
+    for (; *str != 0; str++) {
+        unsigned char const c = (unsigned char)*str;
+
+        switch (c) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+
+            default:
+                if (c < 0x20) {
+                    fprintf(out, "\\u%04x", c);
+                }
+                else {
+                    fputc(c, out);
+                }
+
+                break;
+        }
+    }
+
+    fputc('"', out);
+}
+
+static void json_record(tracefmt_t* const fmt, trace_record_t const* const rec, char const* const str) {
+    FILE* const out = fmt->out;
+    uint64_t const time = rec->u.call.time - fmt->first;
+
+    fprintf(out, "{\"time\":%" PRIu64 ",\"record\":\"%s\"", time, record_name(rec->id));
+
+    if (rec->id == TRACE_FIELD) {
+        char buf[256];
+        char const* const value = field_value_str(rec, str, buf, sizeof(buf));
+
+        fprintf(out, ",\"name\":\"%.*s\"", field_name_length(rec), rec->u.field.name);
+
+        if (rec->aux != TRACE_NO_INDEX) {
+            fprintf(out, ",\"index\":%u", rec->aux);
+        }
+
+        if (rec->kind == TRACE_KIND_STRING) {
+            fputs(",\"value\":", out);
+            json_string(out, str);
+        }
+        else {
+            fprintf(out, ",\"value\":%" PRIu64 ",\"text\":", rec->u.field.value);
+            json_string(out, value);
+        }
+    }
+    else {
+        if (rec->id == TRACE_ENVIRONMENT) {
+            fprintf(out, ",\"cmd\":%u,\"command\":", rec->aux);
+            json_string(out, env_command_str(rec->aux));
+        }
+
+        unsigned const count = rec->id < TRACE_COUNT ? s_calls[rec->id].args : 0;
+        fputs(",\"args\":[", out);
+
+        for (unsigned i = 0; i < count; i++) {
+            fprintf(out, "%s%" PRIu64, i != 0 ? "," : "", rec->u.call.args[i]);
+        }
+
+        fputc(']', out);
+
+        if (rec->id < TRACE_COUNT && s_calls[rec->id].result) {
+            fprintf(out, ",\"result\":%" PRIu64, rec->u.call.result);
+        }
+
+        if (rec->length != 0) {
+            fputs(",\"string\":", out);
+            json_string(out, str);
+        }
+    }
+
+    fputs("}\n", out);
+}
+
+static void csv_string(FILE* const out, char const* str) {
+    if (str == NULL) {
+        return;
+    }
+
+    fputc('"', out);
+
+    for (; *str != 0; str++) {
+        if (*str == '"') {
+            fputc('"', out);
+        }
+
+        fputc(*str, out);
+    }
+
+    fputc('"', out);
+}
+
+static void csv_record(tracefmt_t* const fmt, trace_record_t const* const rec, char const* const str) {
+    FILE* const out = fmt->out;
+    uint64_t const time = rec->u.call.time - fmt->first;
+
+    fprintf(out, "%" PRIu64 ",%s,", time, record_name(rec->id));
+
+    if (rec->id == TRACE_FIELD) {
+        char buf[256];
+        char const* const value = field_value_str(rec, str, buf, sizeof(buf));
+
+        fprintf(out, ",,,,,,%.*s,", field_name_length(rec), rec->u.field.name);
+
+        if (rec->aux != TRACE_NO_INDEX) {
+            fprintf(out, "%u", rec->aux);
+        }
+
+        if (rec->kind == TRACE_KIND_STRING) {
+            fputs(",,", out);
+        }
+        else {
+            fprintf(out, ",%" PRIu64 ",", rec->u.field.value);
+        }
+
+        csv_string(out, value);
+    }
+    else {
+        if (rec->id == TRACE_ENVIRONMENT) {
+            char const* const name = env_command_str(rec->aux);
+
+            if (name != NULL) {
+                fputs(name, out);
+            }
+            else {
+                fprintf(out, "%u", rec->aux);
+            }
+        }
+
+        unsigned const count = rec->id < TRACE_COUNT ? s_calls[rec->id].args : 0;
+
+        for (unsigned i = 0; i < 4; i++) {
+            if (i < count) {
+                fprintf(out, ",%" PRIu64, rec->u.call.args[i]);
+            }
+            else {
+                fputc(',', out);
+            }
+        }
+
+        if (rec->id < TRACE_COUNT && s_calls[rec->id].result) {
+            fprintf(out, ",%" PRIu64, rec->u.call.result);
+        }
+        else {
+            fputc(',', out);
+        }
+
+        fputs(",,,,", out);
+
+        if (rec->length != 0) {
+            csv_string(out, str);
+        }
+    }
+
+    fputc('\n', out);
+}
+
+static void emit(tracefmt_t* const fmt, trace_record_t const* const rec, char const* const str) {
+    if (!fmt->started) {
+        fmt->first = rec->u.call.time;
+        fmt->started = true;
+    }
+
+    switch (fmt->format) {
+        case TRACEFMT_TEXT: log_record(fmt->out, rec, str); break;
+        case TRACEFMT_JSON: json_record(fmt, rec, str); break;
+        case TRACEFMT_CSV: csv_record(fmt, rec, str); break;
+    }
+}
+
+void tracefmt_init(tracefmt_t* const fmt, FILE* const out, tracefmt_format_t const format) {
+    fmt->out = out;
+    fmt->format = format;
+    fmt->first = 0;
+    fmt->started = false;
+    fmt->pending.id = TRACE_NONE;
+    fmt->length = 0;
+
+    if (format == TRACEFMT_CSV) {
+        fputs("time,record,command,arg0,arg1,arg2,arg3,result,name,index,value,text\n", out);
+    }
+}
+
+void tracefmt_record(tracefmt_t* const fmt, trace_record_t const* const rec) {
+    if (rec->id == TRACE_TEXT) {
+        if (fmt->pending.id == TRACE_NONE) {
+            /* Continuation of a record we never saw */
+            return;
+        }
+
+        size_t const chunk = rec->length < TRACE_TEXT_SIZE ? rec->length : TRACE_TEXT_SIZE;
+
+        if (fmt->length + chunk <= TRACE_MAX_STRING) {
+            memcpy(fmt->text + fmt->length, rec->u.text, chunk);
+            fmt->length += chunk;
+        }
+
+        if (fmt->length >= fmt->pending.length) {
+            fmt->text[fmt->length] = 0;
+            emit(fmt, &fmt->pending, fmt->text);
+            fmt->pending.id = TRACE_NONE;
+        }
+
+        return;
+    }
+
+    tracefmt_finish(fmt);
+
+    if (rec->length == TRACE_NULL_STRING) {
+        emit(fmt, rec, NULL);
+    }
+    else if (rec->length != 0) {
+        fmt->pending = *rec;
+        fmt->length = 0;
+    }
+    else {
+        emit(fmt, rec, "");
+    }
+}
+
+void tracefmt_finish(tracefmt_t* const fmt) {
+    if (fmt->pending.id != TRACE_NONE) {
+        /* The string was cut short, log what we have */
+        fmt->text[fmt->length] = 0;
+        emit(fmt, &fmt->pending, fmt->text);
+        fmt->pending.id = TRACE_NONE;
+    }
+}
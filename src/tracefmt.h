@@ -0,0 +1,46 @@
+#ifndef TRACEFMT_H
+#define TRACEFMT_H
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    TRACEFMT_TEXT, /* the APILOG text */
+    TRACEFMT_JSON, /* one JSON object per line */
+    TRACEFMT_CSV
+}
+tracefmt_format_t;
+
+/* Turns a stream of trace records back into human-readable output */
+typedef struct {
+    FILE* out;
+    tracefmt_format_t format;
+
+    /* Timestamps are written relative to the first record */
+    uint64_t first;
+    bool started;
+
+    /* Record waiting for the characters of its string */
+    trace_record_t pending;
+    char text[TRACE_MAX_STRING + 1];
+    size_t length;
+}
+tracefmt_t;
+
+void tracefmt_init(tracefmt_t* fmt, FILE* out, tracefmt_format_t format);
+void tracefmt_record(tracefmt_t* fmt, trace_record_t const* rec);
+
+/* Outputs a record still waiting for the rest of its string */
+void tracefmt_finish(tracefmt_t* fmt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACEFMT_H */